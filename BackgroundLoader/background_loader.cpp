@@ -0,0 +1,209 @@
+#include "background_loader.h"
+
+#include <QFileDialog>
+#include <QFileInfo>
+#include <QMessageBox>
+#include <QSettings>
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+#include "Common/load_telemetry.h"
+#include "ElroyLogLoader/records_reader.h"
+#include "PcapLoader/byte_stream.h"
+#include "PcapLoader/mmap_pcap_reader.h"
+#include "PcapLoader/pcap_loader.h"
+#include "PcapLoader/stream_pcap_reader.h"
+
+BackgroundLoader::BackgroundLoader() : _progress(std::make_unique<LoadProgress>()) {}
+
+BackgroundLoader::~BackgroundLoader() {
+  shutdown();
+}
+
+bool BackgroundLoader::start(QStringList*){
+  QSettings settings;
+  const QString directory = settings.value("BackgroundLoader/directory", "").toString();
+  const QString path = QFileDialog::getOpenFileName(nullptr, "Load a recording in the background", directory,
+                                                    "Recordings (*.elroy_log *.pcap *.pcapng *.gz *.zst)");
+  if (path.isEmpty())
+    return false;
+  settings.setValue("BackgroundLoader/directory", QFileInfo(path).absolutePath());
+  Start(path.toStdString());
+  return true;
+}
+
+void BackgroundLoader::Start(const std::string& path){
+  shutdown();
+  _path = path;
+  _field_table = std::make_unique<FieldTable>();
+  _pipeline = std::make_unique<DecodePipeline>(*_field_table);
+  _progress = std::make_unique<LoadProgress>();
+  _pipeline->SetProgress(_progress.get());
+  _pending.clear();
+  {
+    std::lock_guard<std::mutex> lock(_error_mutex);
+    _last_error.clear();
+  }
+  _running = true;
+  _thread = std::thread(&BackgroundLoader::LoadLoop, this);
+}
+
+void BackgroundLoader::shutdown(){
+  // The pipeline finishes the ranges it started on, and LoadLoop publishes them before it returns
+  _progress->Cancel();
+  Wait();
+}
+
+void BackgroundLoader::Wait(){
+  if (_thread.joinable())
+    _thread.join();
+}
+
+std::string BackgroundLoader::LastError() const {
+  std::lock_guard<std::mutex> lock(_error_mutex);
+  return _last_error;
+}
+
+void BackgroundLoader::LoadLoop(){
+  // The pipeline calls this between batches and while it waits for one, so ranges are published on
+  // time however long the next one takes to decode
+  LoadTimer since_publish;
+  _pipeline->SetIdle([this, &since_publish](){
+    if (since_publish.Seconds() * 1000 < kPublishIntervalMs)
+      return;
+    Publish();
+    since_publish = LoadTimer();
+  });
+  auto writer = [this](DecodedBatch& batch){
+    _pending.push_back(std::move(batch.store));
+  };
+  try {
+    if (QFileInfo(QString::fromStdString(_path)).suffix() == "elroy_log")
+      LoadElroyLog(writer);
+    else
+      LoadCapture(writer);
+  } catch (const std::exception& e) {
+    std::lock_guard<std::mutex> lock(_error_mutex);
+    _last_error = e.what();
+  }
+  _pipeline->SetIdle({});
+  // Whatever was decoded before the load was stopped or failed is kept
+  Publish();
+  const bool stopped = _progress->Cancelled();
+  _running = false;
+  // Let plotjuggler know the stream is over, unless it stopped it itself
+  if (stopped)
+    return;
+  emit closed();
+  const std::string error = LastError();
+  if (!error.empty()) {
+    // Message boxes belong to the UI thread, which this streamer lives in. Without an event loop, e.g.
+    // in BackgroundLoaderExec, the error is only kept for LastError.
+    const QString text = QString::fromStdString("Could not load " + _path + ": " + error);
+    QMetaObject::invokeMethod(this, [this, text](){ QMessageBox::warning(nullptr, name(), text); },
+                              Qt::QueuedConnection);
+  }
+}
+
+void BackgroundLoader::Publish(){
+  if (_pending.empty())
+    return;
+  {
+    std::lock_guard<std::mutex> lock(mutex());
+    for (const auto& store : _pending)
+      store.TransferTo(*_field_table, dataMap());
+  }
+  _pending.clear();
+  emit dataReceived();
+}
+
+void BackgroundLoader::LoadElroyLog(const DecodePipeline::Writer& writer){
+  RecordsReader records(_path);
+  int64_t first_rowid, last_rowid;
+  if (!records.RowidRange(first_rowid, last_rowid))
+    return;
+  _progress->SetTotal(static_cast<size_t>(records.Count()));
+
+  // Partitions are claimed in rowid order, so the first rows are published first
+  std::vector<std::unique_ptr<RecordsReader>> readers(_pipeline->NumWorkers());
+  const size_t n_partitions = static_cast<size_t>((last_rowid - first_rowid) / kRowBatchSize + 1);
+  _pipeline->RunPartitioned(n_partitions,
+    [this, &readers, first_rowid, last_rowid](size_t worker, size_t partition, const DecodePipeline::RecordCallback& decode){
+      if (!readers[worker])
+        readers[worker] = std::make_unique<RecordsReader>(_path);
+      const int64_t begin = first_rowid + static_cast<int64_t>(partition * kRowBatchSize);
+      const int64_t end = std::min<int64_t>(begin + kRowBatchSize - 1, last_rowid);
+      readers[worker]->ReadRange(begin, end, [&decode](const uint8_t* data, size_t size){
+        decode(data, size, 0);
+      });
+    },
+    writer);
+}
+
+void BackgroundLoader::LoadCapture(const DecodePipeline::Writer& writer){
+  MmapPcapReader reader(_path);
+  if (!reader.Open(MmapPcapReader::Access::Partitioned)) {
+    // pcapng and compressed captures can't be split, one reader thread inflates and parses them and
+    // copies the payloads out of its buffer
+    StreamPcapReader stream_reader(ByteStream::Open(_path));
+    if (!stream_reader.Open()) {
+      if (ByteStream::HasCompressedExtension(_path))
+        throw std::runtime_error(_path + " is not a compressed capture");
+      throw std::runtime_error("Could not open pcap file: " + _path);
+    }
+    _pipeline->Run(
+      [&stream_reader](RawBatch& batch){
+        PcapPacketView packet;
+        const uint8_t* payload;
+        size_t payload_len;
+        while (batch.Size() < kPacketBatchSize){
+          if (!stream_reader.GetNextPacket(packet))
+            return false;
+          if (PcapLoader::UdpPayload(packet, payload, payload_len))
+            batch.Add(payload, payload_len, packet.capture_ts);
+        }
+        return true;
+      },
+      writer);
+    return;
+  }
+
+  // Every worker parses and decodes its own ranges of records, straight from the mapping
+  const std::vector<uint64_t> boundaries = reader.RecordBoundaries(kPacketBatchSize);
+  const size_t n_partitions = boundaries.size() - 1;
+  _progress->SetTotal(n_partitions * kPacketBatchSize);
+  _pipeline->RunPartitioned(n_partitions,
+    [&reader, &boundaries](size_t /*worker*/, size_t partition, const DecodePipeline::RecordCallback& decode){
+      PcapPacketView packet;
+      const uint8_t* payload;
+      size_t payload_len;
+      for (uint64_t offset = boundaries[partition];
+           offset < boundaries[partition + 1] && reader.PacketAt(offset, packet);
+           offset = MmapPcapReader::NextOffset(packet)){
+        if (PcapLoader::UdpPayload(packet, payload, payload_len))
+          decode(payload, payload_len, packet.capture_ts);
+      }
+    },
+    writer);
+}
+
+// Example program: run ~/build/BackgroundLoaderExec with a log or capture, e.g. one written by ecm_generator
+int main(int argc, char** argv)
+{
+  if (argc < 2) {
+    std::cout << "usage: BackgroundLoaderExec <recording>" << std::endl;
+    return 1;
+  }
+  const LoadTimer timer;
+  BackgroundLoader loader;
+  loader.Start(argv[1]);
+  loader.Wait();
+  if (!loader.LastError().empty()) {
+    std::cout << "Could not load " << argv[1] << ": " << loader.LastError() << std::endl;
+    return 1;
+  }
+  std::cout << "Loaded " << loader.Progress().Done() << " records of " << argv[1] << " in " << timer.Seconds()
+            << " s" << std::endl;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <QObject>
+#include <QtPlugin>
+#include "PlotJuggler/datastreamer_base.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Common/decode_pipeline.h"
+#include "Common/field_table.h"
+#include "Common/load_progress.h"
+#include "Common/series_store.h"
+
+using namespace PJ;
+
+// @brief Loads a finished .elroy_log or capture in the background, handing plotjuggler what is decoded
+// while the rest of the file still is.
+//
+// A DataLoader only gets its samples into plotjuggler once readDataFromFile returns, i.e. once the
+// whole file is decoded. This runs the same DecodePipeline on a thread of its own instead: the workers
+// decode ranges of the file, the load thread collects them in file order, and every
+// kPublishIntervalMs it transfers the ranges collected so far to plotjuggler under the streamer's
+// mutex. Every publication extends a prefix of the file, which for a recording is a prefix of its
+// time range, so the first minutes of a flight can be plotted while the rest is decoding. The mutex
+// is only held to transfer decoded columns, plotjuggler never waits on a decode.
+//
+// Like LogFollower this is a DataStreamer, because plotjuggler only lets streamers add to series after
+// a load. Only whole files are loaded; filters, the pcap index and the decoded cache belong to the
+// loaders. plotjuggler keeps as much of a stream as its streaming buffer holds, so set the buffer to at
+// least the length of the recording.
+class BackgroundLoader : public DataStreamer
+{
+  Q_OBJECT
+  Q_PLUGIN_METADATA(IID "facontidavide.PlotJuggler3.DataStreamer")
+  Q_INTERFACES(PJ::DataStreamer)
+
+public:
+  BackgroundLoader();
+  ~BackgroundLoader() override;
+
+  // @brief this is the entry point that plotjuggler will call. Asks for the file to load.
+  bool start(QStringList* pre_selected_sources) override;
+  // @brief Stop loading. The ranges that were decoded are still published and stay.
+  void shutdown() override;
+  bool isRunning() const override { return _running; }
+
+  virtual const char* name() const override
+  {
+    return "Elroy background load";
+  };
+
+  // @brief Start loading path without asking
+  void Start(const std::string& path);
+  // @brief Wait until the load is done or stopped
+  void Wait();
+
+  // @brief Records decoded so far and in the whole file, if it is known
+  const LoadProgress& Progress() const { return *_progress; }
+  // @brief Why the last load failed, or empty if it didn't. plotjuggler shows it in a message box once
+  // the load is over.
+  std::string LastError() const;
+
+private:
+  static constexpr int kPublishIntervalMs = 100;
+  static constexpr size_t kRowBatchSize = 512;
+  static constexpr size_t kPacketBatchSize = 256;
+
+  void LoadLoop();
+  void LoadElroyLog(const DecodePipeline::Writer& writer);
+  void LoadCapture(const DecodePipeline::Writer& writer);
+  // @brief Transfer the pending stores to plotjuggler, under the streamer's mutex
+  void Publish();
+
+  std::string _path;
+  // Fields aren't bound to dataMap(), whose series must only be touched under mutex()
+  std::unique_ptr<FieldTable> _field_table;
+  std::unique_ptr<DecodePipeline> _pipeline;
+  std::unique_ptr<LoadProgress> _progress;
+  // Stores written by the pipeline but not published yet, in file order
+  std::vector<SeriesStore> _pending;
+
+  mutable std::mutex _error_mutex;
+  std::string _last_error;
+
+  std::thread _thread;
+  std::atomic<bool> _running{false};
+};
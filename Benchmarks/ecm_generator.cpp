@@ -0,0 +1,661 @@
+// Writes synthetic ECM captures (*.pcap) and logs (*.elroy_log) of any size, so benchmarks and stress
+// tests run on inputs anyone can recreate instead of on flight data from one developer's machine.
+//
+// elroy_common_msg can only encode a message from its generated struct, so instead of encoding, the
+// generator clones the messages of a small seed recording: the first message of every type becomes the
+// template of that type. The bytes of BusObject/write_timestamp_ns and component/instance are found by
+// patching every candidate offset and decoding the result, then each generated message is a copy of its
+// template with those two fields set. All other fields keep their seed values.
+//
+// Every instance of a type sends at its own rate, with a random phase and some jitter on its write
+// timestamps. Types are spread over a number of nodes with one source IP each, and each node packs its
+// messages into datagrams (log records) of up to --per-datagram messages. A fraction of the datagrams
+// reach the capture a few datagrams late, so their messages are out of time order in the file.
+//
+// The output only depends on the seed and the options: the random numbers come from std::mt19937_64,
+// whose sequence the standard fixes, and no std:: distribution (whose output it doesn't) is used.
+//
+// Usage: ecm_generator --seed <capture or log> --output <file.pcap | file.elroy_log> [options]
+//   --types A,B,...      message types to write (default: every type in the seed)
+//   --instances N        instances of each type (default 1)
+//   --rate HZ            messages per second of each instance (default 50)
+//   --rate TYPE=HZ       rate of the instances of one type, may be repeated
+//   --per-datagram N     messages packed into each datagram or log record (default 1)
+//   --nodes N            number of sending nodes (default 4)
+//   --duration S         seconds of traffic (default 60)
+//   --out-of-order F     fraction of datagrams that arrive late (default 0)
+//   --start S            unix time of the first message (default 1700000000)
+//   --rng-seed N         seed of the random numbers (default 1)
+//
+// e.g. a ~2 GB capture for loader_benchmarks:
+//   ecm_generator --seed flight.pcap --output bench_inputs/synthetic.pcap --instances 4 --rate 100
+//                 --duration 3600 --per-datagram 8 --out-of-order 0.01
+
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <initializer_list>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <queue>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Common/field_table.h"
+#include "ElroyLogLoader/records_reader.h"
+#include "PcapLoader/byte_stream.h"
+#include "PcapLoader/pcap_loader.h"
+#include "PcapLoader/stream_pcap_reader.h"
+#include "elroy_common_msg/msg_handling/msg_decoder.h"
+
+namespace {
+using EcmMessageMap = FieldResolver::EcmMessageMap;
+
+const std::string kDelim = "/";
+const std::string kTimestampKey = "BusObject/write_timestamp_ns";
+const std::string kInstanceKey = "component/instance";
+// Largest UDP payload that fits an Ethernet frame within the 65535 byte snap length
+constexpr size_t kMaxPayload = 65535 - 14 - 20 - 8;
+// Write timestamps are moved by up to this fraction of the period, like a node that is a bit late
+constexpr double kJitter = 0.1;
+// A late datagram is captured after up to this many later datagrams
+constexpr uint64_t kMaxDelay = 16;
+constexpr int kRowsPerTransaction = 100000;
+constexpr uint16_t kPort = 5000;
+
+struct Options {
+  std::string seed_path;
+  std::string output_path;
+  std::vector<std::string> types;
+  uint32_t instances = 1;
+  double rate = 50;
+  std::map<std::string, double> type_rates;
+  size_t per_datagram = 1;
+  size_t nodes = 4;
+  double duration = 60;
+  double out_of_order = 0;
+  int64_t start = 1700000000;
+  uint64_t rng_seed = 1;
+};
+
+// @brief Where an integer field sits in the bytes of a message
+struct PatchSite {
+  size_t offset = 0;
+  size_t width = 0;
+  bool big_endian = false;
+
+  bool Found() const { return width > 0; }
+};
+
+struct Template {
+  std::string type;
+  std::vector<uint8_t> bytes;
+  PatchSite timestamp;
+  PatchSite instance;
+};
+
+uint64_t LoadInt(const uint8_t* p, size_t width, bool big_endian) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < width; ++i)
+    value |= uint64_t(p[big_endian ? width - 1 - i : i]) << (8 * i);
+  return value;
+}
+
+void StoreInt(uint8_t* p, const PatchSite& site, uint64_t value) {
+  for (size_t i = 0; i < site.width; ++i)
+    p[site.offset + (site.big_endian ? site.width - 1 - i : i)] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+void StoreBigEndian16(uint8_t* p, uint16_t value) {
+  p[0] = static_cast<uint8_t>(value >> 8);
+  p[1] = static_cast<uint8_t>(value);
+}
+
+void StoreBigEndian32(uint8_t* p, uint32_t value) {
+  StoreBigEndian16(p, static_cast<uint16_t>(value >> 16));
+  StoreBigEndian16(p + 2, static_cast<uint16_t>(value));
+}
+
+// @brief Decode the message at the start of buf. Returns the number of bytes it takes, 0 if there is none.
+size_t DecodeOne(const uint8_t* buf, size_t len, EcmMessageMap& map) {
+  map.clear();
+  size_t bytes_processed = 0;
+  elroy_common_msg::MessageDecoderResult res;
+  if (!elroy_common_msg::MsgDecoder::DecodeAsMap(buf, len, bytes_processed, map, res, kDelim) || map.empty())
+    return 0;
+  return bytes_processed;
+}
+
+// @brief Key of map ending in suffix, or nullptr
+const std::string* FindKey(const EcmMessageMap& map, const std::string& suffix) {
+  for (const auto& pair : map) {
+    const std::string& key = pair.first;
+    if (key.size() >= suffix.size() && key.compare(key.size() - suffix.size(), suffix.size(), suffix) == 0)
+      return &key;
+  }
+  return nullptr;
+}
+
+// @brief True if a and b only differ in key, where b holds expected
+bool DiffersOnlyIn(const EcmMessageMap& a, const EcmMessageMap& b, const std::string& key, double expected) {
+  if (a.size() != b.size())
+    return false;
+  for (const auto& pair : a) {
+    auto it = b.find(pair.first);
+    if (it == b.end())
+      return false;
+    if (pair.first == key) {
+      const double* value = std::get_if<double>(&it->second);
+      if (value == nullptr || *value != expected)
+        return false;
+    } else if (it->second != pair.second) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// @brief Find the bytes holding the integer field key of the message in bytes, decoded to original.
+// Every offset holding the field's value is patched to probe and decoded again; the site is the first one
+// where that changes the field to probe and nothing else.
+PatchSite FindPatchSite(const std::vector<uint8_t>& bytes, const EcmMessageMap& original, const std::string& key,
+                        std::initializer_list<size_t> widths, uint64_t probe) {
+  const double* value = std::get_if<double>(&original.at(key));
+  if (value == nullptr)
+    return {};
+  std::vector<uint8_t> patched;
+  EcmMessageMap map;
+  for (size_t width : widths) {
+    if (width < 8 && probe >> (8 * width) != 0)
+      continue;
+    for (bool big_endian : {false, true}) {
+      for (size_t offset = 0; offset + width <= bytes.size(); ++offset) {
+        // Timestamps in ns don't fit a double exactly, compare them the way the decoder converts them
+        if (static_cast<double>(LoadInt(bytes.data() + offset, width, big_endian)) != *value)
+          continue;
+        const PatchSite site{offset, width, big_endian};
+        patched = bytes;
+        StoreInt(patched.data(), site, probe);
+        if (DecodeOne(patched.data(), patched.size(), map) == bytes.size() &&
+            DiffersOnlyIn(original, map, key, static_cast<double>(probe)))
+          return site;
+      }
+      if (width == 1)
+        break;
+    }
+  }
+  return {};
+}
+
+// @brief Turn the first message of a type into a template. Returns false if its timestamp can't be found.
+bool MakeTemplate(const uint8_t* data, size_t size, const EcmMessageMap& map, Template& tmpl) {
+  tmpl.bytes.assign(data, data + size);
+  const std::string* timestamp_key = FindKey(map, kTimestampKey);
+  if (timestamp_key == nullptr)
+    return false;
+  const double* timestamp = std::get_if<double>(&map.at(*timestamp_key));
+  if (timestamp == nullptr)
+    return false;
+  // 2^20 ns is well above the precision of a double at today's timestamps
+  const uint64_t timestamp_probe = static_cast<uint64_t>(*timestamp) + (uint64_t(1) << 20);
+  tmpl.timestamp = FindPatchSite(tmpl.bytes, map, *timestamp_key, {8}, timestamp_probe);
+  if (!tmpl.timestamp.Found())
+    return false;
+  if (const std::string* instance_key = FindKey(map, kInstanceKey)) {
+    if (const double* instance = std::get_if<double>(&map.at(*instance_key))) {
+      const uint64_t probe = *instance >= 1 ? static_cast<uint64_t>(*instance) - 1 : 1;
+      tmpl.instance = FindPatchSite(tmpl.bytes, map, *instance_key, {1, 2, 4, 8}, probe);
+    }
+  }
+  return true;
+}
+
+// @brief Call fn with every ECM buffer (UDP payload or records blob) of a capture or log
+void ReadBuffers(const std::string& path, const std::function<void(const uint8_t*, size_t)>& fn) {
+  if (path.size() >= 10 && path.compare(path.size() - 10, 10, ".elroy_log") == 0) {
+    RecordsReader records(path);
+    int64_t first, last;
+    if (records.RowidRange(first, last))
+      records.ReadRange(first, last, fn);
+    return;
+  }
+  StreamPcapReader reader(ByteStream::Open(path));
+  if (!reader.Open())
+    throw std::runtime_error(path + " is neither a capture nor an elroy_log");
+  PcapPacketView packet;
+  const uint8_t* payload;
+  size_t payload_len;
+  while (reader.GetNextPacket(packet)) {
+    if (PcapLoader::UdpPayload(packet, payload, payload_len))
+      fn(payload, payload_len);
+  }
+}
+
+// @brief The template of every type in the seed whose timestamp could be found, in the order the types
+// first appear
+std::vector<Template> ReadSeed(const std::string& path) {
+  std::vector<Template> templates;
+  std::set<std::string> seen;
+  EcmMessageMap map;
+  ReadBuffers(path, [&](const uint8_t* data, size_t size) {
+    size_t offset = 0;
+    while (offset < size) {
+      const size_t used = DecodeOne(data + offset, size - offset, map);
+      if (used == 0)
+        break;
+      const std::string& first_key = map.begin()->first;
+      const std::string type = first_key.substr(0, first_key.find(kDelim));
+      if (seen.insert(type).second) {
+        Template tmpl;
+        tmpl.type = type;
+        if (MakeTemplate(data + offset, used, map, tmpl))
+          templates.push_back(std::move(tmpl));
+        else
+          std::cerr << "Skipping " << type << ": its write timestamp can't be found" << std::endl;
+      }
+      offset += used;
+    }
+  });
+  return templates;
+}
+
+// @brief Uniform double in [0, 1). std::uniform_real_distribution isn't the same everywhere.
+double Uniform(std::mt19937_64& rng) {
+  return static_cast<double>(rng() >> 11) * 0x1.0p-53;
+}
+
+struct Datagram {
+  std::vector<uint8_t> payload;
+  size_t n_messages = 0;
+  size_t node = 0;
+  // Capture time in ns since the epoch
+  int64_t capture_ns = 0;
+};
+
+// @brief Destination of the generated datagrams
+class Output
+{
+public:
+  virtual ~Output() = default;
+  virtual void Write(const Datagram& datagram) = 0;
+  virtual void Close() = 0;
+
+  // Node n sends from 172.16.17.(11 + n), to the subnet's broadcast address
+  static uint32_t NodeIp(size_t node) { return kSubnet | static_cast<uint32_t>(11 + node); }
+  static std::string NodeIpString(size_t node) { return "172.16.17." + std::to_string(11 + node); }
+  static constexpr uint32_t kSubnet = (172u << 24) | (16u << 16) | (17u << 8);
+  static constexpr uint32_t kBroadcastIp = kSubnet | 255;
+  static constexpr const char* kBroadcastIpString = "172.16.17.255";
+};
+
+// @brief Nanosecond classic pcap of Ethernet/IPv4/UDP frames, broadcast by each node to kPort
+class PcapOutput : public Output
+{
+public:
+  explicit PcapOutput(const std::string& path) : _buffer(size_t(1) << 20) {
+    _out.rdbuf()->pubsetbuf(_buffer.data(), static_cast<std::streamsize>(_buffer.size()));
+    _out.open(path, std::ios::binary | std::ios::trunc);
+    if (!_out)
+      throw std::runtime_error("Cannot create " + path);
+    const uint32_t header[6] = {0xa1b23c4d, 2 | (4u << 16), 0, 0, 65535, 1};
+    _out.write(reinterpret_cast<const char*>(header), sizeof(header));
+  }
+
+  void Write(const Datagram& datagram) override {
+    const size_t udp_len = 8 + datagram.payload.size();
+    const size_t frame_len = 14 + 20 + udp_len;
+    const uint32_t record[4] = {static_cast<uint32_t>(datagram.capture_ns / 1000000000),
+                                static_cast<uint32_t>(datagram.capture_ns % 1000000000),
+                                static_cast<uint32_t>(frame_len), static_cast<uint32_t>(frame_len)};
+    _out.write(reinterpret_cast<const char*>(record), sizeof(record));
+
+    uint8_t headers[14 + 20 + 8] = {};
+    uint8_t* ethernet = headers;
+    std::memset(ethernet, 0xff, 6);
+    const uint8_t source_mac[6] = {0x02, 0, 0, 0, 0, static_cast<uint8_t>(datagram.node + 1)};
+    std::memcpy(ethernet + 6, source_mac, 6);
+    StoreBigEndian16(ethernet + 12, 0x0800);
+
+    uint8_t* ip = headers + 14;
+    ip[0] = 0x45;
+    StoreBigEndian16(ip + 2, static_cast<uint16_t>(20 + udp_len));
+    StoreBigEndian16(ip + 4, _ip_id++);
+    // Don't fragment
+    StoreBigEndian16(ip + 6, 0x4000);
+    ip[8] = 64;
+    ip[9] = 17;
+    StoreBigEndian32(ip + 12, NodeIp(datagram.node));
+    StoreBigEndian32(ip + 16, kBroadcastIp);
+    uint32_t sum = 0;
+    for (size_t i = 0; i < 20; i += 2)
+      sum += (uint32_t(ip[i]) << 8) | ip[i + 1];
+    while (sum >> 16)
+      sum = (sum & 0xffff) + (sum >> 16);
+    StoreBigEndian16(ip + 10, static_cast<uint16_t>(~sum));
+
+    // A zero UDP checksum means none, which IPv4 allows
+    uint8_t* udp = headers + 34;
+    StoreBigEndian16(udp, static_cast<uint16_t>(kPort + 1 + datagram.node));
+    StoreBigEndian16(udp + 2, kPort);
+    StoreBigEndian16(udp + 4, static_cast<uint16_t>(udp_len));
+
+    _out.write(reinterpret_cast<const char*>(headers), sizeof(headers));
+    _out.write(reinterpret_cast<const char*>(datagram.payload.data()),
+               static_cast<std::streamsize>(datagram.payload.size()));
+  }
+
+  void Close() override {
+    _out.close();
+    if (_out.fail())
+      throw std::runtime_error("Error writing the capture");
+  }
+
+private:
+  std::vector<char> _buffer;
+  std::ofstream _out;
+  uint16_t _ip_id = 0;
+};
+
+// @brief elroy_log with one row of the records table per datagram. The columns the loaders read are at
+// the positions of RecordsReader's k*Column constants.
+class LogOutput : public Output
+{
+public:
+  explicit LogOutput(const std::string& path) {
+    std::remove(path.c_str());
+    if (sqlite3_open(path.c_str(), &_db) != SQLITE_OK) {
+      std::string message = sqlite3_errmsg(_db);
+      sqlite3_close(_db);
+      throw std::runtime_error("Cannot create " + path + ": " + message);
+    }
+    Exec("PRAGMA journal_mode = OFF; PRAGMA synchronous = OFF;");
+    Exec("CREATE TABLE records (time INTEGER, data BLOB, from_port INTEGER, length INTEGER, to_ip TEXT, "
+         "from_ip TEXT);");
+    if (sqlite3_prepare_v2(_db, "INSERT INTO records VALUES (?, ?, ?, ?, ?, ?);", -1, &_insert, nullptr) != SQLITE_OK)
+      throw std::runtime_error(std::string("Cannot prepare insert: ") + sqlite3_errmsg(_db));
+    Exec("BEGIN;");
+  }
+
+  ~LogOutput() override {
+    sqlite3_finalize(_insert);
+    sqlite3_close(_db);
+  }
+
+  void Write(const Datagram& datagram) override {
+    const std::string from_ip = NodeIpString(datagram.node);
+    sqlite3_bind_int64(_insert, 1, datagram.capture_ns / 1000000000);
+    sqlite3_bind_blob(_insert, 2, datagram.payload.data(), static_cast<int>(datagram.payload.size()), SQLITE_STATIC);
+    sqlite3_bind_int(_insert, 3, kPort + 1 + static_cast<int>(datagram.node));
+    sqlite3_bind_int64(_insert, 4, static_cast<int64_t>(datagram.payload.size()));
+    sqlite3_bind_text(_insert, 5, kBroadcastIpString, -1, SQLITE_STATIC);
+    sqlite3_bind_text(_insert, 6, from_ip.c_str(), -1, SQLITE_TRANSIENT);
+    if (sqlite3_step(_insert) != SQLITE_DONE)
+      throw std::runtime_error(std::string("Cannot insert a record: ") + sqlite3_errmsg(_db));
+    sqlite3_reset(_insert);
+    if (++_n_rows % kRowsPerTransaction == 0)
+      Exec("COMMIT; BEGIN;");
+  }
+
+  void Close() override { Exec("COMMIT;"); }
+
+private:
+  void Exec(const std::string& sql) {
+    char* error = nullptr;
+    if (sqlite3_exec(_db, sql.c_str(), nullptr, nullptr, &error) != SQLITE_OK) {
+      std::string message = error != nullptr ? error : "unknown error";
+      sqlite3_free(error);
+      throw std::runtime_error("Error executing \"" + sql + "\": " + message);
+    }
+  }
+
+  sqlite3* _db = nullptr;
+  sqlite3_stmt* _insert = nullptr;
+  int64_t _n_rows = 0;
+};
+
+// @brief Passes datagrams on to an Output, holding back a fraction of them for a few datagrams like a
+// switch merging the traffic of several nodes. A late datagram takes the capture time of the datagram
+// it is written after, so capture times never go backwards.
+class Reorderer
+{
+public:
+  Reorderer(Output& output, double fraction, std::mt19937_64& rng) : _output(output), _fraction(fraction), _rng(rng) {}
+
+  void Write(Datagram& datagram) {
+    if (_fraction > 0 && Uniform(_rng) < _fraction) {
+      _late.push_back({datagram, 1 + _rng() % kMaxDelay});
+      return;
+    }
+    _output.Write(datagram);
+    ++n_datagrams;
+    for (size_t i = 0; i < _late.size();) {
+      if (--_late[i].remaining > 0) {
+        ++i;
+        continue;
+      }
+      _late[i].datagram.capture_ns = datagram.capture_ns;
+      _output.Write(_late[i].datagram);
+      ++n_datagrams;
+      _late.erase(_late.begin() + static_cast<std::ptrdiff_t>(i));
+    }
+  }
+
+  void Flush(int64_t capture_ns) {
+    for (auto& late : _late) {
+      late.datagram.capture_ns = capture_ns;
+      _output.Write(late.datagram);
+      ++n_datagrams;
+    }
+    _late.clear();
+  }
+
+  size_t n_datagrams = 0;
+
+private:
+  struct Late {
+    Datagram datagram;
+    uint64_t remaining;
+  };
+
+  Output& _output;
+  double _fraction;
+  std::mt19937_64& _rng;
+  std::vector<Late> _late;
+};
+
+// One instance of a message type
+struct Stream {
+  const Template* tmpl;
+  uint32_t instance;
+  size_t node;
+  double period;
+  // Time of the next message, in seconds after the start
+  double next;
+};
+
+void Generate(const Options& options, const std::vector<Template>& templates, Output& output) {
+  std::mt19937_64 rng(options.rng_seed);
+  std::vector<Stream> streams;
+  for (size_t i = 0; i < templates.size(); ++i) {
+    const Template& tmpl = templates[i];
+    auto rate = options.type_rates.find(tmpl.type);
+    const double period = 1 / (rate != options.type_rates.end() ? rate->second : options.rate);
+    const uint32_t instances = tmpl.instance.Found() ? options.instances : 1;
+    for (uint32_t instance = 0; instance < instances; ++instance)
+      streams.push_back({&tmpl, instance, i % options.nodes, period, period * Uniform(rng)});
+  }
+
+  using Next = std::pair<double, size_t>;
+  std::priority_queue<Next, std::vector<Next>, std::greater<Next>> queue;
+  for (size_t i = 0; i < streams.size(); ++i)
+    queue.push({streams[i].next, i});
+
+  const int64_t start_ns = options.start * 1000000000;
+  Reorderer reorderer(output, options.out_of_order, rng);
+  std::vector<Datagram> pending(options.nodes);
+  for (size_t node = 0; node < options.nodes; ++node)
+    pending[node].node = node;
+  size_t n_messages = 0;
+  uint64_t n_bytes = 0;
+  int64_t last_ns = start_ns;
+  auto send = [&](Datagram& datagram) {
+    if (datagram.n_messages == 0)
+      return;
+    reorderer.Write(datagram);
+    n_bytes += datagram.payload.size();
+    datagram.payload.clear();
+    datagram.n_messages = 0;
+  };
+
+  while (!queue.empty() && queue.top().first < options.duration) {
+    Stream& stream = streams[queue.top().second];
+    queue.pop();
+    const Template& tmpl = *stream.tmpl;
+    const double sent = stream.next;
+    const double written = sent - stream.period * kJitter * Uniform(rng);
+    stream.next += stream.period;
+    queue.push({stream.next, static_cast<size_t>(&stream - streams.data())});
+
+    Datagram& datagram = pending[stream.node];
+    if (datagram.payload.size() + tmpl.bytes.size() > kMaxPayload)
+      send(datagram);
+    const size_t offset = datagram.payload.size();
+    datagram.payload.insert(datagram.payload.end(), tmpl.bytes.begin(), tmpl.bytes.end());
+    uint8_t* message = datagram.payload.data() + offset;
+    StoreInt(message, tmpl.timestamp, static_cast<uint64_t>(start_ns + std::llround(std::max(written, 0.0) * 1e9)));
+    if (tmpl.instance.Found())
+      StoreInt(message, tmpl.instance, stream.instance);
+    ++datagram.n_messages;
+    ++n_messages;
+    last_ns = start_ns + std::llround(sent * 1e9);
+    datagram.capture_ns = last_ns;
+    if (datagram.n_messages >= options.per_datagram)
+      send(datagram);
+  }
+  for (auto& datagram : pending)
+    send(datagram);
+  reorderer.Flush(last_ns);
+  output.Close();
+
+  std::cout << "Wrote " << n_messages << " messages of " << templates.size() << " types in "
+            << reorderer.n_datagrams << " datagrams (" << n_bytes << " payload bytes) to " << options.output_path
+            << std::endl;
+}
+
+[[noreturn]] void Usage(const std::string& error) {
+  std::cerr << error << "\n"
+            << "Usage: ecm_generator --seed <capture or log> --output <file.pcap | file.elroy_log>\n"
+            << "  [--types A,B,...] [--instances N] [--rate HZ | --rate TYPE=HZ]... [--per-datagram N]\n"
+            << "  [--nodes N] [--duration S] [--out-of-order F] [--start S] [--rng-seed N]" << std::endl;
+  std::exit(2);
+}
+
+double ParseNumber(const std::string& option, const std::string& text, double min) {
+  char* end = nullptr;
+  const double value = std::strtod(text.c_str(), &end);
+  if (text.empty() || *end != '\0' || !(value >= min))
+    Usage("Invalid value for " + option + ": " + text);
+  return value;
+}
+
+Options ParseOptions(int argc, char** argv) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    const std::string option = argv[i];
+    if (i + 1 >= argc)
+      Usage("Missing value for " + option);
+    const std::string value = argv[++i];
+    if (option == "--seed") {
+      options.seed_path = value;
+    } else if (option == "--output") {
+      options.output_path = value;
+    } else if (option == "--types") {
+      for (size_t begin = 0; begin <= value.size();) {
+        const size_t end = std::min(value.find(',', begin), value.size());
+        if (end > begin)
+          options.types.push_back(value.substr(begin, end - begin));
+        begin = end + 1;
+      }
+    } else if (option == "--instances") {
+      options.instances = static_cast<uint32_t>(ParseNumber(option, value, 1));
+    } else if (option == "--rate") {
+      const size_t equals = value.find('=');
+      if (equals == std::string::npos)
+        options.rate = ParseNumber(option, value, 1e-6);
+      else
+        options.type_rates[value.substr(0, equals)] = ParseNumber(option, value.substr(equals + 1), 1e-6);
+    } else if (option == "--per-datagram") {
+      options.per_datagram = static_cast<size_t>(ParseNumber(option, value, 1));
+    } else if (option == "--nodes") {
+      options.nodes = static_cast<size_t>(ParseNumber(option, value, 1));
+      if (options.nodes > 200)
+        Usage("At most 200 nodes");
+    } else if (option == "--duration") {
+      options.duration = ParseNumber(option, value, 0);
+    } else if (option == "--out-of-order") {
+      options.out_of_order = ParseNumber(option, value, 0);
+      if (options.out_of_order > 1)
+        Usage("--out-of-order is a fraction between 0 and 1");
+    } else if (option == "--start") {
+      options.start = static_cast<int64_t>(ParseNumber(option, value, 0));
+    } else if (option == "--rng-seed") {
+      options.rng_seed = static_cast<uint64_t>(ParseNumber(option, value, 0));
+    } else {
+      Usage("Unknown option " + option);
+    }
+  }
+  if (options.seed_path.empty() || options.output_path.empty())
+    Usage("--seed and --output are required");
+  return options;
+}
+
+// @brief Keep the templates of the types asked for, in the order they were asked for
+std::vector<Template> SelectTypes(std::vector<Template> templates, const std::vector<std::string>& types) {
+  if (types.empty())
+    return templates;
+  std::vector<Template> selected;
+  for (const auto& type : types) {
+    auto it = std::find_if(templates.begin(), templates.end(), [&type](const Template& tmpl) { return tmpl.type == type; });
+    if (it == templates.end())
+      throw std::runtime_error("The seed has no usable " + type + " message");
+    selected.push_back(*it);
+  }
+  return selected;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  const Options options = ParseOptions(argc, argv);
+  try {
+    std::vector<Template> templates = SelectTypes(ReadSeed(options.seed_path), options.types);
+    if (templates.empty())
+      throw std::runtime_error("No usable message in " + options.seed_path);
+    for (const auto& tmpl : templates) {
+      if (!tmpl.instance.Found() && options.instances > 1)
+        std::cerr << tmpl.type << " has no instance field, writing a single instance" << std::endl;
+    }
+    const bool is_log = options.output_path.size() >= 10 &&
+                        options.output_path.compare(options.output_path.size() - 10, 10, ".elroy_log") == 0;
+    std::unique_ptr<Output> output;
+    if (is_log)
+      output = std::make_unique<LogOutput>(options.output_path);
+    else
+      output = std::make_unique<PcapOutput>(options.output_path);
+    Generate(options, templates, *output);
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
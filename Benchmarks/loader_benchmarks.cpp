@@ -0,0 +1,290 @@
+// Google Benchmark suite running every loader path against the same inputs, so defaults can be picked
+// and regressions caught from numbers instead of comments.
+//
+// Inputs are the captures (*.pcap, *.pcapng, *.gz, *.zst) and logs (*.elroy_log) in the directory named
+// by the ELROY_BENCH_INPUTS environment variable, "bench_inputs" by default. Every path is registered
+// once per input it can read, e.g. "PcapLoader/readDataFromFile/first_open/flight_1GB.pcap". Besides the
+// time, each benchmark reports bytes/s (of the input file), messages/s, the number of points loaded and
+// the peak resident set size of a load.
+//
+// Loads that find a PcapIndex or SeriesCache next to the input behave very differently, so the sidecars
+// are set up before every iteration:
+//   first_open  no sidecars: the load decodes everything and writes them
+//   index_only  only the PcapIndex: the load decodes from the index and writes the cache
+//   reopen      both: the load reads the cache
+//
+// ecm_generator writes reproducible inputs of any size, see its usage. Run with e.g.
+//   ELROY_BENCH_INPUTS=/data/bench ./loader_benchmarks --benchmark_filter=PcapLoader
+
+#include <benchmark/benchmark.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Common/decode_pipeline.h"
+#include "Common/field_table.h"
+#include "Common/series_cache.h"
+#include "ElroyLogLoader/elroy_log_loader.h"
+#include "ElroyLogLoader/records_reader.h"
+#include "PcapLoader/byte_stream.h"
+#include "PcapLoader/mmap_pcap_reader.h"
+#include "PcapLoader/pcap_index.h"
+#include "PcapLoader/pcap_loader.h"
+#include "PcapLoader/stream_pcap_reader.h"
+
+namespace {
+// readDataFromFile_mulithread keeps a map per message, so it only gets inputs up to this size
+constexpr uint64_t kSmallInputSize = uint64_t(256) << 20;
+
+enum class Sidecars { FirstOpen, IndexOnly, Reopen };
+
+struct Input {
+  std::string path;
+  std::string name;
+  uint64_t size;
+  bool is_log;
+  // Classic uncompressed pcap, which the mmap based paths can read
+  bool is_mappable;
+  size_t n_messages = 0;
+};
+
+// @brief Let the peak resident set size (VmHWM) start over from the current one. Linux only; without it
+// the reported peak is the peak of the whole process so far.
+void ResetPeakRss() {
+#ifdef __GLIBC__
+  // Hand the previous load's series back to the kernel, or they keep counting towards the next peak
+  malloc_trim(0);
+#endif
+  std::ofstream clear_refs("/proc/self/clear_refs");
+  clear_refs << "5";
+}
+
+double PeakRssMegabytes() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 6, "VmHWM:") == 0)
+      return std::strtod(line.c_str() + 6, nullptr) / 1024;
+  }
+  return 0;
+}
+
+size_t CountPoints(const PJ::PlotDataMapRef& plot_data) {
+  size_t n_points = 0;
+  for (const auto& pair : plot_data.numeric)
+    n_points += pair.second.size();
+  for (const auto& pair : plot_data.strings)
+    n_points += pair.second.size();
+  return n_points;
+}
+
+// @brief Number of ECM messages in input, counted once by decoding it without storing anything
+size_t CountMessages(const Input& input) {
+  FieldTable field_table;
+  DecodePipeline pipeline(field_table);
+  // Every type but none of its fields, so messages are still counted while only their timestamps are
+  // stored
+  pipeline.SetFieldSelection(FieldSelection({"*/"}));
+  size_t n_messages = 0;
+  auto writer = [&n_messages](DecodedBatch& batch) { n_messages += batch.n_messages; };
+  if (input.is_log) {
+    RecordsReader records(input.path);
+    int64_t first, last;
+    if (!records.RowidRange(first, last))
+      return 0;
+    pipeline.Run(
+      [&records, &first, last](RawBatch& batch) {
+        const int64_t end = std::min<int64_t>(first + 511, last);
+        records.ReadRange(first, end, [&batch](const uint8_t* data, size_t size) { batch.Add(data, size); });
+        first = end + 1;
+        return first <= last;
+      },
+      writer);
+  } else {
+    StreamPcapReader reader(ByteStream::Open(input.path));
+    if (!reader.Open())
+      return 0;
+    pipeline.Run(
+      [&reader](RawBatch& batch) {
+        PcapPacketView packet;
+        const uint8_t* payload;
+        size_t payload_len;
+        while (batch.Size() < 256) {
+          if (!reader.GetNextPacket(packet))
+            return false;
+          if (PcapLoader::UdpPayload(packet, payload, payload_len))
+            batch.Add(payload, payload_len, packet.capture_ts);
+        }
+        return true;
+      },
+      writer);
+  }
+  return n_messages;
+}
+
+// @brief Put the sidecars of input in the state sidecars asks for, loading it once if they are missing
+void PrepareSidecars(const Input& input, Sidecars sidecars) {
+  const std::string index_path = PcapIndex::SidecarPath(input.path);
+  const std::string cache_path = SeriesCache::SidecarPath(input.path);
+  if (sidecars == Sidecars::FirstOpen) {
+    std::remove(index_path.c_str());
+    std::remove(cache_path.c_str());
+    return;
+  }
+  PcapIndex index;
+  const bool has_index = input.is_log || index.Load(input.path);
+  if (!has_index || (sidecars == Sidecars::Reopen && !std::filesystem::exists(cache_path))) {
+    PJ::PlotDataMapRef plot_data;
+    PJ::FileLoadInfo info;
+    info.filename = QString::fromStdString(input.path);
+    if (input.is_log)
+      ElroyLogLoader().readDataFromFile(&info, plot_data);
+    else
+      PcapLoader().readDataFromFile(&info, plot_data);
+  }
+  if (sidecars == Sidecars::IndexOnly)
+    std::remove(cache_path.c_str());
+}
+
+template <typename Loader>
+using LoadFunction = std::function<bool(Loader&, PJ::FileLoadInfo*, PJ::PlotDataMapRef&)>;
+
+template <typename Loader>
+void RunLoad(benchmark::State& state, Input* input, Sidecars sidecars, const LoadFunction<Loader>& load) {
+  if (input->n_messages == 0)
+    input->n_messages = CountMessages(*input);
+  size_t n_points = 0;
+  double peak_rss = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    PrepareSidecars(*input, sidecars);
+    auto plot_data = std::make_unique<PJ::PlotDataMapRef>();
+    Loader loader;
+    PJ::FileLoadInfo info;
+    info.filename = QString::fromStdString(input->path);
+    ResetPeakRss();
+    state.ResumeTiming();
+
+    load(loader, &info, *plot_data);
+
+    // Freeing the series is not part of the load
+    state.PauseTiming();
+    peak_rss = std::max(peak_rss, PeakRssMegabytes());
+    n_points = CountPoints(*plot_data);
+    plot_data.reset();
+    state.ResumeTiming();
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * input->size));
+  state.counters["messages/s"] =
+    benchmark::Counter(static_cast<double>(input->n_messages), benchmark::Counter::kIsIterationInvariantRate);
+  state.counters["points"] = static_cast<double>(n_points);
+  state.counters["peak_rss_MB"] = peak_rss;
+}
+
+template <typename Loader>
+void Register(const std::string& path_name, Sidecars sidecars, Input* input, const LoadFunction<Loader>& load) {
+  static const char* kSidecarNames[] = {"first_open", "index_only", "reopen"};
+  const std::string name = path_name + "/" + kSidecarNames[static_cast<int>(sidecars)] + "/" + input->name;
+  benchmark::RegisterBenchmark(name.c_str(),
+                               [input, sidecars, load](benchmark::State& state) {
+                                 RunLoad<Loader>(state, input, sidecars, load);
+                               })
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime()
+    ->MeasureProcessCPUTime();
+}
+
+void RegisterCapture(Input* input) {
+  using Load = LoadFunction<PcapLoader>;
+  for (Sidecars sidecars : {Sidecars::FirstOpen, Sidecars::IndexOnly, Sidecars::Reopen}) {
+    // Streamed captures get a cache but never an index
+    if (sidecars == Sidecars::IndexOnly && !input->is_mappable)
+      continue;
+    // readDataFromFile is readDataFromFile_mulithread_old, so that path is only timed once
+    Register<PcapLoader>("PcapLoader/readDataFromFile", sidecars, input,
+                         Load([](PcapLoader& loader, PJ::FileLoadInfo* info, PJ::PlotDataMapRef& plot_data) {
+                           return loader.readDataFromFile(info, plot_data);
+                         }));
+  }
+  // This ignores the sidecars and can only map a classic pcap
+  if (input->is_mappable && input->size <= kSmallInputSize) {
+    Register<PcapLoader>("PcapLoader/mulithread", Sidecars::FirstOpen, input,
+                         Load([](PcapLoader& loader, PJ::FileLoadInfo* info, PJ::PlotDataMapRef& plot_data) {
+                           return loader.readDataFromFile_mulithread(info, plot_data);
+                         }));
+  }
+}
+
+void RegisterLog(Input* input) {
+  using Load = LoadFunction<ElroyLogLoader>;
+  for (Sidecars sidecars : {Sidecars::FirstOpen, Sidecars::Reopen}) {
+    Register<ElroyLogLoader>("ElroyLogLoader/multithread", sidecars, input,
+                             Load([](ElroyLogLoader& loader, PJ::FileLoadInfo* info, PJ::PlotDataMapRef& plot_data) {
+                               return loader.readDataFromFile_multithread(info, plot_data);
+                             }));
+  }
+  Register<ElroyLogLoader>("ElroyLogLoader/singlethread", Sidecars::FirstOpen, input,
+                           Load([](ElroyLogLoader& loader, PJ::FileLoadInfo* info, PJ::PlotDataMapRef& plot_data) {
+                             return loader.readDataFromFile_singlethread(info, plot_data);
+                           }));
+}
+
+// @brief The inputs in directory, sorted by name so the order is the same on every run
+std::vector<std::unique_ptr<Input>> FindInputs(const std::string& directory) {
+  std::vector<std::unique_ptr<Input>> inputs;
+  std::error_code error;
+  for (const auto& entry : std::filesystem::directory_iterator(directory, error)) {
+    if (!entry.is_regular_file())
+      continue;
+    const std::string extension = entry.path().extension().string();
+    const bool is_log = extension == ".elroy_log";
+    if (!is_log && extension != ".pcap" && extension != ".pcapng" && extension != ".gz" && extension != ".zst")
+      continue;
+    auto input = std::make_unique<Input>();
+    input->path = entry.path().string();
+    input->name = entry.path().filename().string();
+    input->size = static_cast<uint64_t>(entry.file_size());
+    input->is_log = is_log;
+    input->is_mappable = !is_log && MmapPcapReader(input->path).Open();
+    inputs.push_back(std::move(input));
+  }
+  std::sort(inputs.begin(), inputs.end(),
+            [](const std::unique_ptr<Input>& a, const std::unique_ptr<Input>& b) { return a->name < b->name; });
+  return inputs;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+
+  const char* directory = std::getenv("ELROY_BENCH_INPUTS");
+  const auto inputs = FindInputs(directory != nullptr ? directory : "bench_inputs");
+  if (inputs.empty()) {
+    std::cerr << "No captures or logs in " << (directory != nullptr ? directory : "bench_inputs")
+              << ", set ELROY_BENCH_INPUTS to a directory of inputs" << std::endl;
+    return 1;
+  }
+  for (const auto& input : inputs) {
+    if (input->is_log)
+      RegisterLog(input.get());
+    else
+      RegisterCapture(input.get());
+  }
+
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
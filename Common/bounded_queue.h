@@ -0,0 +1,75 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+// @brief Blocking FIFO with a fixed capacity, used to hand batches between pipeline stages. Push blocks
+// while the queue is full and Pop blocks while it is empty. Once closed, Push fails and Pop drains
+// what is left.
+template <typename T>
+class BoundedQueue
+{
+public:
+  explicit BoundedQueue(size_t capacity) : _capacity(capacity > 0 ? capacity : 1) {}
+
+  // @brief Returns false if the queue was closed, in which case item is dropped
+  bool Push(T item) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _not_full.wait(lock, [this]() { return _closed || _items.size() < _capacity; });
+    if (_closed)
+      return false;
+    _items.push_back(std::move(item));
+    lock.unlock();
+    _not_empty.notify_one();
+    return true;
+  }
+
+  // @brief Returns false once the queue is closed and empty
+  bool Pop(T& item) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _not_empty.wait(lock, [this]() { return _closed || !_items.empty(); });
+    if (_items.empty())
+      return false;
+    item = std::move(_items.front());
+    _items.pop_front();
+    lock.unlock();
+    _not_full.notify_one();
+    return true;
+  }
+
+  // @brief Like Pop, but gives up once timeout passed. Returns false if it gave up or the queue is closed
+  // and empty, in which case closed tells which.
+  template <typename Rep, typename Period>
+  bool PopFor(T& item, const std::chrono::duration<Rep, Period>& timeout, bool& closed) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _not_empty.wait_for(lock, timeout, [this]() { return _closed || !_items.empty(); });
+    closed = _closed && _items.empty();
+    if (_items.empty())
+      return false;
+    item = std::move(_items.front());
+    _items.pop_front();
+    lock.unlock();
+    _not_full.notify_one();
+    return true;
+  }
+
+  void Close() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _closed = true;
+    }
+    _not_full.notify_all();
+    _not_empty.notify_all();
+  }
+
+private:
+  const size_t _capacity;
+  std::mutex _mutex;
+  std::condition_variable _not_full;
+  std::condition_variable _not_empty;
+  std::deque<T> _items;
+  bool _closed = false;
+};
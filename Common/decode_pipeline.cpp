@@ -0,0 +1,418 @@
+#include "decode_pipeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "bounded_queue.h"
+#include "decode_sink.h"
+#include "ecm_decoder.h"
+#include "load_progress.h"
+#include "load_telemetry.h"
+#include "thread_pool.h"
+
+namespace {
+// Longest the writer goes without calling the idle callback while it waits for a batch
+constexpr std::chrono::milliseconds kIdleInterval(50);
+
+// @brief Forwards every message to another sink, noting the tables of the current record on the way
+class TableRecordingSink : public EcmDecodeSink
+{
+public:
+  TableRecordingSink(EcmDecodeSink& sink, DecodedBatch& batch) : _sink(sink), _batch(batch) {}
+
+  void OnMessageBegin(const TableInfo& table, double timestamp) override {
+    // Records hold a handful of messages, a linear search beats a set
+    auto begin = _batch.record_tables.begin() + static_cast<std::ptrdiff_t>(_record_begin);
+    if (std::find(begin, _batch.record_tables.end(), table.id) == _batch.record_tables.end())
+      _batch.record_tables.push_back(table.id);
+    _sink.OnMessageBegin(table, timestamp);
+  }
+  void OnDouble(const FieldInfo& field, double value) override { _sink.OnDouble(field, value); }
+  void OnBool(const FieldInfo& field, bool value) override { _sink.OnBool(field, value); }
+  void OnString(const FieldInfo& field, std::string_view value) override { _sink.OnString(field, value); }
+  void OnMessageEnd() override { _sink.OnMessageEnd(); }
+
+  void EndRecord() {
+    _record_begin = _batch.record_tables.size();
+    _batch.record_table_end.push_back(_record_begin);
+  }
+
+private:
+  EcmDecodeSink& _sink;
+  DecodedBatch& _batch;
+  size_t _record_begin = 0;
+};
+}  // namespace
+
+void RawBatch::Add(const void* data, size_t size, double fallback_timestamp) {
+  const size_t offset = bytes.size();
+  bytes.resize(offset + size);
+  if (size > 0)
+    std::memcpy(bytes.data() + offset, data, size);
+  records.push_back({nullptr, offset, size, fallback_timestamp});
+}
+
+void RawBatch::AddView(const uint8_t* data, size_t size, double fallback_timestamp) {
+  records.push_back({data, 0, size, fallback_timestamp});
+}
+
+// @brief Runs the reader jobs of a pipeline, one at a time, on a thread that lives as long as the
+// pipeline, so that e.g. LogFollower's polls don't start a thread each
+class DecodePipeline::ReaderThread
+{
+public:
+  ReaderThread() : _thread([this]() { Loop(); }) {}
+
+  ~ReaderThread() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+    }
+    _cv.notify_all();
+    _thread.join();
+  }
+
+  void Start(std::function<void()> job) {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _job = std::move(job);
+      _busy = true;
+    }
+    _cv.notify_all();
+  }
+
+  // @brief Wait until the job passed to Start returned
+  void Wait() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cv.wait(lock, [this]() { return !_busy; });
+  }
+
+private:
+  void Loop() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+      _cv.wait(lock, [this]() { return _stop || _job; });
+      if (!_job)
+        return;
+      auto job = std::move(_job);
+      _job = nullptr;
+      lock.unlock();
+      job();
+      lock.lock();
+      _busy = false;
+      _cv.notify_all();
+    }
+  }
+
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  std::function<void()> _job;
+  bool _busy = false;
+  bool _stop = false;
+  // Last, so it starts once the rest is initialized
+  std::thread _thread;
+};
+
+// @brief State shared by the stages of one run. Everything but the queue and the workers' decoders
+// and batches is guarded by mutex.
+struct DecodePipeline::RunState {
+  struct Worker {
+    // Created by the worker's first task
+    std::unique_ptr<EcmDecoder> decoder;
+    // The batch Run's reader filled for the worker's task. Reused, so its arena stops growing after
+    // the first few batches.
+    RawBatch batch;
+  };
+
+  RunState(size_t n_workers, size_t max_in_flight)
+    : max_in_flight(max_in_flight), workers(n_workers), decoded_queue(max_in_flight) {
+    // Taken from the back, so worker 0 goes first
+    for (size_t worker = n_workers; worker > 0; --worker)
+      free_workers.push_back(worker - 1);
+  }
+
+  bool CanStart() const { return !aborted && in_flight < max_in_flight && !free_workers.empty(); }
+
+  // @brief Reserve a slot and a worker for the next batch, once CanStart()
+  size_t Start() {
+    ++in_flight;
+    const size_t worker = free_workers.back();
+    free_workers.pop_back();
+    return worker;
+  }
+
+  // @brief Hand back what Start reserved, for a batch that turned out empty
+  void Unstart(size_t worker) {
+    --in_flight;
+    free_workers.push_back(worker);
+  }
+
+  // @brief Close the queue once nothing more can be pushed, which ends the writer's loop
+  void CloseIfDone() {
+    if ((producer_done || aborted) && n_running == 0)
+      decoded_queue.Close();
+  }
+
+  // @brief Called by the writer after each batch it wrote
+  void Written() {
+    std::lock_guard<std::mutex> lock(mutex);
+    --in_flight;
+    if (start_more)
+      start_more();
+    CloseIfDone();
+    cv.notify_all();
+  }
+
+  // @brief Record the exception being handled and tear down every stage
+  void Fail() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!error)
+      error = std::current_exception();
+    aborted = true;
+    decoded_queue.Close();
+    cv.notify_all();
+  }
+
+  void WaitForTasks() {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this]() { return n_running == 0; });
+  }
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  // Batches that were started but not written yet. A batch is only started with a free slot, so the
+  // writer's reorder buffer never grows past max_in_flight, and the queue never fills up.
+  const size_t max_in_flight;
+  size_t in_flight = 0;
+  std::vector<Worker> workers;
+  std::vector<size_t> free_workers;
+  // Decode tasks submitted to the pool that haven't finished
+  size_t n_running = 0;
+  // Nothing more will be started
+  bool producer_done = false;
+  bool aborted = false;
+  std::exception_ptr error;
+  // RunPartitioned's scheduler: starts partitions while CanStart(). Called whenever a worker or a slot
+  // is freed.
+  std::function<void()> start_more;
+
+  BoundedQueue<std::unique_ptr<DecodedBatch>> decoded_queue;
+};
+
+DecodePipeline::DecodePipeline(FieldTable& field_table, const std::string& delim, size_t n_workers,
+                               size_t max_in_flight)
+  : _field_table(field_table), _delim(delim) {
+  _n_workers = n_workers > 0 ? n_workers : DecodeThreadCount();
+  _max_in_flight = max_in_flight > 0 ? max_in_flight : 4 * _n_workers;
+}
+
+DecodePipeline::~DecodePipeline() = default;
+
+std::unique_ptr<DecodedBatch> DecodePipeline::DecodeBatch(const RawBatch& raw, EcmDecoder& decoder,
+                                                          bool record_tables) {
+  const LoadTimer timer;
+  const double cpu_start = ThreadCpuSeconds();
+  const size_t failures_before = decoder.NumFailures();
+  auto decoded = std::make_unique<DecodedBatch>();
+  decoded->sequence = raw.sequence;
+  decoded->n_records = raw.Size();
+  SeriesStoreSink store_sink(decoded->store);
+  TableRecordingSink recording_sink(store_sink, *decoded);
+  EcmDecodeSink& sink = record_tables ? static_cast<EcmDecodeSink&>(recording_sink) : store_sink;
+  for (const auto& record : raw.records) {
+    decoded->n_messages += decoder.Decode(raw.Data(record), record.size, sink, record.fallback_timestamp);
+    decoded->n_bytes += record.size;
+    if (record_tables)
+      recording_sink.EndRecord();
+  }
+  decoded->n_failures = decoder.NumFailures() - failures_before;
+  decoded->worker_seconds = timer.Seconds();
+  decoded->worker_cpu_seconds = ThreadCpuSeconds() - cpu_start;
+  return decoded;
+}
+
+std::unique_ptr<DecodedBatch> DecodePipeline::DecodePartition(const PartitionReader& reader, size_t worker,
+                                                              size_t partition, EcmDecoder& decoder) const {
+  // Empty partitions are still written, the writer needs every sequence number
+  const LoadTimer timer;
+  const double cpu_start = ThreadCpuSeconds();
+  const size_t failures_before = decoder.NumFailures();
+  auto decoded = std::make_unique<DecodedBatch>();
+  decoded->sequence = partition;
+  SeriesStoreSink store_sink(decoded->store);
+  TableRecordingSink recording_sink(store_sink, *decoded);
+  EcmDecodeSink& sink = _record_tables ? static_cast<EcmDecodeSink&>(recording_sink) : store_sink;
+  DecodedBatch& batch = *decoded;
+  const bool record_tables = _record_tables;
+  reader(worker, partition, [&](const uint8_t* data, size_t size, double fallback_timestamp){
+    batch.n_messages += decoder.Decode(data, size, sink, fallback_timestamp);
+    batch.n_bytes += size;
+    ++batch.n_records;
+    if (record_tables)
+      recording_sink.EndRecord();
+  });
+  batch.n_failures = decoder.NumFailures() - failures_before;
+  batch.worker_seconds = timer.Seconds();
+  batch.worker_cpu_seconds = ThreadCpuSeconds() - cpu_start;
+  return decoded;
+}
+
+bool DecodePipeline::Cancelled() const {
+  return _progress != nullptr && _progress->Cancelled();
+}
+
+void DecodePipeline::Launch(RunState& state, size_t worker, DecodeTask decode) const {
+  ++state.n_running;
+  ThreadPool::Instance().Submit([this, &state, worker, decode = std::move(decode)]() {
+    std::unique_ptr<DecodedBatch> decoded;
+    try {
+      auto& decoder = state.workers[worker].decoder;
+      if (!decoder) {
+        decoder = std::make_unique<EcmDecoder>(_field_table, _delim);
+        decoder->SetMessageTypes(_message_types);
+        decoder->SetFieldSelection(_selection);
+      }
+      decoded = decode(*decoder);
+      if (_progress != nullptr)
+        _progress->Add(decoded->n_records);
+    } catch (...) {
+      state.Fail();
+    }
+    // The batch holds a slot, so the queue has room for it. Pushing under the lock means the queue is
+    // never closed in between, and the run's state is only let go once the lock is released.
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.free_workers.push_back(worker);
+    if (decoded)
+      state.decoded_queue.Push(std::move(decoded));
+    --state.n_running;
+    if (state.start_more)
+      state.start_more();
+    state.CloseIfDone();
+    state.cv.notify_all();
+  });
+}
+
+void DecodePipeline::ReadBatches(RunState& state, const Reader& reader) const {
+  try {
+    uint64_t sequence = 0;
+    bool more = true;
+    while (more && !Cancelled()) {
+      size_t worker;
+      {
+        std::unique_lock<std::mutex> lock(state.mutex);
+        state.cv.wait(lock, [&state]() { return state.aborted || state.CanStart(); });
+        if (state.aborted)
+          break;
+        worker = state.Start();
+      }
+      RawBatch& batch = state.workers[worker].batch;
+      batch.Clear();
+      batch.sequence = sequence;
+      more = reader(batch);
+      std::lock_guard<std::mutex> lock(state.mutex);
+      if (batch.Empty() || state.aborted) {
+        state.Unstart(worker);
+        continue;
+      }
+      ++sequence;
+      Launch(state, worker, [this, &batch](EcmDecoder& decoder) {
+        return DecodeBatch(batch, decoder, _record_tables);
+      });
+    }
+  } catch (...) {
+    state.Fail();
+  }
+  std::lock_guard<std::mutex> lock(state.mutex);
+  state.producer_done = true;
+  state.CloseIfDone();
+}
+
+void DecodePipeline::WriteInOrder(RunState& state, const Writer& writer) const {
+  // Write the batches in sequence order, holding on to the ones that overtook an earlier batch
+  try {
+    std::map<uint64_t, std::unique_ptr<DecodedBatch>> pending;
+    uint64_t next_sequence = 0;
+    std::unique_ptr<DecodedBatch> decoded;
+    LoadTimer since_idle;
+    while (true) {
+      bool closed = false;
+      if (!_idle) {
+        if (!state.decoded_queue.Pop(decoded))
+          break;
+      } else if (!state.decoded_queue.PopFor(decoded, kIdleInterval, closed)) {
+        if (closed)
+          break;
+        _idle();
+        since_idle = LoadTimer();
+        continue;
+      }
+      const uint64_t sequence = decoded->sequence;
+      pending.emplace(sequence, std::move(decoded));
+      for (auto it = pending.find(next_sequence); it != pending.end(); it = pending.find(next_sequence)) {
+        writer(*it->second);
+        pending.erase(it);
+        ++next_sequence;
+        state.Written();
+      }
+      // A steady stream of batches mustn't starve the idle callback either
+      if (_idle && since_idle.Seconds() > std::chrono::duration<double>(kIdleInterval).count()) {
+        _idle();
+        since_idle = LoadTimer();
+      }
+    }
+  } catch (...) {
+    state.Fail();
+  }
+}
+
+void DecodePipeline::Run(const Reader& reader, const Writer& writer) {
+  RunState state(_n_workers, _max_in_flight);
+  if (!_reader_thread)
+    _reader_thread = std::make_unique<ReaderThread>();
+  _reader_thread->Start([this, &state, &reader]() { ReadBatches(state, reader); });
+
+  WriteInOrder(state, writer);
+
+  _reader_thread->Wait();
+  state.WaitForTasks();
+  if (state.error)
+    std::rethrow_exception(state.error);
+}
+
+void DecodePipeline::RunPartitioned(size_t n_partitions, const PartitionReader& reader, const Writer& writer) {
+  RunState state(_n_workers, _max_in_flight);
+  size_t next_partition = 0;
+  // Claim partitions in order, so the writer never waits on a partition nobody has started. Once
+  // cancelled, the partitions claimed so far are still finished and written, so what is loaded has no
+  // gaps. The rest are never claimed.
+  state.start_more = [&]() {
+    while (next_partition < n_partitions && !Cancelled() && state.CanStart()) {
+      const size_t partition = next_partition++;
+      const size_t worker = state.Start();
+      Launch(state, worker, [this, &reader, worker, partition](EcmDecoder& decoder) {
+        return DecodePartition(reader, worker, partition, decoder);
+      });
+    }
+    if (next_partition == n_partitions || Cancelled())
+      state.producer_done = true;
+  };
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.start_more();
+    state.CloseIfDone();
+  }
+
+  WriteInOrder(state, writer);
+
+  state.WaitForTasks();
+  if (state.error)
+    std::rethrow_exception(state.error);
+}
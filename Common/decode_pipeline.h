@@ -0,0 +1,156 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "field_table.h"
+#include "series_store.h"
+
+class EcmDecoder;
+class LoadProgress;
+
+// @brief A batch of raw ECM buffers (sqlite blobs or UDP payloads) read by the pipeline's reader.
+// Buffers are either copied into the batch's arena or, when the source outlives the pipeline (e.g. a
+// memory mapped capture), referenced in place. Batches are recycled, so the arena stops growing after
+// the first few batches.
+struct RawBatch {
+  struct Record {
+    // Borrowed buffer, or nullptr if the bytes live in RawBatch::bytes at offset
+    const uint8_t* data;
+    size_t offset;
+    size_t size;
+    // Used for messages without a write timestamp
+    double fallback_timestamp;
+  };
+
+  uint64_t sequence = 0;
+  std::vector<uint8_t> bytes;
+  std::vector<Record> records;
+
+  // @brief Copy a buffer into the batch
+  void Add(const void* data, size_t size, double fallback_timestamp = 0);
+  // @brief Reference a buffer that stays valid until the pipeline is done
+  void AddView(const uint8_t* data, size_t size, double fallback_timestamp = 0);
+
+  void Clear() {
+    bytes.clear();
+    records.clear();
+  }
+  const uint8_t* Data(const Record& record) const {
+    return record.data != nullptr ? record.data : bytes.data() + record.offset;
+  }
+  size_t Size() const { return records.size(); }
+  bool Empty() const { return records.empty(); }
+};
+
+// @brief The decoded rows of one RawBatch
+struct DecodedBatch {
+  uint64_t sequence = 0;
+  size_t n_records = 0;
+  size_t n_messages = 0;
+  size_t n_bytes = 0;
+  // Records with bytes the decoder couldn't decode
+  size_t n_failures = 0;
+  // Wall and CPU time the worker spent on the batch: decoding it, and for RunPartitioned reading it too
+  double worker_seconds = 0;
+  double worker_cpu_seconds = 0;
+  SeriesStore store;
+  // Only filled if the pipeline records tables: the tables each record contained, in the order they
+  // first appeared. Record i's are record_tables[record_table_end[i - 1]] up to record_table_end[i].
+  std::vector<TableId> record_tables;
+  std::vector<size_t> record_table_end;
+};
+
+// @brief Bounded three stage pipeline: a reader fills RawBatches, decode tasks on the shared
+// ThreadPool turn them into SeriesStores, and the calling thread writes them out in the order they
+// were read.
+//
+// Reading, decoding and writing to plotjuggler overlap, and since at most max_in_flight batches exist
+// at any time, memory is bounded by the batch size instead of the file size. Because the writer gets
+// batches in read order and TransferTo sorts each batch by timestamp, a log that is roughly in time
+// order reaches plotjuggler in time order, where PlotData::pushBack is cheap.
+//
+// A decode task is only submitted once one of the NumWorkers() decoders and a slot are free, so tasks
+// never wait on each other or on the writer and can share the pool with the loaders' other work. The
+// reader of Run may block on its input, so it runs on a thread the pipeline keeps between runs instead.
+class DecodePipeline
+{
+public:
+  // @brief Called on the reader thread with an empty batch. Fill it and return true, or return false
+  // at the end of the input (a non empty batch is still decoded).
+  using Reader = std::function<bool(RawBatch& batch)>;
+  // @brief Called on the calling thread with each decoded batch, in read order
+  using Writer = std::function<void(DecodedBatch& batch)>;
+  // @brief Decodes one buffer of a partition on the spot, so the buffer only has to stay valid for the
+  // duration of the call
+  using RecordCallback = std::function<void(const uint8_t* data, size_t size, double fallback_timestamp)>;
+  // @brief Called from a decode task holding worker `worker` (0 <= worker < NumWorkers()) to read
+  // partition `partition` of the input, passing every buffer to decode. A worker runs one task at a
+  // time, so per worker state, e.g. a database connection, needs no locking.
+  using PartitionReader = std::function<void(size_t worker, size_t partition, const RecordCallback& decode)>;
+
+  // @brief n_workers = 0 uses DecodeThreadCount(); max_in_flight = 0 allows four batches per worker
+  DecodePipeline(FieldTable& field_table, const std::string& delim = "/", size_t n_workers = 0,
+                 size_t max_in_flight = 0);
+  ~DecodePipeline();
+
+  // @brief Run until the reader is done and every batch is written. If a stage throws, the pipeline
+  // is torn down and the first exception is rethrown here. Once the progress is cancelled nothing more
+  // is read, but the batches that were are still decoded and written, so the run returns normally with
+  // every record up to where it stopped.
+  void Run(const Reader& reader, const Writer& writer);
+
+  // @brief Like Run, but for inputs that can be read in parallel: every decode task reads its partition
+  // itself and decodes each buffer as it is read, without copying it, and the calling thread
+  // writes them in partition order. Partitions are claimed in increasing order.
+  void RunPartitioned(size_t n_partitions, const PartitionReader& reader, const Writer& writer);
+
+  size_t NumWorkers() const { return _n_workers; }
+
+  // @brief Only keep messages of these types, see FieldResolver::SetMessageTypes. Other messages are
+  // still decoded (the decoder can't skip a message without decoding it) but never stored.
+  void SetMessageTypes(const std::vector<std::string>& message_types) { _message_types = message_types; }
+  // @brief Only store the fields selection selects, see FieldResolver::SetFieldSelection
+  void SetFieldSelection(const FieldSelection& selection) { _selection = selection; }
+
+  // @brief Count the records the workers decode in progress, and stop reading once it is cancelled.
+  // progress must outlive the runs.
+  void SetProgress(LoadProgress* progress) { _progress = progress; }
+  // @brief Called on the calling thread every few tens of milliseconds while it waits for or writes
+  // batches, e.g. to keep plotjuggler's event loop, and with it a LoadProgressDialog, running
+  void SetIdle(const std::function<void()>& idle) { _idle = idle; }
+
+  // @brief Fill DecodedBatch::record_tables, e.g. to index which message types each record holds
+  void SetRecordTables(bool record_tables) { _record_tables = record_tables; }
+
+private:
+  struct RunState;
+  class ReaderThread;
+  using DecodeTask = std::function<std::unique_ptr<DecodedBatch>(EcmDecoder& decoder)>;
+
+  static std::unique_ptr<DecodedBatch> DecodeBatch(const RawBatch& raw, EcmDecoder& decoder, bool record_tables);
+  std::unique_ptr<DecodedBatch> DecodePartition(const PartitionReader& reader, size_t worker, size_t partition,
+                                                EcmDecoder& decoder) const;
+  // @brief Submit decode to the pool with worker's decoder. Called with the run's mutex held, once
+  // worker and a slot were reserved for the batch.
+  void Launch(RunState& state, size_t worker, DecodeTask decode) const;
+  void ReadBatches(RunState& state, const Reader& reader) const;
+  void WriteInOrder(RunState& state, const Writer& writer) const;
+  bool Cancelled() const;
+
+  FieldTable& _field_table;
+  std::string _delim;
+  size_t _n_workers;
+  size_t _max_in_flight;
+  bool _record_tables = false;
+  std::vector<std::string> _message_types;
+  FieldSelection _selection;
+  LoadProgress* _progress = nullptr;
+  std::function<void()> _idle;
+  // Started by the first Run
+  std::unique_ptr<ReaderThread> _reader_thread;
+};
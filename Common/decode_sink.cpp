@@ -0,0 +1,36 @@
+#include "decode_sink.h"
+
+void PlotDataSink::OnDouble(const FieldInfo& field, double value) {
+  field.numeric->pushBack(PJ::PlotData::Point(_timestamp, value));
+}
+
+void PlotDataSink::OnBool(const FieldInfo& field, bool value) {
+  field.numeric->pushBack(PJ::PlotData::Point(_timestamp, value ? 1.0 : 0.0));
+}
+
+void PlotDataSink::OnString(const FieldInfo& field, std::string_view value) {
+  field.strings->pushBack({_timestamp, std::string(value)});
+}
+
+void SeriesStoreSink::OnMessageBegin(const TableInfo& table, double timestamp) {
+  _table = table.id;
+  _store.BeginRow(_table, timestamp);
+}
+
+void SeriesStoreSink::OnDouble(const FieldInfo& field, double value) {
+  _store.Column(field).AppendDouble(value);
+}
+
+void SeriesStoreSink::OnBool(const FieldInfo& field, bool value) {
+  _store.Column(field).AppendBool(value);
+}
+
+void SeriesStoreSink::OnString(const FieldInfo& field, std::string_view value) {
+  // Reuse one buffer so that strings already in the column's dictionary don't allocate
+  _string_value.assign(value.data(), value.size());
+  _store.Column(field).AppendString(_string_value);
+}
+
+void SeriesStoreSink::OnMessageEnd() {
+  _store.EndRow(_table);
+}
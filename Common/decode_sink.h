@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string_view>
+
+#include "PlotJuggler/plotdata.h"
+#include "field_table.h"
+#include "series_store.h"
+
+// @brief Receives decoded ECM messages one value at a time, so decoded values can flow straight into
+// their destination without building a container per message. Fields arrive already interned, and
+// each value through the call of its field's FieldType.
+class EcmDecodeSink
+{
+public:
+  virtual ~EcmDecodeSink() = default;
+
+  // @brief Start of a message of the given type and instance, with its timestamp in seconds
+  virtual void OnMessageBegin(const TableInfo& table, double timestamp) = 0;
+  virtual void OnDouble(const FieldInfo& field, double value) = 0;
+  virtual void OnBool(const FieldInfo& field, bool value) = 0;
+  // @brief value is only valid for the duration of the call
+  virtual void OnString(const FieldInfo& field, std::string_view value) = 0;
+  virtual void OnMessageEnd() {}
+};
+
+// @brief Pushes every value straight into its plotjuggler series. The fields must come from a
+// FieldTable created with a PlotDataMapRef. Not thread safe: use one writer per PlotDataMapRef.
+class PlotDataSink : public EcmDecodeSink
+{
+public:
+  void OnMessageBegin(const TableInfo& table, double timestamp) override { _timestamp = timestamp; }
+  void OnDouble(const FieldInfo& field, double value) override;
+  void OnBool(const FieldInfo& field, bool value) override;
+  void OnString(const FieldInfo& field, std::string_view value) override;
+
+private:
+  double _timestamp = 0;
+};
+
+// @brief Appends every message as a row of a SeriesStore
+class SeriesStoreSink : public EcmDecodeSink
+{
+public:
+  explicit SeriesStoreSink(SeriesStore& store) : _store(store) {}
+
+  void OnMessageBegin(const TableInfo& table, double timestamp) override;
+  void OnDouble(const FieldInfo& field, double value) override;
+  void OnBool(const FieldInfo& field, bool value) override;
+  void OnString(const FieldInfo& field, std::string_view value) override;
+  void OnMessageEnd() override;
+
+private:
+  SeriesStore& _store;
+  TableId _table = 0;
+  std::string _string_value;
+};
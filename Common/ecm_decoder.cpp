@@ -0,0 +1,56 @@
+#include "ecm_decoder.h"
+
+#include "elroy_common_msg/msg_handling/msg_decoder.h"
+
+size_t EcmDecoder::Decode(const uint8_t* buf, size_t buf_len, EcmDecodeSink& sink, double fallback_timestamp) {
+  size_t n_msgs = 0;
+  size_t bytes_processed = 0;
+  size_t current_index = 0;
+  elroy_common_msg::MessageDecoderResult res;
+  while (current_index < buf_len) {
+    _map.clear();
+    if (!elroy_common_msg::MsgDecoder::DecodeAsMap(buf + current_index, buf_len - current_index, bytes_processed, _map, res, _delim)) {
+      ++_n_failures;
+      break;
+    }
+    current_index += bytes_processed;
+    if (Dispatch(_map, sink, fallback_timestamp))
+      ++n_msgs;
+  }
+  return n_msgs;
+}
+
+bool EcmDecoder::Dispatch(const EcmMessageMap& map, EcmDecodeSink& sink, double fallback_timestamp) {
+  if (!_resolver.Resolve(map, _message))
+    return false;
+  sink.OnMessageBegin(*_message.table, _message.has_timestamp ? _message.timestamp : fallback_timestamp);
+  // A field's type is that of the first value it was interned with. A later message may hold a value
+  // of another type under the same name, which must not reach a column or series of the field's type.
+  for (const auto& field : _message.fields) {
+    const FieldInfo& info = *field.field;
+    switch (info.type) {
+      case FieldType::Double:
+        if (const double* value = std::get_if<double>(field.value))
+          sink.OnDouble(info, *value);
+        else if (const bool* value = std::get_if<bool>(field.value))
+          sink.OnDouble(info, *value ? 1.0 : 0.0);
+        else
+          ++_n_failures;
+        break;
+      case FieldType::Bool:
+        if (const bool* value = std::get_if<bool>(field.value))
+          sink.OnBool(info, *value);
+        else
+          ++_n_failures;
+        break;
+      case FieldType::String:
+        if (const std::string* value = std::get_if<std::string>(field.value))
+          sink.OnString(info, *value);
+        else
+          ++_n_failures;
+        break;
+    }
+  }
+  sink.OnMessageEnd();
+  return true;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "decode_sink.h"
+#include "field_table.h"
+
+// @brief Decodes ECM buffers and pushes every message into an EcmDecodeSink.
+//
+// elroy_common_msg::MsgDecoder can only decode into a map, so each message is decoded into a map
+// owned by this decoder and then dispatched field by field through a FieldResolver. Reusing the map
+// only keeps its bucket array: clearing it frees every node, so each message still allocates a node,
+// a key string and, for text fields, a value string per field. That cost stays until MsgDecoder gets
+// an entry point that hands values to a visitor instead of a map. Past the map, resolving and
+// dispatching allocate nothing in steady state. Not thread safe: use one EcmDecoder per thread,
+// sharing the FieldTable.
+class EcmDecoder
+{
+public:
+  using EcmMessageMap = FieldResolver::EcmMessageMap;
+
+  EcmDecoder(FieldTable& field_table, const std::string& delim = "/") : _resolver(field_table, delim), _delim(delim) {}
+
+  // @brief Decode every message in buf. fallback_timestamp is used for messages without a write
+  // timestamp (e.g. the capture time of a packet). Returns the number of messages decoded.
+  size_t Decode(const uint8_t* buf, size_t buf_len, EcmDecodeSink& sink, double fallback_timestamp = 0);
+  // @brief Number of buffers passed to Decode that ended in bytes the decoder couldn't decode, plus
+  // values that were dropped because their type didn't match their field's. Booleans of a Double
+  // field are passed on as 0 or 1 instead.
+  size_t NumFailures() const { return _n_failures; }
+
+  // @brief Dispatch an already decoded message. Returns false if the map is empty or its type isn't
+  // accepted.
+  bool Dispatch(const EcmMessageMap& map, EcmDecodeSink& sink, double fallback_timestamp = 0);
+
+  // @brief Only pass messages of these types on to the sink, see FieldResolver::SetMessageTypes
+  void SetMessageTypes(const std::vector<std::string>& message_types) { _resolver.SetMessageTypes(message_types); }
+  // @brief Only pass the fields selection selects on to the sink, see FieldResolver::SetFieldSelection
+  void SetFieldSelection(const FieldSelection& selection) { _resolver.SetFieldSelection(selection); }
+
+private:
+  FieldResolver _resolver;
+  std::string _delim;
+  EcmMessageMap _map;
+  FieldResolver::ResolvedMessage _message;
+  size_t _n_failures = 0;
+};
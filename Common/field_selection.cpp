@@ -0,0 +1,71 @@
+#include "field_selection.h"
+
+#include <stdexcept>
+
+namespace {
+const std::string kRegexPrefix = "re:";
+}  // namespace
+
+FieldSelection::FieldSelection(const std::vector<std::string>& patterns) {
+  for (const auto& text : patterns) {
+    const bool is_regex = text.compare(0, kRegexPrefix.size(), kRegexPrefix) == 0;
+    const std::string body = is_regex ? text.substr(kRegexPrefix.size()) : text;
+    // Table names never contain "/", so the first one always ends the table part
+    const size_t slash = body.find('/');
+    std::string table = body.substr(0, slash);
+    std::string field = slash == std::string::npos ? "" : body.substr(slash + 1);
+    if (!is_regex) {
+      table = GlobToRegex(table);
+      field = GlobToRegex(field);
+    }
+    try {
+      _patterns.push_back({std::regex(table), std::regex(field), slash == std::string::npos});
+    } catch (const std::regex_error& e) {
+      throw std::runtime_error("Invalid field pattern \"" + text + "\": " + e.what());
+    }
+  }
+}
+
+std::string FieldSelection::GlobToRegex(const std::string& glob) {
+  std::string regex;
+  for (char c : glob) {
+    switch (c) {
+      case '*': regex += ".*"; break;
+      case '?': regex += '.'; break;
+      case '.': case '^': case '$': case '+': case '(': case ')': case '[': case ']':
+      case '{': case '}': case '|': case '\\':
+        regex += '\\';
+        regex += c;
+        break;
+      default: regex += c;
+    }
+  }
+  return regex;
+}
+
+bool FieldSelection::TableMatches(const Pattern& pattern, const std::string& table_name) const {
+  if (std::regex_match(table_name, pattern.table))
+    return true;
+  const size_t instance = table_name.rfind("__");
+  return instance != std::string::npos && std::regex_match(table_name.substr(0, instance), pattern.table);
+}
+
+bool FieldSelection::MatchesTable(const std::string& table_name) const {
+  if (_patterns.empty())
+    return true;
+  for (const auto& pattern : _patterns) {
+    if (TableMatches(pattern, table_name))
+      return true;
+  }
+  return false;
+}
+
+bool FieldSelection::MatchesField(const std::string& table_name, const std::string& field_name) const {
+  if (_patterns.empty())
+    return true;
+  for (const auto& pattern : _patterns) {
+    if (TableMatches(pattern, table_name) && (pattern.all_fields || std::regex_match(field_name, pattern.field)))
+      return true;
+  }
+  return false;
+}
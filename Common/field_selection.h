@@ -0,0 +1,45 @@
+#pragma once
+
+#include <regex>
+#include <string>
+#include <vector>
+
+// @brief Which series to load, picked by patterns over series names such as
+// "VlThrusterState__2/BusObject/write_timestamp_ns". A name is selected if any pattern matches it.
+//
+// A pattern is a glob ("*" matches anything, "?" any one character) or, when it starts with "re:", an
+// ECMAScript regex. The part before the first "/" is matched against the message type with its
+// instance, "VlThrusterState__2", or without it, "VlThrusterState". The rest is matched against the
+// field name; a pattern without "/" selects every field of the matching types. For example
+// "VlThruster*/BusObject/*" or "re:Vl(Thruster|Battery)State__[0-3]/.*_ns". Matches are case sensitive
+// and must cover the whole name.
+class FieldSelection
+{
+public:
+  // @brief Selects everything
+  FieldSelection() = default;
+  // @brief Throws std::runtime_error if one of the regexes is invalid. No patterns selects everything.
+  explicit FieldSelection(const std::vector<std::string>& patterns);
+
+  bool Empty() const { return _patterns.empty(); }
+
+  // @brief True if some field of table_name, e.g. "VlThrusterState__2", may be selected. Messages of
+  // other types don't have to be stored at all.
+  bool MatchesTable(const std::string& table_name) const;
+  // @brief True if field_name of table_name is selected. field_name has no leading "/", e.g.
+  // "BusObject/write_timestamp_ns".
+  bool MatchesField(const std::string& table_name, const std::string& field_name) const;
+
+private:
+  struct Pattern {
+    std::regex table;
+    std::regex field;
+    bool all_fields;
+  };
+
+  // @brief Regex matching the same names as glob
+  static std::string GlobToRegex(const std::string& glob);
+  bool TableMatches(const Pattern& pattern, const std::string& table_name) const;
+
+  std::vector<Pattern> _patterns;
+};
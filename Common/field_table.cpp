@@ -0,0 +1,190 @@
+#include "field_table.h"
+
+#include "record_filter.h"
+
+namespace {
+bool EndsWith(const std::string& str, const std::string& suffix) {
+  return str.size() > suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+}  // namespace
+
+const TableInfo& FieldTable::InternTable(const std::string& name) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  auto it = _table_index.find(name);
+  if (it != _table_index.end())
+    return _tables[it->second];
+  const TableId id = static_cast<TableId>(_tables.size());
+  _tables.push_back({id, name});
+  _table_index.insert({name, id});
+  return _tables.back();
+}
+
+const FieldInfo& FieldTable::InternField(TableId table, const std::string& field_name, FieldType type) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  std::string name = _tables[table].name + field_name;
+  auto it = _field_index.find(name);
+  if (it != _field_index.end())
+    return _fields[it->second];
+  const FieldId id = static_cast<FieldId>(_fields.size());
+  FieldInfo field{id, table, name, type};
+  // Add a new column to the plotter. Series live in unordered_maps, so the pointers stay valid.
+  if (_plot_data != nullptr) {
+    if (type == FieldType::String)
+      field.strings = &(_plot_data->addStringSeries(name)->second);
+    else
+      field.numeric = &(_plot_data->addNumeric(name)->second);
+  }
+  _fields.push_back(std::move(field));
+  _field_index.insert({std::move(name), id});
+  return _fields.back();
+}
+
+const TableInfo& FieldTable::Table(TableId id) const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _tables[id];
+}
+
+const FieldInfo& FieldTable::Field(FieldId id) const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _fields[id];
+}
+
+size_t FieldTable::NumTables() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _tables.size();
+}
+
+size_t FieldTable::NumFields() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _fields.size();
+}
+
+void FieldTable::CreateSeries(PJ::PlotDataMapRef& plot_data,
+                              const std::function<bool(const TableInfo&)>& include) const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  for (const auto& field : _fields) {
+    if (!include(_tables[field.table]))
+      continue;
+    if (field.type == FieldType::String)
+      plot_data.addStringSeries(field.name);
+    else
+      plot_data.addNumeric(field.name);
+  }
+}
+
+const FieldInfo FieldResolver::kSkippedField{};
+
+uint32_t FieldResolver::FieldIndex(Schema& schema, size_t position, const std::string& key) {
+  // Fast path: the decoder yielded the same key at this position in the previous message
+  if (position < schema.order.size()) {
+    const uint32_t index = schema.order[position];
+    if (schema.keys[index] == key)
+      return index;
+  }
+  uint32_t index;
+  auto it = schema.key_index.find(key);
+  if (it != schema.key_index.end()) {
+    index = it->second;
+  } else {
+    index = static_cast<uint32_t>(schema.keys.size());
+    schema.keys.push_back(key);
+    schema.key_index.insert({key, index});
+    if (EndsWith(key, "component" + _delim + "instance"))
+      schema.instance_field = index;
+    if (EndsWith(key, "BusObject" + _delim + "write_timestamp_ns"))
+      schema.timestamp_field = index;
+  }
+  if (position < schema.order.size())
+    schema.order[position] = index;
+  else
+    schema.order.push_back(index);
+  return index;
+}
+
+FieldResolver::Instance& FieldResolver::FindInstance(Schema& schema, size_t instance_id, bool has_instance) {
+  if (!has_instance)
+    instance_id = SIZE_MAX;
+  // There are only ever a handful of instances of a message type, so a linear search beats hashing
+  for (auto& instance : schema.instances) {
+    if (instance.instance_id == instance_id)
+      return instance;
+  }
+  std::string name = schema.type;
+  if (has_instance)
+    name += "__" + std::to_string(instance_id);
+  const bool accepted = MatchesMessageType(_message_types, name) && _selection.MatchesTable(name);
+  schema.instances.push_back({instance_id, &_table.InternTable(name), {}, accepted});
+  return schema.instances.back();
+}
+
+bool FieldResolver::Resolve(const EcmMessageMap& map, ResolvedMessage& message) {
+  message.fields.clear();
+  message.timestamp = 0;
+  message.has_timestamp = false;
+  if (map.empty())
+    return false;
+
+  // Find the schema of the message type. Maps of one type almost always yield the same first key, so
+  // look it up by that key instead of building the type name.
+  Schema* schema;
+  const std::string& first_key = map.begin()->first;
+  auto it = _first_key_to_schema.find(first_key);
+  if (it != _first_key_to_schema.end()) {
+    schema = it->second;
+  } else {
+    const std::string type = first_key.substr(0, first_key.find(_delim));
+    auto type_it = _type_to_schema.find(type);
+    if (type_it == _type_to_schema.end()) {
+      _schemas.emplace_back();
+      _schemas.back().type = type;
+      type_it = _type_to_schema.insert({type, &_schemas.back()}).first;
+    }
+    schema = type_it->second;
+    _first_key_to_schema.insert({first_key, schema});
+  }
+
+  // Resolve the field index of every key, picking out the instance id and timestamp on the way
+  _scratch.clear();
+  size_t instance_id = 0;
+  bool has_instance = false;
+  size_t position = 0;
+  for (const auto& pair : map) {
+    const uint32_t index = FieldIndex(*schema, position++, pair.first);
+    _scratch.push_back({index, &pair.second});
+    if (const double* value = std::get_if<double>(&pair.second)) {
+      if (index == schema->instance_field) {
+        instance_id = static_cast<size_t>(*value);
+        has_instance = true;
+      } else if (index == schema->timestamp_field) {
+        message.timestamp = *value / 1e9;
+        message.has_timestamp = true;
+      }
+    }
+  }
+
+  Instance& instance = FindInstance(*schema, instance_id, has_instance);
+  if (!instance.accepted)
+    return false;
+  message.table = instance.table;
+  if (instance.fields.size() < schema->keys.size())
+    instance.fields.resize(schema->keys.size(), nullptr);
+  for (const auto& pair : _scratch) {
+    const FieldInfo*& field = instance.fields[pair.first];
+    if (field == nullptr) {
+      const std::string field_name = schema->keys[pair.first].substr(schema->type.size());
+      if (!_selection.MatchesField(instance.table->name, field_name.substr(_delim.size()))) {
+        field = &kSkippedField;
+      } else {
+        FieldType type = FieldType::String;
+        if (std::holds_alternative<double>(*pair.second))
+          type = FieldType::Double;
+        else if (std::holds_alternative<bool>(*pair.second))
+          type = FieldType::Bool;
+        field = &_table.InternField(instance.table->id, field_name, type);
+      }
+    }
+    if (field != &kSkippedField)
+      message.fields.push_back({field, pair.second});
+  }
+  return true;
+}
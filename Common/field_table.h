@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include "PlotJuggler/plotdata.h"
+#include "field_selection.h"
+
+// Dense id of one message type and instance, e.g. "VlThrusterState__2"
+using TableId = uint32_t;
+// Dense id of one field of one message type and instance, i.e. one plotjuggler series
+using FieldId = uint32_t;
+
+enum class FieldType { Double, Bool, String };
+
+struct TableInfo {
+  TableId id;
+  std::string name;
+};
+
+struct FieldInfo {
+  FieldId id;
+  TableId table;
+  // Full series name, e.g. "VlThrusterState__2/BusObject/write_timestamp_ns"
+  std::string name;
+  FieldType type;
+  // Destination series, set if the FieldTable was created with a PlotDataMapRef
+  PJ::PlotData* numeric = nullptr;
+  PJ::StringSeries* strings = nullptr;
+};
+
+// @brief Registry that interns every table and field once and hands out dense ids. If a
+// PlotDataMapRef is given, the plotjuggler series of each field is created when the field is
+// interned, so the handle can be cached and the series never has to be looked up by name again.
+// Interning is thread safe. The returned references stay valid for the lifetime of the table.
+class FieldTable
+{
+public:
+  explicit FieldTable(PJ::PlotDataMapRef* plot_data = nullptr) : _plot_data(plot_data) {}
+
+  const TableInfo& InternTable(const std::string& name);
+  const FieldInfo& InternField(TableId table, const std::string& field_name, FieldType type);
+
+  const TableInfo& Table(TableId id) const;
+  const FieldInfo& Field(FieldId id) const;
+  size_t NumTables() const;
+  size_t NumFields() const;
+
+  // @brief Create an empty plotjuggler series for every field whose table include accepts, e.g. to
+  // list the fields of a log in the tree without decoding their samples
+  void CreateSeries(PJ::PlotDataMapRef& plot_data, const std::function<bool(const TableInfo&)>& include) const;
+
+private:
+  PJ::PlotDataMapRef* _plot_data;
+  mutable std::mutex _mutex;
+  // std::deque so that references stay valid while other threads intern
+  std::deque<TableInfo> _tables;
+  std::deque<FieldInfo> _fields;
+  std::unordered_map<std::string, TableId> _table_index;
+  std::unordered_map<std::string, FieldId> _field_index;
+};
+
+// @brief Resolves decoded ECM messages to table and field ids. Each thread owns a resolver; the
+// FieldTable is only consulted (under its lock) the first time a field is seen.
+//
+// The decoder hands out one map per message, keyed by strings like "MessageType/BusObject/...". The
+// resolver learns the order in which the map yields the keys of each message type, so that for every
+// following message of that type a field is resolved with one string comparison and a vector lookup,
+// without building the series name or hashing it.
+class FieldResolver
+{
+public:
+  using Value = std::variant<std::string, double, bool>;
+  using EcmMessageMap = std::unordered_map<std::string, Value>;
+
+  struct ResolvedField {
+    const FieldInfo* field;
+    const Value* value;
+  };
+  struct ResolvedMessage {
+    const TableInfo* table = nullptr;
+    // Timestamp in seconds, from BusObject/write_timestamp_ns
+    double timestamp = 0;
+    bool has_timestamp = false;
+    std::vector<ResolvedField> fields;
+  };
+
+  FieldResolver(FieldTable& table, const std::string& delim = "/") : _table(table), _delim(delim) {}
+
+  // @brief Resolve every field of map. message is reused between calls so that steady state resolution
+  // doesn't allocate. Returns false if the map is empty or its type isn't accepted.
+  bool Resolve(const EcmMessageMap& map, ResolvedMessage& message);
+
+  // @brief Only accept these message types (see MatchesMessageType); empty accepts all. Messages of
+  // other types are rejected before any of their fields are interned. Must be set before resolving.
+  void SetMessageTypes(const std::vector<std::string>& message_types) { _message_types = message_types; }
+  // @brief Only accept the fields selection selects. Types with no selected field are rejected like
+  // types missing from SetMessageTypes, other fields are left out of the resolved message without ever
+  // being interned. Must be set before resolving.
+  void SetFieldSelection(const FieldSelection& selection) { _selection = selection; }
+
+private:
+  static constexpr uint32_t kNoField = UINT32_MAX;
+  // Stands in for a field the selection left out, so it is only matched once
+  static const FieldInfo kSkippedField;
+
+  // One instance of a message type, with its fields indexed by the schema's field index
+  struct Instance {
+    size_t instance_id;
+    const TableInfo* table;
+    std::vector<const FieldInfo*> fields;
+    bool accepted;
+  };
+  struct Schema {
+    std::string type;
+    // Decoder keys, indexed by field index
+    std::vector<std::string> keys;
+    std::unordered_map<std::string, uint32_t> key_index;
+    // Field index of the n-th key yielded by the decoder's map, as seen in the last message
+    std::vector<uint32_t> order;
+    uint32_t instance_field = kNoField;
+    uint32_t timestamp_field = kNoField;
+    std::vector<Instance> instances;
+  };
+
+  uint32_t FieldIndex(Schema& schema, size_t position, const std::string& key);
+  Instance& FindInstance(Schema& schema, size_t instance_id, bool has_instance);
+
+  FieldTable& _table;
+  std::string _delim;
+  std::deque<Schema> _schemas;
+  std::unordered_map<std::string, Schema*> _first_key_to_schema;
+  std::unordered_map<std::string, Schema*> _type_to_schema;
+  std::vector<std::pair<uint32_t, const Value*>> _scratch;
+  std::vector<std::string> _message_types;
+  FieldSelection _selection;
+};
+
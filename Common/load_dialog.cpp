@@ -0,0 +1,164 @@
+#include "load_dialog.h"
+
+#include <QDialogButtonBox>
+#include <QFormLayout>
+#include <QLabel>
+#include <QMessageBox>
+#include <QSettings>
+#include <QVBoxLayout>
+
+#include <cmath>
+#include <stdexcept>
+
+#include "field_selection.h"
+
+namespace {
+// Trimmed, non empty items of a comma separated list
+QStringList SplitList(const QLineEdit* edit) {
+  QStringList items;
+  for (const QString& item : edit->text().split(",", Qt::SkipEmptyParts)) {
+    const QString trimmed = item.trimmed();
+    if (!trimmed.isEmpty())
+      items.push_back(trimmed);
+  }
+  return items;
+}
+
+QLineEdit* NewListEdit(QWidget* parent, const QString& placeholder, const QString& tooltip, const QString& text) {
+  auto edit = new QLineEdit(parent);
+  edit->setPlaceholderText(placeholder);
+  edit->setToolTip(tooltip);
+  edit->setText(text);
+  return edit;
+}
+}  // namespace
+
+LoadDialog::LoadDialog(int64_t log_begin, int64_t log_end, const QString& settings_group, bool packet_filters,
+                       QWidget* parent)
+  : QDialog(parent), _settings_group(settings_group), _log_begin(log_begin), _log_end(log_end) {
+  setWindowTitle("Select the data to load");
+  const double duration = static_cast<double>(log_end - log_begin);
+  QSettings settings;
+
+  _from = new QDoubleSpinBox(this);
+  _from->setRange(0, duration);
+  _from->setDecimals(0);
+  _from->setSuffix(" s");
+  _from->setValue(0);
+  _to = new QDoubleSpinBox(this);
+  _to->setRange(0, duration);
+  _to->setDecimals(0);
+  _to->setSuffix(" s");
+  _to->setValue(duration);
+
+  // 0 disables it, so the From/To window applies
+  _last_minutes = new QSpinBox(this);
+  _last_minutes->setRange(0, static_cast<int>(std::ceil(duration / 60)));
+  _last_minutes->setSpecialValueText("Off");
+  _last_minutes->setValue(settings.value(_settings_group + "/last_minutes", 0).toInt());
+
+  _sources = NewListEdit(this, "All sources", "Comma separated source IP addresses, e.g. 172.16.17.11, 172.16.17.12",
+                         settings.value(_settings_group + "/sources", "").toString());
+  _message_types = NewListEdit(this, "All message types",
+                               "Comma separated message types, e.g. VlThrusterState for every instance or "
+                               "VlThrusterState__2 for one",
+                               settings.value(_settings_group + "/message_types", "").toString());
+
+  _field_patterns = new QPlainTextEdit(this);
+  _field_patterns->setPlaceholderText("All fields");
+  _field_patterns->setToolTip("One pattern per line over names like VlThrusterState__2/BusObject/write_timestamp_ns.\n"
+                              "Globs: VlThruster*/BusObject/* or VlThrusterState for every field of a type.\n"
+                              "Regexes start with re:, e.g. re:Vl(Thruster|Battery)State__[0-3]/.*_ns");
+  _field_patterns->setPlainText(settings.value(_settings_group + "/field_patterns", "").toString());
+
+  _lazy = new QCheckBox("Scan the message types first and pick the ones to decode", this);
+  _lazy->setChecked(settings.value(_settings_group + "/lazy", false).toBool());
+  _load_summary = new QCheckBox("Show where the load spent its time when it is done", this);
+  _load_summary->setChecked(settings.value(_settings_group + "/load_summary", false).toBool());
+
+  auto form = new QFormLayout();
+  form->addRow("From (since start of log)", _from);
+  form->addRow("To (since start of log)", _to);
+  form->addRow("Only the last (minutes)", _last_minutes);
+  form->addRow("Sources", _sources);
+  if (packet_filters) {
+    _destinations = NewListEdit(this, "All destinations", "Comma separated destination IP addresses",
+                                settings.value(_settings_group + "/destinations", "").toString());
+    _ports = NewListEdit(this, "All ports", "Comma separated UDP ports, matching either the source or destination port",
+                         settings.value(_settings_group + "/ports", "").toString());
+    form->addRow("Destinations", _destinations);
+    form->addRow("Ports", _ports);
+  }
+  form->addRow("Message types", _message_types);
+  form->addRow("Fields", _field_patterns);
+  form->addRow(_lazy);
+  form->addRow(_load_summary);
+
+  auto buttons = new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel, this);
+  connect(buttons, &QDialogButtonBox::accepted, this, [this]() {
+    // Catch a broken regex here rather than half way through the load
+    try {
+      FieldSelection selection(Filter().field_patterns);
+    } catch (const std::runtime_error& e) {
+      QMessageBox::warning(this, "Invalid field pattern", e.what());
+      return;
+    }
+    accept();
+  });
+  connect(buttons, &QDialogButtonBox::rejected, this, &QDialog::reject);
+
+  auto layout = new QVBoxLayout(this);
+  layout->addWidget(new QLabel(QString("The recording spans %1 s").arg(duration, 0, 'f', 0), this));
+  layout->addLayout(form);
+  layout->addWidget(buttons);
+  setLayout(layout);
+}
+
+RecordFilter LoadDialog::Filter() const {
+  RecordFilter filter;
+  if (_last_minutes->value() > 0) {
+    filter.has_time_range = true;
+    filter.begin_time = _log_end - static_cast<int64_t>(_last_minutes->value()) * 60;
+    filter.end_time = _log_end;
+  } else if (_from->value() > 0 || _to->value() < _log_end - _log_begin) {
+    filter.has_time_range = true;
+    filter.begin_time = _log_begin + static_cast<int64_t>(_from->value());
+    filter.end_time = _log_begin + static_cast<int64_t>(_to->value());
+  }
+  for (const QString& source : SplitList(_sources))
+    filter.sources.push_back(source.toStdString());
+  for (const QString& message_type : SplitList(_message_types))
+    filter.message_types.push_back(message_type.toStdString());
+  for (const QString& line : _field_patterns->toPlainText().split("\n", Qt::SkipEmptyParts)) {
+    const QString pattern = line.trimmed();
+    if (!pattern.isEmpty())
+      filter.field_patterns.push_back(pattern.toStdString());
+  }
+  if (_destinations != nullptr) {
+    for (const QString& destination : SplitList(_destinations))
+      filter.destinations.push_back(destination.toStdString());
+  }
+  if (_ports != nullptr) {
+    for (const QString& port : SplitList(_ports)) {
+      bool ok;
+      const uint16_t value = port.toUShort(&ok);
+      if (ok)
+        filter.ports.push_back(value);
+    }
+  }
+  return filter;
+}
+
+void LoadDialog::SaveSettings() const {
+  QSettings settings;
+  settings.setValue(_settings_group + "/last_minutes", _last_minutes->value());
+  settings.setValue(_settings_group + "/sources", _sources->text());
+  settings.setValue(_settings_group + "/message_types", _message_types->text());
+  settings.setValue(_settings_group + "/field_patterns", _field_patterns->toPlainText());
+  settings.setValue(_settings_group + "/lazy", _lazy->isChecked());
+  settings.setValue(_settings_group + "/load_summary", _load_summary->isChecked());
+  if (_destinations != nullptr)
+    settings.setValue(_settings_group + "/destinations", _destinations->text());
+  if (_ports != nullptr)
+    settings.setValue(_settings_group + "/ports", _ports->text());
+}
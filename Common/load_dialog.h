@@ -0,0 +1,49 @@
+#pragma once
+
+#include <QCheckBox>
+#include <QDialog>
+#include <QDoubleSpinBox>
+#include <QLineEdit>
+#include <QPlainTextEdit>
+#include <QSpinBox>
+
+#include "record_filter.h"
+
+// @brief Asks which part of a log or capture to load: a time window, either absolute or "the last N
+// minutes", the source IPs, the message types and the fields, plus the destination IPs and UDP ports of
+// a capture. It also offers a lazy load, which scans the log for its message types and lets the user pick the ones
+// to decode, and a summary of the load's telemetry once it is done (see LoadTelemetry). The choices are
+// remembered for the next load, under settings_group.
+class LoadDialog : public QDialog
+{
+public:
+  // @brief log_begin and log_end are the time of the first and last record, in seconds. packet_filters
+  // adds the destination and port fields.
+  LoadDialog(int64_t log_begin, int64_t log_end, const QString& settings_group, bool packet_filters = false,
+             QWidget* parent = nullptr);
+
+  // @brief The filter picked by the user. Empty if the whole log should be loaded.
+  RecordFilter Filter() const;
+
+  // @brief True if only the field tree should be loaded at first, see MessageTypeDialog
+  bool Lazy() const { return _lazy->isChecked(); }
+
+  // @brief Remember the current choices in QSettings
+  void SaveSettings() const;
+
+private:
+  QString _settings_group;
+  int64_t _log_begin;
+  int64_t _log_end;
+  QDoubleSpinBox* _from;
+  QDoubleSpinBox* _to;
+  QSpinBox* _last_minutes;
+  QLineEdit* _sources;
+  QLineEdit* _destinations = nullptr;
+  QLineEdit* _ports = nullptr;
+  QLineEdit* _message_types;
+  // One FieldSelection pattern per line
+  QPlainTextEdit* _field_patterns;
+  QCheckBox* _lazy;
+  QCheckBox* _load_summary;
+};
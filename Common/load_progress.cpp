@@ -0,0 +1,46 @@
+#include "load_progress.h"
+
+#include <QApplication>
+
+#include <algorithm>
+
+std::unique_ptr<LoadProgressDialog> LoadProgressDialog::Create(LoadProgress& progress, const QString& label) {
+  if (qobject_cast<QApplication*>(QCoreApplication::instance()) == nullptr)
+    return nullptr;
+  return std::make_unique<LoadProgressDialog>(progress, label);
+}
+
+LoadProgressDialog::LoadProgressDialog(LoadProgress& progress, const QString& label, QWidget* parent)
+  : QProgressDialog(label, "Cancel", 0, kSteps, parent), _progress(progress), _timer(new QTimer(this)) {
+  setWindowTitle("Loading");
+  // plotjuggler mustn't be used while the load fills its series
+  setWindowModality(Qt::ApplicationModal);
+  setMinimumDuration(500);
+  // Stay up until the load returns, even once the bar is full or Cancel was pressed
+  setAutoClose(false);
+  setAutoReset(false);
+  connect(this, &QProgressDialog::canceled, this, [this]() {
+    _progress.Cancel();
+    setLabelText("Cancelling, keeping what has loaded...");
+  });
+  connect(_timer, &QTimer::timeout, this, [this]() { Sample(); });
+  _timer->start(kSampleInterval);
+}
+
+void LoadProgressDialog::ProcessEvents() {
+  QCoreApplication::processEvents();
+}
+
+void LoadProgressDialog::Sample() {
+  const size_t total = _progress.Total();
+  if (total == 0) {
+    // A busy indicator, for streams of unknown length
+    setRange(0, 0);
+    return;
+  }
+  // The total may only be known once the load has started, e.g. after a capture was cut into ranges
+  if (maximum() != kSteps)
+    setRange(0, kSteps);
+  const size_t done = std::min(_progress.Done(), total);
+  setValue(static_cast<int>(done * kSteps / total));
+}
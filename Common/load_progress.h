@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+#include <QProgressDialog>
+#include <QTimer>
+
+// @brief How far a load is, and whether the user asked to stop it. The threads doing the load add to
+// the counter with relaxed atomics and never wait or print; a LoadProgressDialog samples it on a timer.
+class LoadProgress
+{
+public:
+  // @brief The number of records the load expects to read, 0 if it isn't known
+  void SetTotal(size_t total) { _total.store(total, std::memory_order_relaxed); }
+  size_t Total() const { return _total.load(std::memory_order_relaxed); }
+
+  // @brief Count records that were read and decoded
+  void Add(size_t n_records) { _done.fetch_add(n_records, std::memory_order_relaxed); }
+  size_t Done() const { return _done.load(std::memory_order_relaxed); }
+
+  // @brief Ask the load to stop. It finishes the records it already started on and keeps them.
+  void Cancel() { _cancelled.store(true, std::memory_order_relaxed); }
+  bool Cancelled() const { return _cancelled.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<size_t> _total{0};
+  std::atomic<size_t> _done{0};
+  std::atomic<bool> _cancelled{false};
+};
+
+// @brief Modal progress dialog of a LoadProgress, with a Cancel button that cancels the load. A timer
+// samples the counters, so the load has to hand the event loop some time every now and then, see
+// DecodePipeline::SetIdle and ProcessEvents.
+class LoadProgressDialog : public QProgressDialog
+{
+public:
+  // @brief nullptr outside plotjuggler, e.g. in PcapLoaderExec, where a load runs to the end
+  static std::unique_ptr<LoadProgressDialog> Create(LoadProgress& progress, const QString& label);
+
+  LoadProgressDialog(LoadProgress& progress, const QString& label, QWidget* parent = nullptr);
+
+  // @brief Handle the events that are waiting, among them the timer and the Cancel button
+  static void ProcessEvents();
+
+private:
+  void Sample();
+
+  // Steps of the progress bar, so record counts don't overflow its int range
+  static constexpr int kSteps = 1000;
+  // How often the counters are sampled, in milliseconds
+  static constexpr int kSampleInterval = 100;
+
+  LoadProgress& _progress;
+  QTimer* _timer;
+};
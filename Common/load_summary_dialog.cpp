@@ -0,0 +1,86 @@
+#include "load_summary_dialog.h"
+
+#include <QDialogButtonBox>
+#include <QFileDialog>
+#include <QLabel>
+#include <QMessageBox>
+#include <QPushButton>
+#include <QTableWidget>
+#include <QVBoxLayout>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "load_telemetry.h"
+
+namespace {
+QTableWidget* NewTable(QWidget* parent, const QStringList& headers, int n_rows) {
+  auto table = new QTableWidget(n_rows, headers.size(), parent);
+  table->setHorizontalHeaderLabels(headers);
+  table->setEditTriggers(QTableWidget::NoEditTriggers);
+  return table;
+}
+
+void SetRow(QTableWidget* table, int row, const QStringList& cells) {
+  for (int column = 0; column < cells.size(); ++column)
+    table->setItem(row, column, new QTableWidgetItem(cells[column]));
+}
+}  // namespace
+
+LoadSummaryDialog::LoadSummaryDialog(const LoadTelemetry& telemetry, QWidget* parent) : QDialog(parent) {
+  setWindowTitle("Load summary");
+
+  // Nested stages are indented under the stage they are part of
+  const auto& stages = telemetry.Stages();
+  auto stage_table = NewTable(this, {"Stage", "Wall (s)", "CPU (s)", "Calls"}, static_cast<int>(stages.size()));
+  for (size_t i = 0; i < stages.size(); ++i) {
+    const auto& stage = stages[i];
+    const int depth = static_cast<int>(std::count(stage.name.begin(), stage.name.end(), '/'));
+    SetRow(stage_table, static_cast<int>(i),
+           {QString(2 * depth, ' ') + QString::fromStdString(stage.name.substr(stage.name.rfind('/') + 1)),
+            QString::number(stage.wall_seconds, 'f', 3), QString::number(stage.cpu_seconds, 'f', 3),
+            QString::number(stage.calls)});
+  }
+  stage_table->resizeColumnsToContents();
+
+  const std::vector<std::pair<QString, size_t>> counters = {
+    {"Records", telemetry.n_records},
+    {"Bytes", telemetry.n_bytes},
+    {"Messages", telemetry.n_messages},
+    {"Decode failures", telemetry.n_failures},
+    {"Series", telemetry.n_series},
+    {"Samples", telemetry.n_samples},
+    {"Largest batch store (bytes)", telemetry.max_store_bytes},
+  };
+  const auto& per_type = telemetry.messages_per_type;
+  auto counter_table = NewTable(this, {"Counter", "Value"}, static_cast<int>(counters.size() + per_type.size()));
+  int row = 0;
+  for (const auto& counter : counters)
+    SetRow(counter_table, row++, {counter.first, QString::number(counter.second)});
+  for (const auto& pair : per_type)
+    SetRow(counter_table, row++, {QString::fromStdString(pair.first) + " messages", QString::number(pair.second)});
+  counter_table->resizeColumnsToContents();
+
+  auto buttons = new QDialogButtonBox(QDialogButtonBox::Close, this);
+  auto save = buttons->addButton("Save JSON...", QDialogButtonBox::ActionRole);
+  connect(save, &QPushButton::clicked, this, [this, &telemetry]() {
+    const QString path = QFileDialog::getSaveFileName(this, "Save load summary", "load_summary.json", "JSON (*.json)");
+    if (!path.isEmpty() && !telemetry.WriteJson(path.toStdString()))
+      QMessageBox::warning(this, "Load summary", "Could not write " + path);
+  });
+  connect(buttons, &QDialogButtonBox::rejected, this, &QDialog::reject);
+
+  auto layout = new QVBoxLayout(this);
+  layout->addWidget(new QLabel(QString::fromStdString(telemetry.Summary()), this));
+  if (!telemetry.warnings.empty()) {
+    QStringList warnings;
+    for (const auto& warning : telemetry.warnings)
+      warnings.append(QString::fromStdString(warning));
+    layout->addWidget(new QLabel(warnings.join("\n"), this));
+  }
+  layout->addWidget(stage_table);
+  layout->addWidget(counter_table);
+  layout->addWidget(buttons);
+  setLayout(layout);
+}
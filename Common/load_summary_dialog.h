@@ -0,0 +1,14 @@
+#pragma once
+
+#include <QDialog>
+
+class LoadTelemetry;
+
+// @brief Shown after a load when the loader's "load_summary" setting is on: the wall and CPU time of
+// every stage and the load's counters, with a button to save them all as JSON, e.g. to attach to a
+// report of a slow load.
+class LoadSummaryDialog : public QDialog
+{
+public:
+  explicit LoadSummaryDialog(const LoadTelemetry& telemetry, QWidget* parent = nullptr);
+};
@@ -0,0 +1,184 @@
+#include "load_telemetry.h"
+
+#include <QApplication>
+#include <QDebug>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QSettings>
+
+#include <time.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+#include "decode_pipeline.h"
+#include "field_table.h"
+#include "load_summary_dialog.h"
+
+namespace {
+double ClockSeconds(clockid_t clock) {
+  timespec ts;
+  if (clock_gettime(clock, &ts) != 0)
+    return 0;
+  return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) / 1e9;
+}
+}  // namespace
+
+double ThreadCpuSeconds() {
+  return ClockSeconds(CLOCK_THREAD_CPUTIME_ID);
+}
+
+double ProcessCpuSeconds() {
+  return ClockSeconds(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+LoadTelemetry::Scope::Scope(LoadTelemetry& telemetry, const std::string& stage)
+  : _telemetry(telemetry), _stage(stage), _cpu_start(ProcessCpuSeconds()) {
+  // Create the stage now, so it is listed before the stages nested in it
+  _telemetry.FindStage(_stage);
+}
+
+LoadTelemetry::Scope::~Scope() {
+  _telemetry.AddStage(_stage, _timer.Seconds(), ProcessCpuSeconds() - _cpu_start);
+}
+
+LoadTelemetry::LoadTelemetry(const std::string& loader, const std::string& path)
+  : _loader(loader), _path(path), _cpu_start(ProcessCpuSeconds()) {}
+
+LoadTelemetry::Stage& LoadTelemetry::FindStage(const std::string& stage) {
+  // A load has a dozen stages at most
+  for (auto& existing : _stages) {
+    if (existing.name == stage)
+      return existing;
+  }
+  _stages.push_back({stage, 0, 0, 0});
+  return _stages.back();
+}
+
+void LoadTelemetry::AddStage(const std::string& stage, double wall_seconds, double cpu_seconds) {
+  Stage& existing = FindStage(stage);
+  existing.wall_seconds += wall_seconds;
+  existing.cpu_seconds += cpu_seconds;
+  ++existing.calls;
+}
+
+void LoadTelemetry::AddBatch(const DecodedBatch& batch, const FieldTable& fields) {
+  n_records += batch.n_records;
+  n_bytes += batch.n_bytes;
+  n_messages += batch.n_messages;
+  n_failures += batch.n_failures;
+  max_store_bytes = std::max(max_store_bytes, batch.store.MemoryUsage());
+  const auto& tables = batch.store.Tables();
+  for (TableId id = 0; id < tables.size(); ++id) {
+    const size_t n_rows = tables[id].NumRows();
+    if (n_rows == 0)
+      continue;
+    const std::string& name = fields.Table(id).name;
+    messages_per_type[name.substr(0, name.rfind("__"))] += n_rows;
+  }
+  AddStage("pipeline/workers", batch.worker_seconds, batch.worker_cpu_seconds);
+}
+
+void LoadTelemetry::Warn(const std::string& warning) {
+  warnings.push_back(warning);
+  qWarning("%s", warning.c_str());
+}
+
+void LoadTelemetry::Report(const PJ::PlotDataMapRef& plot_data) {
+  _seconds = _timer.Seconds();
+  _cpu_seconds = ProcessCpuSeconds() - _cpu_start;
+  // Loaders get an empty PlotDataMapRef, so everything in it was created by this load
+  n_series = plot_data.numeric.size() + plot_data.strings.size();
+  n_samples = 0;
+  for (const auto& pair : plot_data.numeric)
+    n_samples += pair.second.size();
+  for (const auto& pair : plot_data.strings)
+    n_samples += pair.second.size();
+
+  if (const char* json_path = std::getenv("ELROY_LOAD_TELEMETRY")) {
+    if (!WriteJson(json_path))
+      Warn(std::string("Could not write ") + json_path);
+  }
+  if (qobject_cast<QApplication*>(QCoreApplication::instance()) == nullptr) {
+    std::cout << Summary() << std::endl;
+    return;
+  }
+  QSettings settings;
+  if (settings.value(QString::fromStdString(_loader) + "/load_summary", false).toBool()) {
+    LoadSummaryDialog dialog(*this);
+    dialog.exec();
+  }
+}
+
+std::string LoadTelemetry::Summary() const {
+  char line[256];
+  if (mode == "cache") {
+    std::snprintf(line, sizeof(line), "Loaded %zu samples of %zu series from the decoded cache in %.1f s", n_samples,
+                  n_series, _seconds);
+  } else if (mode == "listed") {
+    std::snprintf(line, sizeof(line), "Listed %zu series without decoding in %.1f s", n_series, _seconds);
+  } else {
+    const double seconds = _seconds > 0 ? _seconds : 1;
+    std::snprintf(line, sizeof(line), "Loaded %zu records, %zu messages, %.1f MB in %.1f s (%.1f MB/s, %.0f msg/s)",
+                  n_records, n_messages, n_bytes / 1e6, _seconds, n_bytes / 1e6 / seconds, n_messages / seconds);
+  }
+  std::string summary = line;
+  if (cancelled)
+    summary += " (cancelled)";
+  if (!warnings.empty())
+    summary += " (" + std::to_string(warnings.size()) + (warnings.size() == 1 ? " warning)" : " warnings)");
+  return summary;
+}
+
+QJsonObject LoadTelemetry::ToJson() const {
+  QJsonObject json;
+  json["loader"] = QString::fromStdString(_loader);
+  json["path"] = QString::fromStdString(_path);
+  json["mode"] = QString::fromStdString(mode);
+  json["cancelled"] = cancelled;
+  json["wall_seconds"] = _seconds;
+  json["cpu_seconds"] = _cpu_seconds;
+
+  QJsonArray stages;
+  for (const auto& stage : _stages) {
+    QJsonObject object;
+    object["name"] = QString::fromStdString(stage.name);
+    object["wall_seconds"] = stage.wall_seconds;
+    object["cpu_seconds"] = stage.cpu_seconds;
+    object["calls"] = static_cast<double>(stage.calls);
+    stages.append(object);
+  }
+  json["stages"] = stages;
+
+  QJsonObject counters;
+  counters["records"] = static_cast<double>(n_records);
+  counters["bytes"] = static_cast<double>(n_bytes);
+  counters["messages"] = static_cast<double>(n_messages);
+  counters["decode_failures"] = static_cast<double>(n_failures);
+  counters["series"] = static_cast<double>(n_series);
+  counters["samples"] = static_cast<double>(n_samples);
+  counters["max_store_bytes"] = static_cast<double>(max_store_bytes);
+  json["counters"] = counters;
+
+  QJsonObject per_type;
+  for (const auto& pair : messages_per_type)
+    per_type[QString::fromStdString(pair.first)] = static_cast<double>(pair.second);
+  json["messages_per_type"] = per_type;
+
+  QJsonArray warning_list;
+  for (const auto& warning : warnings)
+    warning_list.append(QString::fromStdString(warning));
+  json["warnings"] = warning_list;
+  return json;
+}
+
+bool LoadTelemetry::WriteJson(const std::string& path) const {
+  const QByteArray json = QJsonDocument(ToJson()).toJson(QJsonDocument::Indented);
+  FILE* file = std::fopen(path.c_str(), "wb");
+  if (file == nullptr)
+    return false;
+  const bool ok = std::fwrite(json.constData(), 1, static_cast<size_t>(json.size()), file) == static_cast<size_t>(json.size());
+  return std::fclose(file) == 0 && ok;
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <QJsonObject>
+
+#include "PlotJuggler/plotdata.h"
+
+struct DecodedBatch;
+class FieldTable;
+
+// @brief Measures the wall time of a load
+class LoadTimer
+{
+public:
+  LoadTimer() : _start(std::chrono::steady_clock::now()) {}
+
+  double Seconds() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+  }
+
+private:
+  std::chrono::steady_clock::time_point _start;
+};
+
+// @brief CPU time of the calling thread and of the whole process, in seconds
+double ThreadCpuSeconds();
+double ProcessCpuSeconds();
+
+// @brief Where the time of one load went, and what it read, decoded and created, so a slow load on a
+// user's machine can be told apart from a slow disk, decoder or plotjuggler.
+//
+// Stages are timed on the thread driving the load. Their CPU time is that of the whole process, so a
+// stage that waits on the decode workers shows the work they did meanwhile. Stage names nest with "/":
+// "pipeline/transfer" is the part of "pipeline" the writer spent handing batches to plotjuggler, and
+// "pipeline/workers" adds up the time every worker spent reading and decoding. Counters are only
+// updated from the writer, so nothing here is shared with the workers.
+class LoadTelemetry
+{
+public:
+  struct Stage {
+    std::string name;
+    double wall_seconds = 0;
+    double cpu_seconds = 0;
+    size_t calls = 0;
+  };
+
+  // @brief Adds the time from its construction to its destruction to a stage
+  class Scope
+  {
+  public:
+    Scope(LoadTelemetry& telemetry, const std::string& stage);
+    ~Scope();
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+  private:
+    LoadTelemetry& _telemetry;
+    std::string _stage;
+    LoadTimer _timer;
+    double _cpu_start;
+  };
+
+  // @brief loader is the settings group of the loader, e.g. "PcapLoader"
+  LoadTelemetry(const std::string& loader, const std::string& path);
+
+  Scope Time(const std::string& stage) { return Scope(*this, stage); }
+  // @brief Add time to stage, creating it the first time; stages keep the order they were created in
+  void AddStage(const std::string& stage, double wall_seconds, double cpu_seconds);
+
+  // @brief Count a batch handed to the pipeline's writer, including its workers' time
+  void AddBatch(const DecodedBatch& batch, const FieldTable& fields);
+  // @brief Note something the load skipped or couldn't do, e.g. write a sidecar. Warnings are listed in
+  // the summary and the JSON, and passed to qWarning, since plotjuggler shows no console.
+  void Warn(const std::string& warning);
+
+  // @brief Finish the load: count the series and samples in plot_data, then show the summary dialog if the loader's
+  // "load_summary" setting is on, write the JSON to $ELROY_LOAD_TELEMETRY if it is set, and outside
+  // plotjuggler (e.g. PcapLoaderExec) print the summary line
+  void Report(const PJ::PlotDataMapRef& plot_data);
+
+  // @brief One line, e.g. "Loaded 1200000 records, 3500000 messages, 1500.0 MB in 12.3 s (121.9 MB/s,
+  // 284552 msg/s)"
+  std::string Summary() const;
+  QJsonObject ToJson() const;
+  // @brief Write ToJson to path. Returns false if it can't be written.
+  bool WriteJson(const std::string& path) const;
+
+  const std::vector<Stage>& Stages() const { return _stages; }
+  double Seconds() const { return _seconds; }
+
+  // How the samples were loaded: "decoded", "cache" or "listed" (a lazy load that only listed fields)
+  std::string mode = "decoded";
+  // The user cancelled the load part way, see LoadProgress
+  bool cancelled = false;
+  // sqlite rows or pcap packets
+  size_t n_records = 0;
+  // Bytes handed to the decoder
+  size_t n_bytes = 0;
+  size_t n_messages = 0;
+  // Accepted messages by message type, without the instance
+  std::map<std::string, size_t> messages_per_type;
+  // Records with bytes the decoder couldn't decode
+  size_t n_failures = 0;
+  // Series and samples in plotjuggler once the load is done
+  size_t n_series = 0;
+  size_t n_samples = 0;
+  // Largest SeriesStore of a batch, i.e. the memory one batch takes before it reaches plotjuggler
+  size_t max_store_bytes = 0;
+  // See Warn
+  std::vector<std::string> warnings;
+
+private:
+  Stage& FindStage(const std::string& stage);
+
+  std::string _loader;
+  std::string _path;
+  LoadTimer _timer;
+  double _cpu_start;
+  double _seconds = 0;
+  double _cpu_seconds = 0;
+  std::vector<Stage> _stages;
+};
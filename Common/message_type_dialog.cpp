@@ -0,0 +1,76 @@
+#include "message_type_dialog.h"
+
+#include <QDialogButtonBox>
+#include <QHBoxLayout>
+#include <QLabel>
+#include <QPushButton>
+#include <QSettings>
+#include <QVBoxLayout>
+
+#include <map>
+
+MessageTypeDialog::MessageTypeDialog(const FieldTable& scanned, const QString& scan_summary,
+                                     const QString& settings_group, QWidget* parent)
+  : QDialog(parent), _settings_group(settings_group) {
+  setWindowTitle("Select the message types to decode");
+  QSettings settings;
+  const QStringList checked = settings.value(_settings_group + "/lazy_message_types").toStringList();
+
+  // Sorted by name, so the instances of a type end up next to each other. Tables of types the resolver
+  // rejected have no fields and are left out.
+  std::map<std::string, size_t> n_fields;
+  for (FieldId id = 0; id < scanned.NumFields(); ++id)
+    ++n_fields[scanned.Table(scanned.Field(id).table).name];
+
+  _types = new QListWidget(this);
+  for (const auto& pair : n_fields) {
+    const QString name = QString::fromStdString(pair.first);
+    auto item = new QListWidgetItem(QString("%1 (%2 fields)").arg(name).arg(pair.second), _types);
+    item->setData(Qt::UserRole, name);
+    item->setFlags(item->flags() | Qt::ItemIsUserCheckable);
+    item->setCheckState(checked.contains(name) ? Qt::Checked : Qt::Unchecked);
+  }
+
+  auto all = new QPushButton("Check all", this);
+  auto none = new QPushButton("Check none", this);
+  auto set_all = [this](Qt::CheckState state) {
+    for (int i = 0; i < _types->count(); ++i)
+      _types->item(i)->setCheckState(state);
+  };
+  connect(all, &QPushButton::clicked, this, [set_all]() { set_all(Qt::Checked); });
+  connect(none, &QPushButton::clicked, this, [set_all]() { set_all(Qt::Unchecked); });
+  auto check_buttons = new QHBoxLayout();
+  check_buttons->addWidget(all);
+  check_buttons->addWidget(none);
+  check_buttons->addStretch();
+
+  auto buttons = new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel, this);
+  connect(buttons, &QDialogButtonBox::accepted, this, &QDialog::accept);
+  connect(buttons, &QDialogButtonBox::rejected, this, &QDialog::reject);
+
+  auto layout = new QVBoxLayout(this);
+  layout->addWidget(new QLabel(QString("%1 message types. ").arg(n_fields.size()) + scan_summary, this));
+  layout->addWidget(new QLabel("Fields of unchecked types are listed without samples.", this));
+  layout->addWidget(_types);
+  layout->addLayout(check_buttons);
+  layout->addWidget(buttons);
+  setLayout(layout);
+}
+
+std::vector<std::string> MessageTypeDialog::MessageTypes() const {
+  std::vector<std::string> types;
+  for (int i = 0; i < _types->count(); ++i) {
+    const QListWidgetItem* item = _types->item(i);
+    if (item->checkState() == Qt::Checked)
+      types.push_back(item->data(Qt::UserRole).toString().toStdString());
+  }
+  return types;
+}
+
+void MessageTypeDialog::SaveSettings() const {
+  QStringList checked;
+  for (const auto& type : MessageTypes())
+    checked.push_back(QString::fromStdString(type));
+  QSettings settings;
+  settings.setValue(_settings_group + "/lazy_message_types", checked);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <QDialog>
+#include <QListWidget>
+#include <string>
+#include <vector>
+
+#include "field_table.h"
+
+// @brief Lazy loading: lists the message types a quick scan of a log found, with their number of
+// fields, and asks which ones to decode. Every field still shows up in plotjuggler's tree, but only the
+// checked message types get samples; reloading the file brings the dialog back to add more. The
+// checked types are remembered for the next load, under settings_group.
+class MessageTypeDialog : public QDialog
+{
+public:
+  // @brief scanned holds the tables and fields found by the scan; scan_summary tells the user how
+  // complete it is
+  MessageTypeDialog(const FieldTable& scanned, const QString& scan_summary, const QString& settings_group,
+                    QWidget* parent = nullptr);
+
+  // @brief The checked message types, as table names for RecordFilter::message_types
+  std::vector<std::string> MessageTypes() const;
+
+  // @brief Remember the checked types in QSettings
+  void SaveSettings() const;
+
+private:
+  QString _settings_group;
+  QListWidget* _types;
+};
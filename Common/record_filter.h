@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// @brief The records of a log or capture to load. An empty filter loads everything.
+struct RecordFilter {
+  // Inclusive time range, in seconds
+  bool has_time_range = false;
+  int64_t begin_time = 0;
+  int64_t end_time = 0;
+  // Accepted source IPs (from_ip of an elroy_log, IPv4 source address of a capture); empty accepts
+  // every source
+  std::vector<std::string> sources;
+  // Accepted IPv4 destination addresses and UDP ports (source or destination) of a capture; empty
+  // accepts all. Logs don't record either.
+  std::vector<std::string> destinations;
+  std::vector<uint16_t> ports;
+  // Accepted message types, e.g. "VlThrusterState" for every instance or "VlThrusterState__2" for
+  // one; empty accepts every type. Other messages are dropped before any of their fields are stored.
+  std::vector<std::string> message_types;
+  // Accepted series, see FieldSelection; empty accepts every field
+  std::vector<std::string> field_patterns;
+
+  // @brief True if whole records are filtered, i.e. some records don't have to be read at all
+  bool SelectsRecords() const { return has_time_range || !sources.empty() || !destinations.empty() || !ports.empty(); }
+  bool Empty() const { return !SelectsRecords() && message_types.empty() && field_patterns.empty(); }
+};
+
+// @brief True if table_name (a message type, with "__<instance>" appended if it has an instance) is
+// one of message_types, or an instance of one of them. An empty list accepts every table.
+inline bool MatchesMessageType(const std::vector<std::string>& message_types, const std::string& table_name) {
+  if (message_types.empty())
+    return true;
+  const std::string type = table_name.substr(0, table_name.rfind("__"));
+  for (const auto& message_type : message_types) {
+    if (message_type == table_name || message_type == type)
+      return true;
+  }
+  return false;
+}
@@ -0,0 +1,421 @@
+#include "series_cache.h"
+
+#include <QSettings>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#ifndef ELROY_ECM_SCHEMA_ID
+// Builds that don't identify the schema can't tell each other's caches apart beyond kDecoderVersion
+#define ELROY_ECM_SCHEMA_ID "unknown"
+#endif
+
+namespace {
+constexpr char kMagic[8] = {'P', 'J', 'S', 'E', 'R', 'I', 'E', 'S'};
+constexpr uint32_t kVersion = 3;
+// Written as 1 by the machine that built the cache, so a foreign byte order reads as something else
+constexpr uint32_t kByteOrderMark = 1;
+constexpr uint32_t kNumeric = 0;
+constexpr uint32_t kString = 1;
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t decoder_version;
+  uint64_t source_size;
+  int64_t source_mtime_ns;
+  // Offset of the field names, after the last block
+  uint64_t footer_offset;
+  uint64_t n_points;
+};
+
+// One batch of one table: n_rows timestamps, followed by n_columns columns
+struct TableBlock {
+  uint32_t n_columns;
+  uint32_t reserved;
+  uint64_t n_rows;
+};
+
+// Followed, if the field had no value in some of the table's rows, by one bit per row in time order
+// set where it had one, padded to 8 bytes. Then n_values doubles, or n_values string lengths and the
+// strings padded to 8 bytes.
+struct ColumnBlock {
+  uint32_t field;
+  uint32_t kind;
+  uint64_t n_values;
+};
+
+// Footer entry of a field, followed by its name
+struct FieldEntry {
+  uint32_t field;
+  uint32_t kind;
+};
+
+size_t Padding(size_t size) {
+  return (8 - size % 8) % 8;
+}
+
+// @brief Bounds checked reads from the mapped cache
+class Cursor
+{
+public:
+  Cursor(const uint8_t* begin, const uint8_t* end) : _pos(begin), _end(end) {}
+
+  bool AtEnd() const { return _pos == _end; }
+
+  // @brief Point data at the next size bytes. Returns false if there aren't as many left.
+  bool Take(size_t size, const uint8_t*& data) {
+    if (size > static_cast<size_t>(_end - _pos))
+      return false;
+    data = _pos;
+    _pos += size;
+    return true;
+  }
+  template <typename T>
+  bool Read(T& value) {
+    const uint8_t* data;
+    if (!Take(sizeof(T), data))
+      return false;
+    std::memcpy(&value, data, sizeof(T));
+    return true;
+  }
+  // @brief Take n_rows values of size bytes each, guarding against overflow of the product
+  bool TakeArray(uint64_t n_rows, size_t size, const uint8_t*& data) {
+    if (n_rows > static_cast<uint64_t>(_end - _pos) / size)
+      return false;
+    return Take(static_cast<size_t>(n_rows) * size, data);
+  }
+
+private:
+  const uint8_t* _pos;
+  const uint8_t* _end;
+};
+
+double DoubleAt(const uint8_t* data, size_t i) {
+  double value;
+  std::memcpy(&value, data + i * sizeof(double), sizeof(double));
+  return value;
+}
+
+uint32_t U32At(const uint8_t* data, size_t i) {
+  uint32_t value;
+  std::memcpy(&value, data + i * sizeof(uint32_t), sizeof(uint32_t));
+  return value;
+}
+
+bool BitAt(const uint8_t* data, size_t i) {
+  uint64_t word;
+  std::memcpy(&word, data + i / 64 * sizeof(uint64_t), sizeof(word));
+  return ((word >> (i % 64)) & 1) != 0;
+}
+
+// @brief Walk the blocks of body, calling on_column(field, n_rows, timestamps, present, values, strings)
+// for every column; present is nullptr if the column has a value in every row, strings is nullptr for
+// numeric columns. Returns false as soon as a block runs past the end, names an unknown field or
+// doesn't mark as many rows present as it has values.
+template <typename OnColumn>
+bool ForEachColumn(Cursor body, const std::unordered_map<uint32_t, uint32_t>& kinds, const OnColumn& on_column) {
+  while (!body.AtEnd()) {
+    TableBlock table;
+    const uint8_t* timestamps;
+    if (!body.Read(table) || !body.TakeArray(table.n_rows, sizeof(double), timestamps))
+      return false;
+    for (uint32_t c = 0; c < table.n_columns; ++c) {
+      ColumnBlock column;
+      if (!body.Read(column))
+        return false;
+      auto it = kinds.find(column.field);
+      if (it == kinds.end() || it->second != column.kind || column.n_values > table.n_rows)
+        return false;
+      const uint8_t* present = nullptr;
+      if (column.n_values < table.n_rows) {
+        if (!body.TakeArray((table.n_rows + 63) / 64, sizeof(uint64_t), present))
+          return false;
+        uint64_t n_present = 0;
+        for (size_t i = 0; i < table.n_rows; ++i)
+          n_present += BitAt(present, i);
+        if (n_present != column.n_values)
+          return false;
+      }
+      const uint8_t* values;
+      const uint8_t* strings = nullptr;
+      if (column.kind == kNumeric) {
+        if (!body.TakeArray(column.n_values, sizeof(double), values))
+          return false;
+      } else {
+        if (!body.TakeArray(column.n_values, sizeof(uint32_t), values))
+          return false;
+        uint64_t n_bytes = 0;
+        for (size_t i = 0; i < column.n_values; ++i)
+          n_bytes += U32At(values, i);
+        const uint8_t* padding;
+        if (!body.TakeArray(n_bytes, 1, strings) ||
+            !body.Take(Padding(static_cast<size_t>((column.n_values * sizeof(uint32_t) + n_bytes))), padding))
+          return false;
+      }
+      on_column(column.field, static_cast<size_t>(table.n_rows), timestamps, present, values, strings);
+    }
+  }
+  return true;
+}
+
+template <typename T>
+void WriteValue(std::ofstream& out, const T& value) {
+  out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+void WriteArray(std::ofstream& out, const std::vector<T>& values) {
+  if (!values.empty())
+    out.write(reinterpret_cast<const char*>(values.data()), static_cast<std::streamsize>(values.size() * sizeof(T)));
+}
+}  // namespace
+
+uint64_t SeriesCache::DecoderVersion() {
+  // FNV-1a of the schema id, seeded with kDecoderVersion
+  uint64_t hash = 14695981039346656037ull ^ kDecoderVersion;
+  for (const char* c = ELROY_ECM_SCHEMA_ID; *c != '\0'; ++c)
+    hash = (hash ^ static_cast<uint8_t>(*c)) * 1099511628211ull;
+  return hash;
+}
+
+bool SeriesCache::Enabled() {
+  QSettings settings;
+  return settings.value("ElroyPlugins/decoded_cache", true).toBool();
+}
+
+bool SeriesCache::SourceStamp(const std::string& source_path, uint64_t& size, int64_t& mtime_ns) {
+  struct stat st;
+  if (stat(source_path.c_str(), &st) != 0)
+    return false;
+  size = static_cast<uint64_t>(st.st_size);
+  mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+  return true;
+}
+
+bool SeriesCache::Load(const std::string& source_path, PJ::PlotDataMapRef& plot_data, size_t* n_points) {
+  uint64_t source_size;
+  int64_t source_mtime_ns;
+  if (!SourceStamp(source_path, source_size, source_mtime_ns))
+    return false;
+  const int fd = ::open(SidecarPath(source_path).c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) < sizeof(FileHeader)) {
+    ::close(fd);
+    return false;
+  }
+  const size_t size = static_cast<size_t>(st.st_size);
+  void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED)
+    return false;
+  madvise(addr, size, MADV_SEQUENTIAL);
+  const uint8_t* base = static_cast<const uint8_t*>(addr);
+
+  bool ok = false;
+  FileHeader header;
+  std::memcpy(&header, base, sizeof(header));
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) == 0 && header.version == kVersion &&
+      header.byte_order == kByteOrderMark && header.decoder_version == DecoderVersion() &&
+      header.source_size == source_size && header.source_mtime_ns == source_mtime_ns &&
+      header.footer_offset >= sizeof(FileHeader) && header.footer_offset <= size) {
+    // Read the field names, then check every block before the first point is pushed, so a damaged
+    // cache falls back to decoding instead of leaving half a load behind
+    std::unordered_map<uint32_t, uint32_t> kinds;
+    std::vector<std::pair<uint32_t, std::string>> names;
+    Cursor footer(base + header.footer_offset, base + size);
+    uint32_t n_fields = 0;
+    ok = footer.Read(n_fields);
+    for (uint32_t i = 0; ok && i < n_fields; ++i) {
+      FieldEntry field;
+      uint32_t length;
+      const uint8_t* name;
+      ok = footer.Read(field) && footer.Read(length) && footer.Take(length, name);
+      if (ok) {
+        kinds[field.field] = field.kind;
+        names.emplace_back(field.field, std::string(reinterpret_cast<const char*>(name), length));
+      }
+    }
+    const Cursor body(base + sizeof(FileHeader), base + header.footer_offset);
+    ok = ok && ForEachColumn(body, kinds,
+                             [](uint32_t, size_t, const uint8_t*, const uint8_t*, const uint8_t*, const uint8_t*) {});
+
+    if (ok) {
+      std::unordered_map<uint32_t, PJ::PlotData*> numeric;
+      std::unordered_map<uint32_t, PJ::StringSeries*> strings;
+      for (const auto& pair : names) {
+        if (kinds[pair.first] == kString)
+          strings[pair.first] = &(plot_data.addStringSeries(pair.second)->second);
+        else
+          numeric[pair.first] = &(plot_data.addNumeric(pair.second)->second);
+      }
+      ForEachColumn(body, kinds,
+        [&numeric, &strings](uint32_t field, size_t n_rows, const uint8_t* timestamps, const uint8_t* present,
+                             const uint8_t* values, const uint8_t* string_bytes) {
+          // j is the index of the next value, which only advances on rows where the field had one
+          size_t j = 0;
+          if (string_bytes == nullptr) {
+            PJ::PlotData* series = numeric[field];
+            for (size_t i = 0; i < n_rows; ++i) {
+              if (present == nullptr || BitAt(present, i))
+                series->pushBack(PJ::PlotData::Point(DoubleAt(timestamps, i), DoubleAt(values, j++)));
+            }
+          } else {
+            PJ::StringSeries* series = strings[field];
+            for (size_t i = 0; i < n_rows; ++i) {
+              if (present != nullptr && !BitAt(present, i))
+                continue;
+              const uint32_t length = U32At(values, j++);
+              series->pushBack({DoubleAt(timestamps, i), std::string(reinterpret_cast<const char*>(string_bytes), length)});
+              string_bytes += length;
+            }
+          }
+        });
+      if (n_points != nullptr)
+        *n_points = static_cast<size_t>(header.n_points);
+    }
+  }
+  munmap(addr, size);
+  return ok;
+}
+
+SeriesCache::~SeriesCache() {
+  Abort();
+}
+
+bool SeriesCache::Begin(const std::string& source_path) {
+  Abort();
+  if (!SourceStamp(source_path, _source_size, _source_mtime_ns))
+    return false;
+  _source_path = source_path;
+  _tmp_path = SidecarPath(source_path) + ".tmp";
+  _out.open(_tmp_path, std::ios::binary | std::ios::trunc);
+  if (!_out) {
+    _tmp_path.clear();
+    return false;
+  }
+  // The header is rewritten with the footer offset once the blocks are done
+  const FileHeader header{};
+  WriteValue(_out, header);
+  return true;
+}
+
+void SeriesCache::Write(const SeriesStore& store, const FieldTable& fields) {
+  if (!_out.is_open())
+    return;
+  std::vector<double> timestamps;
+  std::vector<uint64_t> present;
+  std::vector<double> values;
+  std::vector<uint32_t> lengths;
+  std::string bytes;
+  for (const auto& table : store.Tables()) {
+    if (table.NumRows() == 0)
+      continue;
+    // Rows go in the order TransferTo pushes them, so loading the cache appends exactly the same points
+    const std::vector<size_t> order = table.TimeOrder();
+    timestamps.clear();
+    for (size_t row : order)
+      timestamps.push_back(table.Timestamps()[row]);
+    const TableBlock table_block{static_cast<uint32_t>(table.Columns().size()), 0, timestamps.size()};
+    WriteValue(_out, table_block);
+    WriteArray(_out, timestamps);
+
+    for (const auto& pair : table.Columns()) {
+      const SeriesColumn& column = pair.second;
+      const bool is_string = column.type() == FieldType::String;
+      const ColumnBlock column_block{pair.first, is_string ? kString : kNumeric, column.NumValues()};
+      WriteValue(_out, column_block);
+      if (_fields.find(pair.first) == _fields.end())
+        _fields.insert({pair.first, {fields.Field(pair.first).name, column.type()}});
+      // Absent rows are left out of the values, and the bits tell the loader which rows they were
+      if (column.NumValues() < order.size()) {
+        present.assign((order.size() + 63) / 64, 0);
+        for (size_t i = 0; i < order.size(); ++i) {
+          if (column.Has(order[i]))
+            present[i / 64] |= uint64_t(1) << (i % 64);
+        }
+        WriteArray(_out, present);
+      }
+      if (!is_string) {
+        values.clear();
+        for (size_t row : order) {
+          if (column.Has(row))
+            values.push_back(column.NumericAt(row));
+        }
+        WriteArray(_out, values);
+      } else {
+        lengths.clear();
+        bytes.clear();
+        for (size_t row : order) {
+          if (!column.Has(row))
+            continue;
+          const std::string& value = column.StringAt(row);
+          lengths.push_back(static_cast<uint32_t>(value.size()));
+          bytes += value;
+        }
+        WriteArray(_out, lengths);
+        bytes.append(Padding(lengths.size() * sizeof(uint32_t) + bytes.size()), '\0');
+        _out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+      }
+      _n_points += column.NumValues();
+    }
+  }
+}
+
+bool SeriesCache::Finish() {
+  if (!_out.is_open())
+    return false;
+  FileHeader header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.byte_order = kByteOrderMark;
+  header.decoder_version = DecoderVersion();
+  header.source_size = _source_size;
+  header.source_mtime_ns = _source_mtime_ns;
+  header.footer_offset = static_cast<uint64_t>(_out.tellp());
+  header.n_points = _n_points;
+
+  WriteValue(_out, static_cast<uint32_t>(_fields.size()));
+  for (const auto& pair : _fields) {
+    const FieldEntry field{pair.first, pair.second.second == FieldType::String ? kString : kNumeric};
+    const std::string& name = pair.second.first;
+    WriteValue(_out, field);
+    WriteValue(_out, static_cast<uint32_t>(name.size()));
+    _out.write(name.data(), static_cast<std::streamsize>(name.size()));
+  }
+  _out.seekp(0);
+  WriteValue(_out, header);
+  _out.flush();
+  const bool written = static_cast<bool>(_out);
+  _out.close();
+
+  // A source that changed during the load may have grown past what was decoded
+  uint64_t source_size;
+  int64_t source_mtime_ns;
+  if (!written || !SourceStamp(_source_path, source_size, source_mtime_ns) || source_size != _source_size ||
+      source_mtime_ns != _source_mtime_ns || std::rename(_tmp_path.c_str(), SidecarPath(_source_path).c_str()) != 0) {
+    Abort();
+    return false;
+  }
+  _tmp_path.clear();
+  _fields.clear();
+  _n_points = 0;
+  return true;
+}
+
+void SeriesCache::Abort() {
+  if (_out.is_open())
+    _out.close();
+  if (!_tmp_path.empty())
+    std::remove(_tmp_path.c_str());
+  _tmp_path.clear();
+  _fields.clear();
+  _n_points = 0;
+}
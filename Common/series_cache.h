@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+
+#include "PlotJuggler/plotdata.h"
+#include "field_table.h"
+#include "series_store.h"
+
+// @brief Sidecar cache of the fully decoded series of a log or capture, "<source>.pjcache". A complete
+// load writes every batch's columns to it as they are transferred to plotjuggler; the next load of the
+// same file maps the cache and pushes the points straight into the series, without reading a single
+// record or running the decoder.
+//
+// The body is a sequence of column blocks, one per field and batch, each holding the batch's
+// timestamps and values of that field in time order. Rows where the field had no value are left out,
+// like TransferTo leaves them out of the series. The field names follow the blocks. The cache is
+// tied to the size and modification time of the source and to DecoderVersion(), and is ignored once
+// any of them changes. Like the pcap index it is written in host byte order.
+class SeriesCache
+{
+public:
+  // Bump whenever a change to the decoder or the loaders changes the series a file decodes to
+  static constexpr uint32_t kDecoderVersion = 1;
+
+  // @brief kDecoderVersion combined with the message schema the plugins were built against, so that
+  // regenerating elroy_common_msg invalidates every cache without anyone having to remember the bump.
+  // The schema is identified by ELROY_ECM_SCHEMA_ID, a hash of the generated headers set by CMake.
+  static uint64_t DecoderVersion();
+
+  static std::string SidecarPath(const std::string& source_path) { return source_path + ".pjcache"; }
+
+  // @brief Whether loads write and use caches: the "ElroyPlugins/decoded_cache" setting, on by default
+  static bool Enabled();
+
+  // @brief Push the cached series of source_path into plot_data. Returns false, without touching
+  // plot_data, if there is no cache or it is out of date or damaged. n_points is set to the number of
+  // points loaded.
+  static bool Load(const std::string& source_path, PJ::PlotDataMapRef& plot_data, size_t* n_points = nullptr);
+
+  SeriesCache() = default;
+  ~SeriesCache();
+  SeriesCache(const SeriesCache&) = delete;
+  SeriesCache& operator=(const SeriesCache&) = delete;
+
+  // @brief Start writing the cache of source_path. Returns false if it can't be created, in which case
+  // Write and Finish do nothing.
+  bool Begin(const std::string& source_path);
+  // @brief Append every column of store. Stores must be written in the order they reach plotjuggler.
+  void Write(const SeriesStore& store, const FieldTable& fields);
+  // @brief Write the field names and move the cache into place. The cache is dropped if the source
+  // changed since Begin, e.g. because it is still being recorded.
+  bool Finish();
+  // @brief Drop a cache that was begun, e.g. because the load failed or was cancelled
+  void Abort();
+  // @brief True between a successful Begin and Finish or Abort
+  bool IsOpen() const { return _out.is_open(); }
+
+private:
+  // Stat of the file the cache belongs to
+  static bool SourceStamp(const std::string& source_path, uint64_t& size, int64_t& mtime_ns);
+
+  std::string _source_path;
+  std::string _tmp_path;
+  std::ofstream _out;
+  uint64_t _source_size = 0;
+  int64_t _source_mtime_ns = 0;
+  uint64_t _n_points = 0;
+  // Name and type of every field that has a block, by field id
+  std::unordered_map<FieldId, std::pair<std::string, FieldType>> _fields;
+};
@@ -0,0 +1,251 @@
+#include "series_store.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+void SeriesColumn::AppendDouble(double value) {
+  assert(_type == Type::Double);
+  _doubles.push_back(value);
+  AppendPresence(_size++, true);
+}
+
+void SeriesColumn::AppendBool(bool value) {
+  assert(_type == Type::Bool);
+  if (_size % 64 == 0)
+    _bits.push_back(0);
+  if (value)
+    _bits.back() |= uint64_t(1) << (_size % 64);
+  AppendPresence(_size++, true);
+}
+
+void SeriesColumn::AppendString(const std::string& value) {
+  assert(_type == Type::String);
+  _codes.push_back(Code(value));
+  AppendPresence(_size++, true);
+}
+
+uint32_t SeriesColumn::Code(const std::string& value) {
+  auto it = _dictionary_index.find(value);
+  if (it == _dictionary_index.end()) {
+    it = _dictionary_index.insert({value, static_cast<uint32_t>(_dictionary.size())}).first;
+    _dictionary.push_back(value);
+  }
+  return it->second;
+}
+
+void SeriesColumn::AppendPresence(size_t row, bool present) {
+  if (_n_absent == 0) {
+    // Columns with a value in every row, i.e. most of them, keep no bits at all
+    if (present)
+      return;
+    _present.assign(row / 64, ~uint64_t(0));
+    if (row % 64 != 0)
+      _present.push_back((uint64_t(1) << (row % 64)) - 1);
+  }
+  if (row % 64 == 0)
+    _present.push_back(0);
+  if (present)
+    _present.back() |= uint64_t(1) << (row % 64);
+  else
+    ++_n_absent;
+}
+
+void SeriesColumn::PadTo(size_t n_rows) {
+  // The placeholders keep the values indexed by row; they are never read
+  while (_size < n_rows) {
+    switch (_type) {
+      case Type::Double: _doubles.push_back(std::numeric_limits<double>::quiet_NaN()); break;
+      case Type::Bool:
+        if (_size % 64 == 0)
+          _bits.push_back(0);
+        break;
+      case Type::String: _codes.push_back(Code("")); break;
+    }
+    AppendPresence(_size++, false);
+  }
+}
+
+void SeriesColumn::Append(const SeriesColumn& other) {
+  if (_n_absent > 0 || other._n_absent > 0) {
+    for (size_t i = 0; i < other._size; ++i)
+      AppendPresence(_size + i, other.Has(i));
+  }
+  switch (_type) {
+    case Type::Double:
+      _doubles.insert(_doubles.end(), other._doubles.begin(), other._doubles.end());
+      break;
+    case Type::Bool:
+      if (_size % 64 == 0) {
+        // Word aligned, so the packed bits can be copied as they are
+        _bits.insert(_bits.end(), other._bits.begin(), other._bits.end());
+      } else {
+        for (size_t i = 0; i < other._size; ++i) {
+          const size_t row = _size + i;
+          if (row % 64 == 0)
+            _bits.push_back(0);
+          if (other.NumericAt(i) != 0)
+            _bits.back() |= uint64_t(1) << (row % 64);
+        }
+      }
+      break;
+    case Type::String:
+      for (size_t i = 0; i < other._size; ++i)
+        _codes.push_back(Code(other.StringAt(i)));
+      break;
+  }
+  _size += other._size;
+}
+
+double SeriesColumn::NumericAt(size_t row) const {
+  switch (_type) {
+    case Type::Double: return _doubles[row];
+    case Type::Bool: return (_bits[row / 64] >> (row % 64)) & 1 ? 1.0 : 0.0;
+    case Type::String: break;
+  }
+  return std::numeric_limits<double>::quiet_NaN();
+}
+
+const std::string& SeriesColumn::StringAt(size_t row) const {
+  return _dictionary[_codes[row]];
+}
+
+size_t SeriesColumn::MemoryUsage() const {
+  size_t bytes = _doubles.capacity() * sizeof(double) + _bits.capacity() * sizeof(uint64_t) +
+                 _present.capacity() * sizeof(uint64_t) + _codes.capacity() * sizeof(uint32_t);
+  for (const auto& str : _dictionary)
+    bytes += sizeof(std::string) + str.capacity();
+  return bytes;
+}
+
+void SeriesTable::EndRow() {
+  for (auto& pair : _columns)
+    pair.second.PadTo(_timestamps.size());
+}
+
+uint32_t SeriesTable::AddColumn(FieldId field, FieldType type, size_t n_rows) {
+  _columns.emplace_back(field, SeriesColumn(type));
+  _columns.back().second.PadTo(n_rows);
+  return static_cast<uint32_t>(_columns.size() - 1);
+}
+
+void SeriesTable::AppendTimestamps(const SeriesTable& other) {
+  _timestamps.insert(_timestamps.end(), other._timestamps.begin(), other._timestamps.end());
+}
+
+std::vector<size_t> SeriesTable::TimeOrder() const {
+  std::vector<size_t> order(_timestamps.size());
+  std::iota(order.begin(), order.end(), 0);
+  if (!std::is_sorted(_timestamps.begin(), _timestamps.end())) {
+    std::stable_sort(order.begin(), order.end(),
+                     [this](size_t a, size_t b) { return _timestamps[a] < _timestamps[b]; });
+  }
+  return order;
+}
+
+void SeriesTable::TransferTo(const FieldTable& fields, PJ::PlotDataMapRef& plot_data) const {
+  // PlotData::pushBack is only cheap when points arrive in time order, so sort the rows once here
+  // instead of letting every series insert out of order samples
+  const std::vector<size_t> order = TimeOrder();
+  for (const auto& pair : _columns) {
+    const FieldInfo& field = fields.Field(pair.first);
+    const SeriesColumn& column = pair.second;
+    if (column.type() == FieldType::String) {
+      PJ::StringSeries* series = field.strings;
+      if (series == nullptr)
+        series = &(plot_data.addStringSeries(field.name)->second);
+      for (size_t row : order) {
+        if (column.Has(row))
+          series->pushBack({_timestamps[row], column.StringAt(row)});
+      }
+    } else {
+      PJ::PlotData* series = field.numeric;
+      if (series == nullptr)
+        series = &(plot_data.addNumeric(field.name)->second);
+      for (size_t row : order) {
+        if (column.Has(row))
+          series->pushBack(PJ::PlotData::Point(_timestamps[row], column.NumericAt(row)));
+      }
+    }
+  }
+}
+
+size_t SeriesTable::MemoryUsage() const {
+  size_t bytes = _timestamps.capacity() * sizeof(double);
+  for (const auto& pair : _columns)
+    bytes += sizeof(pair) + pair.second.MemoryUsage();
+  return bytes;
+}
+
+SeriesTable& SeriesStore::Table(TableId table) {
+  if (table >= _tables.size())
+    _tables.resize(table + 1);
+  return _tables[table];
+}
+
+uint32_t& SeriesStore::ColumnIndex(FieldId field) {
+  if (field >= _column_index.size())
+    _column_index.resize(field + 1, kNoColumn);
+  return _column_index[field];
+}
+
+void SeriesStore::BeginRow(TableId table, double timestamp) {
+  Table(table).BeginRow(timestamp);
+}
+
+SeriesColumn& SeriesStore::Column(const FieldInfo& field) {
+  SeriesTable& table = Table(field.table);
+  uint32_t& index = ColumnIndex(field.id);
+  // A column that first appears part way through the table has no value for the earlier rows
+  if (index == kNoColumn)
+    index = table.AddColumn(field.id, field.type, table.NumRows() - 1);
+  return table.ColumnAt(index);
+}
+
+void SeriesStore::EndRow(TableId table) {
+  _tables[table].EndRow();
+}
+
+void SeriesStore::Merge(const SeriesStore& other) {
+  for (TableId id = 0; id < other._tables.size(); ++id) {
+    const SeriesTable& source = other._tables[id];
+    if (source.NumRows() == 0)
+      continue;
+    SeriesTable& table = Table(id);
+    const size_t n_rows = table.NumRows();
+    table.AppendTimestamps(source);
+    for (const auto& pair : source.Columns()) {
+      uint32_t& index = ColumnIndex(pair.first);
+      if (index == kNoColumn)
+        index = table.AddColumn(pair.first, pair.second.type(), n_rows);
+      table.ColumnAt(index).Append(pair.second);
+    }
+    table.EndRow();
+  }
+}
+
+void SeriesStore::TransferTo(const FieldTable& fields, PJ::PlotDataMapRef& plot_data) const {
+  for (const auto& table : _tables)
+    table.TransferTo(fields, plot_data);
+}
+
+void SeriesStore::Clear() {
+  _tables.clear();
+  _column_index.clear();
+}
+
+size_t SeriesStore::NumRows() const {
+  size_t n_rows = 0;
+  for (const auto& table : _tables)
+    n_rows += table.NumRows();
+  return n_rows;
+}
+
+size_t SeriesStore::MemoryUsage() const {
+  size_t bytes = _column_index.capacity() * sizeof(uint32_t);
+  for (const auto& table : _tables)
+    bytes += sizeof(table) + table.MemoryUsage();
+  return bytes;
+}
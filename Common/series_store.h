@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "PlotJuggler/plotdata.h"
+#include "field_table.h"
+
+// @brief A single typed, contiguous column of samples. Numbers are stored unboxed, booleans are bit
+// packed and strings are dictionary encoded, which is a fraction of the size of one
+// std::variant<std::string, double, bool> per sample. Rows where the field had no value hold a
+// placeholder and are marked absent, so they never become samples.
+class SeriesColumn
+{
+public:
+  using Type = FieldType;
+
+  explicit SeriesColumn(Type type) : _type(type) {}
+
+  Type type() const { return _type; }
+  size_t Size() const { return _size; }
+
+  // @brief Append a value. Only the call of the column's type may be used.
+  void AppendDouble(double value);
+  void AppendBool(bool value);
+  void AppendString(const std::string& value);
+
+  // @brief Append absent rows until the column holds n_rows rows
+  void PadTo(size_t n_rows);
+
+  // @brief Append all rows of other, which must have the same type
+  void Append(const SeriesColumn& other);
+
+  // @brief Whether the field had a value in row
+  bool Has(size_t row) const { return _n_absent == 0 || ((_present[row / 64] >> (row % 64)) & 1) != 0; }
+  // @brief Number of rows where the field had a value
+  size_t NumValues() const { return _size - _n_absent; }
+  // @brief Value of a Double or Bool column as a double
+  double NumericAt(size_t row) const;
+  const std::string& StringAt(size_t row) const;
+
+  size_t MemoryUsage() const;
+
+private:
+  // @brief Record whether the row being appended at index row has a value
+  void AppendPresence(size_t row, bool present);
+  // @brief Index of value in the dictionary, adding it if needed
+  uint32_t Code(const std::string& value);
+
+  Type _type;
+  size_t _size = 0;
+  std::vector<double> _doubles;
+  std::vector<uint64_t> _bits;
+  // One bit per row, set where the field had a value. Only kept once a row is absent: until then
+  // _n_absent is 0 and every row has a value.
+  std::vector<uint64_t> _present;
+  size_t _n_absent = 0;
+  // Dictionary encoded strings: each row stores an index into _dictionary
+  std::vector<uint32_t> _codes;
+  std::vector<std::string> _dictionary;
+  std::unordered_map<std::string, uint32_t> _dictionary_index;
+};
+
+// @brief All samples of one message type and instance: a timestamp column shared by every field, plus
+// one column per field. Every column has one row per timestamp, absent where the message had no value
+// for the field.
+class SeriesTable
+{
+public:
+  void BeginRow(double timestamp) { _timestamps.push_back(timestamp); }
+  // @brief Mark the row absent in every column that wasn't written since BeginRow
+  void EndRow();
+
+  // @brief Add a column for field, with n_rows absent rows. Returns its index in this table.
+  uint32_t AddColumn(FieldId field, FieldType type, size_t n_rows);
+  SeriesColumn& ColumnAt(uint32_t index) { return _columns[index].second; }
+  const std::vector<std::pair<FieldId, SeriesColumn>>& Columns() const { return _columns; }
+
+  size_t NumRows() const { return _timestamps.size(); }
+  const std::vector<double>& Timestamps() const { return _timestamps; }
+  void AppendTimestamps(const SeriesTable& other);
+  // @brief Row indices sorted by timestamp, ties in insertion order
+  std::vector<size_t> TimeOrder() const;
+
+  // @brief Copy the rows of every column that have a value into plot_data, in timestamp order
+  void TransferTo(const FieldTable& fields, PJ::PlotDataMapRef& plot_data) const;
+
+  size_t MemoryUsage() const;
+
+private:
+  std::vector<double> _timestamps;
+  std::vector<std::pair<FieldId, SeriesColumn>> _columns;
+};
+
+// @brief Columnar intermediate store filled by the loaders' decode threads. Tables and columns are
+// indexed by the dense ids of a FieldTable shared by all threads. Each thread fills its own store; the
+// stores are merged in order and then bulk-transferred into PlotJuggler with a linear scan per column.
+class SeriesStore
+{
+public:
+  void BeginRow(TableId table, double timestamp);
+  // @brief Get the column of field, creating it if needed. Must be called between BeginRow and EndRow
+  // of the field's table.
+  SeriesColumn& Column(const FieldInfo& field);
+  void EndRow(TableId table);
+
+  // @brief Append the rows of other after the rows of this store
+  void Merge(const SeriesStore& other);
+
+  // @brief Copy every table into plot_data. Fields that have a cached series handle are written through
+  // it, the others are looked up by name.
+  void TransferTo(const FieldTable& fields, PJ::PlotDataMapRef& plot_data) const;
+
+  // @brief Tables indexed by TableId; tables that never got a row are empty
+  const std::vector<SeriesTable>& Tables() const { return _tables; }
+
+  void Clear();
+  bool Empty() const { return _tables.empty(); }
+  size_t NumRows() const;
+  size_t MemoryUsage() const;
+
+private:
+  static constexpr uint32_t kNoColumn = UINT32_MAX;
+
+  SeriesTable& Table(TableId table);
+  uint32_t& ColumnIndex(FieldId field);
+
+  std::vector<SeriesTable> _tables;
+  // Index of each field's column in its table
+  std::vector<uint32_t> _column_index;
+};
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// @brief Lock-free single producer, single consumer ring of variable length byte records, e.g. UDP
+// datagrams. The producer writes a record straight into the ring (BeginWrite/CommitWrite) and the
+// consumer reads it in place (BeginRead/CommitRead), so a record is never copied and neither side
+// ever waits on the other. Records never wrap around the end of the ring: when one doesn't fit
+// before the end, the rest of the ring is skipped.
+class SpscByteRing
+{
+public:
+  // @brief capacity is rounded up to a power of two
+  explicit SpscByteRing(size_t capacity) {
+    size_t size = 1024;
+    while (size < capacity)
+      size <<= 1;
+    _buffer.resize(size);
+  }
+
+  size_t Capacity() const { return _buffer.size(); }
+
+  // @brief Producer: reserve room for a record of up to max_size bytes. Returns nullptr if the ring is
+  // too full, otherwise the record must be finished with CommitWrite before the next BeginWrite.
+  uint8_t* BeginWrite(size_t max_size) {
+    const size_t needed = kHeaderSize + Align(max_size);
+    const size_t capacity = _buffer.size();
+    const size_t read = _read.load(std::memory_order_acquire);
+    size_t write = _write.load(std::memory_order_relaxed);
+    size_t pos = write & (capacity - 1);
+    size_t skip = 0;
+    if (capacity - pos < needed)
+      skip = capacity - pos;
+    if (needed > capacity || capacity - (write - read) < skip + needed)
+      return nullptr;
+    if (skip > 0) {
+      // Tell the consumer to continue at the start of the ring. Published by CommitWrite.
+      WriteHeader(pos, kWrapMarker);
+      write += skip;
+      pos = 0;
+    }
+    _pending_write = write;
+    return _buffer.data() + pos + kHeaderSize;
+  }
+
+  // @brief Producer: publish the record reserved by BeginWrite, which holds size bytes
+  void CommitWrite(size_t size) {
+    WriteHeader(_pending_write & (_buffer.size() - 1), static_cast<uint32_t>(size));
+    _write.store(_pending_write + kHeaderSize + Align(size), std::memory_order_release);
+  }
+
+  // @brief Consumer: get the oldest record. Returns false if the ring is empty, otherwise the record
+  // stays valid until CommitRead.
+  bool BeginRead(const uint8_t*& data, size_t& size) {
+    const size_t capacity = _buffer.size();
+    size_t read = _read.load(std::memory_order_relaxed);
+    const size_t write = _write.load(std::memory_order_acquire);
+    if (read == write)
+      return false;
+    size_t pos = read & (capacity - 1);
+    uint32_t header = ReadHeader(pos);
+    if (header == kWrapMarker) {
+      read += capacity - pos;
+      pos = 0;
+      header = ReadHeader(pos);
+    }
+    _pending_read = read + kHeaderSize + Align(header);
+    data = _buffer.data() + pos + kHeaderSize;
+    size = header;
+    return true;
+  }
+
+  // @brief Consumer: release the record returned by BeginRead
+  void CommitRead() { _read.store(_pending_read, std::memory_order_release); }
+
+private:
+  static constexpr size_t kHeaderSize = sizeof(uint32_t);
+  static constexpr uint32_t kWrapMarker = UINT32_MAX;
+
+  // Keep every header 4 byte aligned, so there is always room for a wrap marker before the end
+  static size_t Align(size_t size) { return (size + kHeaderSize - 1) & ~(kHeaderSize - 1); }
+  void WriteHeader(size_t pos, uint32_t header) { std::memcpy(_buffer.data() + pos, &header, sizeof(header)); }
+  uint32_t ReadHeader(size_t pos) const {
+    uint32_t header;
+    std::memcpy(&header, _buffer.data() + pos, sizeof(header));
+    return header;
+  }
+
+  std::vector<uint8_t> _buffer;
+  // Monotonic byte counters; the position in the ring is the counter modulo the capacity. Kept on
+  // separate cache lines so the two threads don't contend for one.
+  alignas(64) std::atomic<size_t> _write{0};
+  alignas(64) std::atomic<size_t> _read{0};
+  // Owned by the producer and the consumer respectively
+  alignas(64) size_t _pending_write = 0;
+  alignas(64) size_t _pending_read = 0;
+};
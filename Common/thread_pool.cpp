@@ -0,0 +1,143 @@
+#include "thread_pool.h"
+
+#include <QSettings>
+#include <algorithm>
+#include <exception>
+
+namespace {
+// Index of the pool worker running on this thread, or SIZE_MAX outside the pool
+thread_local size_t t_worker_index = SIZE_MAX;
+}  // namespace
+
+ThreadPool::ThreadPool(size_t n_threads) {
+  n_threads = std::max<size_t>(n_threads, 1);
+  for (size_t i = 0; i < n_threads; ++i)
+    _workers.push_back(std::make_unique<Worker>());
+  for (size_t i = 0; i < n_threads; ++i)
+    _threads.emplace_back([this, i]() { WorkerLoop(i); });
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(_sleep_mutex);
+    _stop = true;
+  }
+  _wake.notify_all();
+  for (auto& thread : _threads)
+    thread.join();
+}
+
+ThreadPool& ThreadPool::Instance() {
+  static ThreadPool pool(DecodeThreadCount());
+  return pool;
+}
+
+void ThreadPool::Submit(std::function<void()> task) {
+  // Workers push to their own deque so that nested tasks stay local; everyone else spreads the load
+  size_t index = t_worker_index;
+  if (index >= _workers.size())
+    index = _next_queue++ % _workers.size();
+  {
+    std::lock_guard<std::mutex> lock(_workers[index]->mutex);
+    _workers[index]->tasks.push_back(std::move(task));
+  }
+  ++_pending;
+  {
+    std::lock_guard<std::mutex> lock(_sleep_mutex);
+  }
+  _wake.notify_one();
+}
+
+bool ThreadPool::PopTask(size_t index, std::function<void()>& task) {
+  if (index < _workers.size()) {
+    Worker& own = *_workers[index];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.tasks.empty()) {
+      task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      --_pending;
+      return true;
+    }
+  }
+  for (size_t i = 1; i <= _workers.size(); ++i) {
+    Worker& victim = *_workers[(index + i) % _workers.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      --_pending;
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::WorkerLoop(size_t index) {
+  t_worker_index = index;
+  std::function<void()> task;
+  while (true) {
+    if (PopTask(index, task)) {
+      task();
+      task = nullptr;
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(_sleep_mutex);
+    _wake.wait(lock, [this]() { return _stop || _pending > 0; });
+    if (_stop && _pending == 0)
+      return;
+  }
+}
+
+void ThreadPool::ParallelFor(size_t n, size_t batch_size,
+                             const std::function<void(size_t slot, size_t begin, size_t end)>& fn) {
+  if (n == 0)
+    return;
+  batch_size = std::max<size_t>(batch_size, 1);
+  const size_t n_batches = (n + batch_size - 1) / batch_size;
+  std::atomic<size_t> remaining{n_batches};
+  std::mutex done_mutex;
+  std::condition_variable done;
+  std::exception_ptr error;
+
+  for (size_t batch = 0; batch < n_batches; ++batch) {
+    const size_t begin = batch * batch_size;
+    const size_t end = std::min(n, begin + batch_size);
+    Submit([&, begin, end]() {
+      const size_t slot = t_worker_index < _workers.size() ? t_worker_index : _workers.size();
+      try {
+        fn(slot, begin, end);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(done_mutex);
+        if (!error)
+          error = std::current_exception();
+      }
+      std::lock_guard<std::mutex> lock(done_mutex);
+      if (--remaining == 0)
+        done.notify_all();
+    });
+  }
+
+  // Help with the batches instead of sitting idle
+  std::function<void()> task;
+  while (remaining > 0) {
+    if (PopTask(t_worker_index, task)) {
+      task();
+      task = nullptr;
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(done_mutex);
+    done.wait_for(lock, std::chrono::milliseconds(1), [&remaining]() { return remaining == 0; });
+  }
+  // Take the lock so the last batch is done with the locals before they go out of scope
+  std::lock_guard<std::mutex> lock(done_mutex);
+  if (error)
+    std::rethrow_exception(error);
+}
+
+size_t DecodeThreadCount() {
+  QSettings settings;
+  const int n_threads = settings.value("ElroyPlugins/decode_threads", 0).toInt();
+  if (n_threads > 0)
+    return static_cast<size_t>(n_threads);
+  return std::max<size_t>(std::thread::hardware_concurrency(), 1);
+}
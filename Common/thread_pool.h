@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// @brief Persistent work-stealing thread pool shared by the loader plugins.
+//
+// PluginCommon is a shared library, so Instance() is one pool per process however many plugins
+// plotjuggler loads, and the decode_threads setting bounds the decode threads of all of them.
+//
+// Every worker owns a task deque: it pops its own tasks LIFO and, when it runs dry, steals FIFO from
+// the other workers. Tasks submitted from outside the pool are spread round-robin over the deques.
+class ThreadPool
+{
+public:
+  explicit ThreadPool(size_t n_threads);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // @brief The pool shared by all plugins in the process, sized by DecodeThreadCount() when first used
+  static ThreadPool& Instance();
+
+  size_t NumThreads() const { return _workers.size(); }
+  // @brief Number of distinct slot values passed to ParallelFor callbacks: one per worker plus one for
+  // the calling thread
+  size_t NumSlots() const { return _workers.size() + 1; }
+
+  void Submit(std::function<void()> task);
+
+  // @brief Run fn(slot, begin, end) over [0, n) in batches of at most batch_size items, scheduled
+  // dynamically over the pool. slot identifies the thread running the batch, so callers can keep one
+  // decoder/output per slot without locking. Blocks until every batch is done; the calling thread
+  // runs batches too while it waits. Rethrows the first exception thrown by fn.
+  // Must not be called concurrently from two threads outside the pool, as they would share a slot.
+  void ParallelFor(size_t n, size_t batch_size, const std::function<void(size_t slot, size_t begin, size_t end)>& fn);
+
+private:
+  struct Worker {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  void WorkerLoop(size_t index);
+  // @brief Pop a task from worker index's deque or steal one from another worker
+  bool PopTask(size_t index, std::function<void()>& task);
+
+  std::vector<std::unique_ptr<Worker>> _workers;
+  std::vector<std::thread> _threads;
+  std::atomic<size_t> _pending{0};
+  std::atomic<size_t> _next_queue{0};
+  std::mutex _sleep_mutex;
+  std::condition_variable _wake;
+  bool _stop = false;
+};
+
+// @brief Number of decode threads: the "ElroyPlugins/decode_threads" setting if it is positive,
+// std::thread::hardware_concurrency() otherwise
+size_t DecodeThreadCount();
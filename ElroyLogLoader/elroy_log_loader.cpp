@@ -9,756 +9,288 @@
 #include <QProgressDialog>
 #include <QDateTime>
 #include <QInputDialog>
+#include <QApplication>
 #include <thread>
 #include <sqlite3.h>
 #include <cstring>
 
-#include "elroy_common_msg/msg_handling/msg_decoder.h"
+#include "Common/decode_pipeline.h"
+#include "Common/decode_sink.h"
+#include "Common/ecm_decoder.h"
+#include "Common/field_table.h"
+#include "Common/load_progress.h"
+#include "Common/load_telemetry.h"
+#include "Common/load_dialog.h"
+#include "Common/message_type_dialog.h"
+#include "Common/series_cache.h"
+#include "records_index.h"
+#include "records_reader.h"
+#include "Common/series_store.h"
 
 
-using EcmMessageMap = std::unordered_map<std::string, std::variant<std::string, double, bool>>;
 ElroyLogLoader::ElroyLogLoader(){
     _extensions.push_back("elroy_log");
 }
-void ElroyLogLoader::WriteToPlotjugglerThreadSafe(const QString& field_name, const std::variant<std::string, double, bool> &data, double timestamp){
-  std::lock_guard<std::mutex> lock(_plotjuggler_mutex);
-  //Add a new column to the plotter if it does not already exist
-  if (_plots_map.find(field_name) == _plots_map.end() && (std::holds_alternative<double>(data) || std::holds_alternative<bool>(data))){
-    auto it = _plot_data->addNumeric(field_name.toStdString());
-    _plots_map[field_name] = (&(it->second));
-  }
-  else if (_string_map.find(field_name) == _string_map.end() && std::holds_alternative<std::string>(data) ){
-    auto it = _plot_data->addStringSeries(field_name.toStdString());
-    _string_map[field_name] = (&(it->second));
-  }
-  // Add the data to the plotter
-  if(std::holds_alternative<double>(data)){
-    PlotData::Point point(timestamp, std::get<double>(data));
-    _plots_map[field_name]->pushBack(point);
-  }else if(std::holds_alternative<std::string>(data)){
-    _string_map[field_name]->pushBack({timestamp, std::get<std::string>(data)});
-  }
-}
-std::vector<EcmMessageMap> ElroyLogLoader::ParseToEcmMap(const uint8_t* const raw_data, size_t byte_array_len, const std::string& delim){
-  size_t bytes_processed = 0;
-  size_t current_index = 0;
-  std::vector<EcmMessageMap> maps;
-  while (current_index <= byte_array_len){
-    if (current_index >= byte_array_len)
-      break;
-    EcmMessageMap map;
-    elroy_common_msg::MessageDecoderResult res;
-    if (!elroy_common_msg::MsgDecoder::DecodeAsMap(raw_data + current_index , byte_array_len-current_index, bytes_processed, map, res, delim)){
-      break;
-    }
-    current_index += bytes_processed;
-    maps.push_back(map);
-  }
-  return maps;
-}
-bool ElroyLogLoader::ParseEcmToPlotjuggler(const uint8_t* raw_data, size_t byte_array_len, const std::string &delim){
-  size_t bytes_processed = 0;
-  size_t current_index = 0;
-  while (current_index <= byte_array_len){
-    if (current_index >= byte_array_len)
-      break;
-    EcmMessageMap map;
-    elroy_common_msg::MessageDecoderResult res;
-    if (!elroy_common_msg::MsgDecoder::DecodeAsMap(raw_data + current_index , byte_array_len-current_index, bytes_processed, map, res, delim)){
-      break;
-    }
-    current_index += bytes_processed;
-    // Find the instance ID and rename
-    if (map.size() == 0)
-      continue;
-    // Find the type of the message
-    std::string first_key = map.begin()->first;
-    size_t pos = first_key.find(delim);
-    std::string message_type = map.begin()->first;
-    if (pos != std::string::npos){
-      message_type = message_type.substr(0,pos);
-    }
-    // Find the key that points to the instance id of this message type
-    if(_message_to_instance_id.find(message_type) == _message_to_instance_id.end()){
-      std::string instance_key;
-      const std::string instance_suffix = "component" + delim + "instance"; 
-      for(auto it = map.begin(); it!= map.end(); ++it){
-        const std::string& key = it->first;
-        if(key.size() > instance_suffix.size() && key.compare(key.size() - instance_suffix.size(), instance_suffix.size(), instance_suffix) == 0 ){
-          _message_to_instance_id.insert({message_type, key});
-        }
-      }
-    }
-    // Find the key that points to the timestamp of this message type
-    if(_message_id_to_timestamp_id.find(message_type) == _message_id_to_timestamp_id.end()){
-      std::string timestamp_key;
-      const std::string timestamp_suffix = "BusObject" + delim + "write_timestamp_ns";
-      for(auto it = map.begin(); it!= map.end(); ++it){
-        const std::string& key = it->first;
-        if(key.size() > timestamp_suffix.size() && key.compare(key.size() - timestamp_suffix.size(), timestamp_suffix.size(), timestamp_suffix) == 0 ){
-          _message_id_to_timestamp_id.insert({message_type, key});
-        }
-      }
-    }
-    // Get the instance id
-    std::string instance_id = "";
-    if(_message_to_instance_id.find(message_type) != _message_to_instance_id.end()){
-      const std::string& instance_key = _message_to_instance_id[message_type]; 
-      instance_id = "_"+  std::to_string(static_cast<size_t>(std::get<double>(map.at(instance_key))));
-    }
-    // Get the timestamp
-    std::string timestamp_key = _message_id_to_timestamp_id[message_type];
-    double timestamp = std::get<double>(map[timestamp_key]) / 1e9;
-    // Write each element from the ecm message map to plotjuggler
-    for (const auto& pair: map){
-      std::string field_name_str = pair.first;
-      field_name_str = field_name_str.insert(field_name_str.find(delim), "_"+instance_id);
-      QString field_name = QString::fromStdString(field_name_str);
-      WriteToPlotjugglerThreadSafe(field_name, pair.second, timestamp);
-    }
-  }
+bool ElroyLogLoader::AskForFilter(RecordsReader& records, RecordFilter& filter, bool& lazy){
+  // Only ask when running inside plotjuggler, not from ElroyLogLoaderExec
+  if (qobject_cast<QApplication*>(QCoreApplication::instance()) == nullptr)
+    return true;
+  int64_t log_begin, log_end;
+  if (!records.TimeRange(log_begin, log_end))
+    return true;
+  LoadDialog dialog(log_begin, log_end, "ElroyLogLoader");
+  if (dialog.exec() != QDialog::Accepted)
+    return false;
+  dialog.SaveSettings();
+  filter = dialog.Filter();
+  lazy = dialog.Lazy();
   return true;
 }
-bool ElroyLogLoader::MultithreadProcess(std::vector<BlobData> &data, size_t start_idx, size_t end_idx, size_t n_threads, std::string delim){
-  // This function should start multiple threads and process data in order
-  std::vector<std::vector<EcmMessageMap>> messages(n_threads);
-  std::vector<std::thread> threads;
-  const size_t chunkSize = data.size() / n_threads;
-  const size_t numRows = end_idx - start_idx; // number of rows in chunk
-  size_t n  = 0;
-  std::mutex mux;
-  std::cout << std::endl;
-  // Parse each message
-  for (size_t thread_idx = 0; thread_idx < n_threads; ++thread_idx) {
-    size_t startIndex = thread_idx * chunkSize;
-    size_t endIndex = (thread_idx == n_threads - 1) ? numRows : (thread_idx + 1) * chunkSize;
-    // const auto& maps = ParseToEcmMap(data_ptrs[j].getData(), data_ptrs[j].getSize(), delim);
-    threads.emplace_back([this, &n,&mux, &messages, &data, thread_idx, startIndex, endIndex, numRows, delim](){ /*&data_ptrs*/
-      for(size_t j = startIndex; j < endIndex; ++j){
-        const auto& maps = ParseToEcmMap(data[j].getData(), data[j].getSize(), delim);
-        messages[thread_idx].insert(messages[thread_idx].end(), maps.begin(), maps.end());
-        {
-          std::lock_guard<std::mutex> lock(mux);
-          std::cout << ++n << "\r" << std::flush;
-        }
-      }
+size_t ElroyLogLoader::ScanMessageTypes(const std::string& path, int64_t first_rowid, int64_t last_rowid,
+                                        const RecordFilter& filter, FieldTable& scanned){
+  DecodePipeline pipeline(scanned);
+  pipeline.SetMessageTypes(filter.message_types);
+  pipeline.SetFieldSelection(FieldSelection(filter.field_patterns));
+  std::vector<std::unique_ptr<RecordsReader>> readers(pipeline.NumWorkers());
+  const size_t n_batches = static_cast<size_t>((last_rowid - first_rowid) / kRowBatchSize + 1);
+  const size_t n_partitions = std::min(n_batches, kScanBatches);
+  size_t n_records = 0;
+  pipeline.RunPartitioned(n_partitions,
+    [&readers, &path, first_rowid, last_rowid, n_batches, n_partitions](size_t worker, size_t partition,
+                                                                         const DecodePipeline::RecordCallback& decode){
+      if (!readers[worker])
+        readers[worker] = std::make_unique<RecordsReader>(path);
+      // Spread the batches evenly over the log, so types that only show up part way through are found too
+      const size_t batch = partition * n_batches / n_partitions;
+      const int64_t begin = first_rowid + static_cast<int64_t>(batch * kRowBatchSize);
+      const int64_t end = std::min<int64_t>(begin + kRowBatchSize - 1, last_rowid);
+      readers[worker]->ReadRange(begin, end, [&decode](const uint8_t* data, size_t size){
+        decode(data, size, 0);
+      });
+    },
+    [&n_records](DecodedBatch& batch){
+      n_records += batch.n_records;
     });
-  }
-  for (auto& thread : threads) {
-    thread.join();
-  }
-  std::cout << std::endl;
-  std::cout << "Done loading chunk" << std::endl;
-  //map of keys to timestamp and instance id fields for each message
-  std::unordered_map<std::string, std::string> message_to_timestamp;
-  std::unordered_map<std::string, std::string> message_to_instance_id;
-  // Once I have each message parsed, write the data to plotjuggler
-  for(const auto& message_thread : messages){
-    for(const auto& map : message_thread){
-      // One message is an EcmMessageMap
-
-      // Find the type of the message
-      std::string first_key = map.begin()->first;
-      size_t pos = first_key.find(delim);
-      std::string message_type = map.begin()->first;
-      std::string instance_id = "";
-      if (pos != std::string::npos){
-        message_type = message_type.substr(0,pos);
-      }
-      // Find the key that points to the instance id of this message type
-      if(message_to_instance_id.find(message_type) == message_to_instance_id.end()){
-        std::string instance_key;
-        const std::string instance_suffix = "component" + delim + "instance"; 
-        for(auto it = map.begin(); it!= map.end(); ++it){
-          const std::string& key = it->first;
-          if(key.size() > instance_suffix.size() && key.compare(key.size() - instance_suffix.size(), instance_suffix.size(), instance_suffix) == 0 ){
-            message_to_instance_id.insert({message_type, key});
-          }
-        }
-      }
-      // Find the key that points to the timestamp of this message type
-      if(message_to_timestamp.find(message_type) == message_to_timestamp.end()){
-        std::string timestamp_key;
-        const std::string timestamp_suffix = "BusObject" + delim + "write_timestamp_ns";
-        for(auto it = map.begin(); it!= map.end(); ++it){
-          const std::string& key = it->first;
-          if(key.size() > timestamp_suffix.size() && key.compare(key.size() - timestamp_suffix.size(), timestamp_suffix.size(), timestamp_suffix) == 0 ){
-            message_to_timestamp.insert({message_type, key});
-          }
-        }
-      }
-      // Get the timestamp and instance id
-      const auto& timestamp_key = message_to_timestamp.at(message_type);
-      const double timestamp = std::get<double>(map.at(timestamp_key)) / 1e9;
-      if(message_to_instance_id.find(message_type) != message_to_instance_id.end()){
-        const auto& instance_key = message_to_instance_id.at(message_type);
-        instance_id = "_"+  std::to_string(static_cast<size_t>(std::get<double>(map.at(instance_key))));
-      }
-      // For each entry in the map, add it to plotjuggler
-      for (const auto& pair: map){
-        std::string field_name_str = pair.first;
-        if(instance_id.size() > 0)
-          field_name_str = field_name_str.insert(field_name_str.find(delim), "_"+instance_id);
-        QString field_name = QString::fromStdString(field_name_str);
-        WriteToPlotjugglerThreadSafe(field_name, pair.second, timestamp);
-      }
-    }
-  }
-
-  return true;
+  return n_records;
 }
-
 bool ElroyLogLoader::readDataFromFile_multithread(PJ::FileLoadInfo* fileload_info,
                       PlotDataMapRef& plot_data){
-  auto startTime = std::chrono::high_resolution_clock::now();
-  int numThreads = 8;
-  std::vector<std::thread> threads;
   std::string delim = "/";
   _plot_data = &plot_data;  
-  
-  // Initialize pointers to plotjuggler plots
-  std::map<QString, PlotData*> plots_map;
-  // Initialize pointers to plotjuggler string plots (this only displays the strings in the tree and does not plot them)
-  std::map<QString, PJ::StringSeries*> string_map;
+  _field_table = std::make_unique<FieldTable>(&plot_data);
 
-  // Load the elroy_log database file into a vector of packets
+  // Open the elroy_log database file
   const auto& path = fileload_info->filename.toStdString();
-  sqlite3* db;
-  int rc = sqlite3_open(path.c_str(), &db);
-  if (rc != SQLITE_OK) {
-    std::cerr << "Cannot open database: " << sqlite3_errmsg(db) << std::endl;
-    return rc;
-  }
-  // Count rows
-  const char* row_query = "SELECT COUNT(*) FROM records;";
-  sqlite3_stmt* stmt;
-  rc = sqlite3_prepare_v2(db, row_query, -1, &stmt, nullptr);
-  if (rc != SQLITE_OK) {
-      std::cerr << "Cannot prepare query: " << sqlite3_errmsg(db) << std::endl;
-      sqlite3_close(db);
-      return rc;
-  }
-  // Execute the query
-  rc = sqlite3_step(stmt);
-  if (rc != SQLITE_ROW) {
-      std::cerr << "Error executing query: " << sqlite3_errmsg(db) << std::endl;
-      sqlite3_finalize(stmt);
-      sqlite3_close(db);
-      return rc;
+  LoadTelemetry telemetry("ElroyLogLoader", path);
+  auto open_scope = std::make_unique<LoadTelemetry::Scope>(telemetry, "open");
+  RecordsReader records(path);
+  const int64_t numRows = records.Count();
+  int64_t first_rowid, last_rowid;
+  const bool has_rows = records.RowidRange(first_rowid, last_rowid);
+  open_scope.reset();
+  if (!has_rows) {
+    telemetry.Warn("No records in " + path);
+    telemetry.Report(plot_data);
+    return true;
   }
-  // Get the result of the COUNT(*) query
-  int numRows = sqlite3_column_int(stmt, 0);
 
-  // Prepare the SQL query
-  const char* query = "SELECT * FROM records;";
-  rc = sqlite3_prepare_v2(db, query, -1, &stmt, nullptr);
-  if (rc != SQLITE_OK) {
-        std::cerr << "Cannot prepare query: " << sqlite3_errmsg(db) << std::endl;
-        sqlite3_close(db);
-        return rc;
-  }        
-  size_t count = 0;
-  std::vector<BlobData> data_ptrs;
-  std::vector<const uint8_t*> raw_data_ptrs;
-  std::vector<size_t> data_lens;
-  std::cout << "Loading database..." << std::endl;
-  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-      std::cout << count << " of " << numRows << "\r" << std::flush;
-      ++count;
-      // Access the columns of the current row
-      int timestamp = sqlite3_column_int(stmt, 0);
-      const uint8_t* raw_data = reinterpret_cast<const uint8_t*>(sqlite3_column_blob(stmt, 1));
-      int column2 = sqlite3_column_int(stmt, 3);
-      const unsigned char* from_ip = sqlite3_column_text(stmt, 5);
-      const unsigned char* git_sha = sqlite3_column_text(stmt, 8);
-      size_t byte_array_len = sqlite3_column_int(stmt, 3);
-      BlobData myBlob(sqlite3_column_blob(stmt, 1), byte_array_len);
-      data_ptrs.push_back(std::move(myBlob)); // 2.03 sec to load 1.5 GB
-  }   
-
-  // multiprocessing in order
-  size_t chunk_size = 10000;
-  size_t n_chunks = static_cast<size_t>(std::ceil(static_cast<double>(data_ptrs.size()) / chunk_size));
-  for(size_t i = 0; i < n_chunks; ++i){
-    size_t start = i * chunk_size;
-    size_t end = (i == n_chunks - 1) ? data_ptrs.size() : (i + 1) * chunk_size;
-    std::cout << "start "<<start << " end "<<end <<std::endl;
-    MultithreadProcess(data_ptrs, start, end);
-    break;
+  // Ask which part of the log to load. With a filter, the matching rows are looked up in an index of
+  // the time and source columns, and only those rows are read.
+  RecordFilter filter;
+  bool lazy = false;
+  {
+    // Time spent on the dialogs is the user's, but it is part of the wall time of the load
+    auto scope = telemetry.Time("dialogs");
+    if (!AskForFilter(records, filter, lazy))
+      return false;
   }
-
-
-  std::cout << std::endl;
-  auto endTime1 = std::chrono::high_resolution_clock::now();
-  auto duration3 = std::chrono::duration_cast<std::chrono::milliseconds>(endTime1 - startTime);
-  std::cout << "Time to write to plotjuggler: " << duration3.count()/1000.0 << " seconds" << std::endl;
-  return true;
-  //below this, multiprocessing didn't do things in order
-
-
-  auto copyEndTime = std::chrono::high_resolution_clock::now();
-  auto duration1 = std::chrono::duration_cast<std::chrono::milliseconds>(copyEndTime - startTime);
-  std::cout << "Time taken to copy data: " << duration1.count()/1000.0 << " seconds" << std::endl;
-
-  // Convert each packet into a vector of Ecm message maps
-  const size_t chunkSize = numRows / numThreads;
-  std::vector<std::vector<EcmMessageMap>> list_of_maps(numRows);
-  std::vector<EcmMessageListMap> list_of_list_maps(numRows);
-  std::vector<std::vector<std::pair<std::string, PlotData::Point>>> pj_points_in_order(numRows);
-
-  std::mutex plotjuggler_mutex;  
-  std::cout << "Parsing data..." << std::endl;
-  for (size_t thread_idx = 0; thread_idx < numThreads; ++thread_idx) {
-    size_t startIndex = thread_idx * chunkSize;
-    size_t endIndex = (thread_idx == numThreads - 1) ? numRows : (thread_idx + 1) * chunkSize;
-    threads.emplace_back([this, &pj_points_in_order, &plotjuggler_mutex, &plots_map, &string_map, &list_of_list_maps, &data_ptrs, &raw_data_ptrs, &data_lens, &list_of_maps, thread_idx, startIndex, endIndex, numRows, delim](){ /*&data_ptrs*/
-      //map of keys to timestamp and instance id fields for each message
-      std::unordered_map<std::string, std::string> message_to_timestamp;
-      std::unordered_map<std::string, std::string> message_to_instance_id;
-      // Store a chunk of data to write to plotjuggler at once
-      EcmMessageListMap map_of_lists;
-      bool dump_to_plotjuggler = false;
-      for(size_t j = startIndex; j < endIndex; ++j){
-        // ParseEcmToPlotjuggler(raw_data_ptrs[j], data_lens[j], delim);
-        const auto& maps = ParseToEcmMap(data_ptrs[j].getData(), data_ptrs[j].getSize(), delim);
-        auto& map_list = list_of_list_maps[j];
-
-        for (const auto& map : maps){
-          if (map.size() == 0){
-            continue;
-          }
-          // Find the type of the message
-          std::string first_key = map.begin()->first;
-          size_t pos = first_key.find(delim);
-          std::string message_type = map.begin()->first;
-          std::string instance_id = "";
-          if (pos != std::string::npos){
-            message_type = message_type.substr(0,pos);
-          }
-
-          // Find the keys that point to the instance id
-          if(message_to_instance_id.find(message_type) == message_to_instance_id.end()){
-            std::string instance_key;
-            const std::string instance_suffix = "component" + delim + "instance"; 
-            for(auto it = map.begin(); it!= map.end(); ++it){
-              const std::string& key = it->first;
-              if(key.size() > instance_suffix.size() && key.compare(key.size() - instance_suffix.size(), instance_suffix.size(), instance_suffix) == 0 ){
-                message_to_instance_id.insert({message_type, key});
-              }
-            }
-          }
-          // Find the keys that point to the timestamp
-          if(message_to_timestamp.find(message_type) == message_to_timestamp.end()){
-            std::string timestamp_key;
-            const std::string timestamp_suffix = "BusObject" + delim + "write_timestamp_ns";
-            for(auto it = map.begin(); it!= map.end(); ++it){
-              const std::string& key = it->first;
-              if(key.size() > timestamp_suffix.size() && key.compare(key.size() - timestamp_suffix.size(), timestamp_suffix.size(), timestamp_suffix) == 0 ){
-                message_to_timestamp.insert({message_type, key});
-              }
-            }
-          }
-          // Get the timestamp and instance id
-          const auto& timestamp_key = message_to_timestamp.at(message_type);
-          const double timestamp = std::get<double>(map.at(timestamp_key)) / 1e9;
-          if(message_to_instance_id.find(message_type) != message_to_instance_id.end()){
-            const auto& instance_key = message_to_instance_id.at(message_type);
-            instance_id = "_"+  std::to_string(static_cast<size_t>(std::get<double>(map.at(instance_key))));
-          }
-
-          // std::lock_guard<std::mutex> lock(_plotjuggler_mutex);
-          // std::lock_guard<std::mutex> lock(plotjuggler_mutex);
-          // Get the instance id so we know the full message name
-          // std::string instance_key = "component" + delim + "instance"; 
-          // std::string instance_id = "";
-          // double instance_component = 0;
-          // for(auto it = map.begin(); it!= map.end(); ++it){
-          //   const std::string& key = it->first;
-          //   if(key.size() > instance_key.size() && key.compare(key.size() - instance_key.size(), instance_key.size(), instance_key) == 0 ){
-          //     instance_id = "_"+  std::to_string(static_cast<size_t>(std::get<double>(map.at(key))));
-          //   }
-          // }
-          // // Get the timestamp
-          // double timestamp = 0;
-          // std::string timestamp_key = "BusObject" + delim + "write_timestamp_ns";
-          // for(auto it = map.begin(); it!= map.end(); ++it){
-          //   const std::string& key = it->first;
-          //   if(key.size() > timestamp_key.size() && key.compare(key.size() - timestamp_key.size(), timestamp_key.size(), timestamp_key) == 0 ){
-          //     timestamp = std::get<double>(map.at(key)) / 1e9;
-          //   }
-          // }
-          // Finding timestamp and instance takes 
-          for (const auto& pair: map){
-            std::string field_name_str = pair.first;
-            if(instance_id.size() > 0)
-              field_name_str = field_name_str.insert(field_name_str.find(delim), "_"+instance_id);
-            QString field_name = QString::fromStdString(field_name_str);
-            // if (map_list.find(field_name_str) == map_list.end()){
-            //   map_list.insert({field_name_str,{}});
-            //   // std::cout << field_name_str << std::endl;
-            //   // if (j == 0)
-            //     // std::cout << "\nMap keys:" <<  map_list.size() << std::endl;
-            // }
-            // else{
-            //   std::cout << "duplicate field: " << field_name_str << std::endl;
-            // }
-            // map_list[field_name_str].push_back(pair.second);
-            // WriteToPlotjugglerThreadSafe(field_name, pair.second, timestamp);
-
-            // Add each data to a map that contains a list of map points, which will be periodically cleared and written to plotjuggler
-            map_of_lists.insert({field_name_str, {}}); 
-            map_of_lists[field_name_str].push_back(pair.second);
-            if (map_of_lists[field_name_str].size() > 1000)
-              dump_to_plotjuggler = true;
-            
-            // Problem: writing to plotjuggler using PushBack is slow b/c i'm not doing it in order. Solution:
-            // Write to a vector of PlotData points instead
-            // if(std::holds_alternative<double>(pair.second)){
-            //   PlotData::Point point(timestamp, std::get<double>(pair.second));
-            //   pj_points_in_order[thread_idx].push_back({field_name_str, point});
-            // }
-          }
-        }
-
-
-        // list_of_maps[j] = maps;
-        // ParseEcmToPlotjuggler(data_ptrs[j].getData(), data_ptrs[j].getSize(), delim); // 64 sec to load 1.5 GB (without writing to plotjuggler)
-        {
-          std::lock_guard<std::mutex> lock(this->_counter_mutex);
-          this->_msg_counter ++;
-          std::cout << "\r" << this->_msg_counter << " of " << numRows<< " " << 100 * this->_msg_counter / numRows << "%" << std::flush;
-          if (this->_msg_counter > 10000)
-            break;
-        }
-
-        // Send everything to plotjuggler - this is slow, perhaps because it is not in order
-        if(dump_to_plotjuggler){
-          std::lock_guard<std::mutex> lock(this->_counter_mutex);
-          for(auto& pair: map_of_lists){
-            const auto& field_name = pair.first;
-            const auto& data_vec = pair.second;
-            // Find the timestamp for this series
-            std::string message_type = field_name;
-            size_t pos = field_name.find(delim);
-            if (pos != std::string::npos){
-              message_type = message_type.substr(0,pos);
-            }
-            if (message_to_timestamp.find(message_type) == message_to_timestamp.end()){
-              // Find something that ends in "timestamp_ns" and starts with "message_type"
-              const std::string timestamp_suffix = "BusObject" + delim + "write_timestamp_ns";
-              const std::string prefix = message_type;
-              for(auto it = map_of_lists.begin(); it!= map_of_lists.end(); ++it){
-                const std::string& key = it->first;
-                if(key.substr(0,prefix.size()) == prefix && key.size() > timestamp_suffix.size() && key.compare(key.size() - timestamp_suffix.size(), timestamp_suffix.size(), timestamp_suffix) == 0 ){
-                  message_to_timestamp.insert({message_type, key});
-                  break;
-                }
-              }
-            }
-            const auto& timestamp_key = message_to_timestamp.at(message_type);
-            // WriteToPlotjugglerThreadSafe(field_name, pair.second, timestamp);
-            QString q_field_name = QString::fromStdString(field_name);
-            {
-              std::lock_guard<std::mutex> lock(_plotjuggler_mutex);
-              //Add a new column to the plotter if it does not already exist
-              if (_plots_map.find(q_field_name) == _plots_map.end() && (std::holds_alternative<double>(data_vec[0]) || std::holds_alternative<bool>(data_vec[0]))){
-                auto it = _plot_data->addNumeric(q_field_name.toStdString());
-                _plots_map[q_field_name] = (&(it->second));
-              }
-              else if (_string_map.find(q_field_name) == _string_map.end() && std::holds_alternative<std::string>(data_vec[0]) ){
-                auto it = _plot_data->addStringSeries(q_field_name.toStdString());
-                _string_map[q_field_name] = (&(it->second));
-              }
-              // Add the data to the plotter
-              if(std::holds_alternative<double>(data_vec[0])){
-                for(size_t i = 0; i < data_vec.size(); ++i){
-                  const double timestamp = std::get<double>(map_of_lists.at(timestamp_key)[i]) / 1e9;
-                  PlotData::Point point(timestamp, std::get<double>(data_vec[i]));
-                  // _plots_map[q_field_name]->insert()
-                  _plots_map[q_field_name]->pushBack(point);
-                }
-              }else if(std::holds_alternative<std::string>(data_vec[0])){
-                for(size_t i = 0; i < data_vec.size(); ++i){
-                  const double timestamp = std::get<double>(map_of_lists.at(timestamp_key)[i]) / 1e9;
-                  // _string_map[q_field_name]->pushBack({timestamp, std::get<std::string>(data_vec[i])});
-                }
-              }
-            }
-          }
-          // Delete the contents of map_of_lists
-          map_of_lists.clear();
-          dump_to_plotjuggler = false;
-        }
-
-      }
-    });
+  // A lazy load only decodes the message types picked from a scan of the log. The fields of the other
+  // types are added to the tree without samples once the load is done.
+  std::unique_ptr<FieldTable> scanned;
+  if (lazy) {
+    scanned = std::make_unique<FieldTable>();
+    size_t n_scanned;
+    {
+      auto scope = telemetry.Time("scan message types");
+      n_scanned = ScanMessageTypes(path, first_rowid, last_rowid, filter, *scanned);
+    }
+    {
+      auto scope = telemetry.Time("dialogs");
+      MessageTypeDialog dialog(*scanned, QString("Found in %1 of %2 records, rare types may be missing.")
+                                            .arg(n_scanned).arg(numRows),
+                               "ElroyLogLoader");
+      if (dialog.exec() != QDialog::Accepted)
+        return false;
+      dialog.SaveSettings();
+      filter.message_types = dialog.MessageTypes();
+    }
+    if (filter.message_types.empty()) {
+      scanned->CreateSeries(plot_data, [](const TableInfo&){ return true; });
+      telemetry.mode = "listed";
+      telemetry.Report(plot_data);
+      return true;
+    }
   }
-  std::cout << std::endl;
-  // Wait for all threads to finish
-  for (auto& thread : threads) {
-      thread.join();
+  // A complete load of a log that was loaded before is read back from its decoded cache. Otherwise the
+  // complete load writes the cache as it goes.
+  const bool use_cache = filter.Empty() && SeriesCache::Enabled();
+  if (use_cache) {
+    bool cached;
+    {
+      auto scope = telemetry.Time("load cache");
+      cached = SeriesCache::Load(path, plot_data);
+    }
+    if (cached) {
+      telemetry.mode = "cache";
+      telemetry.Report(plot_data);
+      return true;
+    }
+  }
+  SeriesCache cache;
+  // A log in a read-only directory just won't get a cache
+  if (use_cache && !cache.Begin(path))
+    telemetry.Warn("Could not write " + SeriesCache::SidecarPath(path));
+  std::vector<int64_t> rowids;
+  if (filter.SelectsRecords()) {
+    auto scope = telemetry.Time("select");
+    // The first filtered load of a log indexes its time and source columns, which takes a while on a
+    // long log. Cancelling it cancels the load.
+    LoadProgress index_progress;
+    auto index_dialog = LoadProgressDialog::Create(index_progress, "Indexing " + fileload_info->filename);
+    RecordsIndex index(path, &index_progress,
+                       index_dialog ? &LoadProgressDialog::ProcessEvents : std::function<void()>());
+    if (index_progress.Cancelled())
+      return false;
+    if (!index.BuildError().empty())
+      telemetry.Warn(index.BuildError());
+    rowids = index.MatchingRowids(filter);
   }
 
-  auto parseEndTime = std::chrono::high_resolution_clock::now();
-  auto duration2 = std::chrono::duration_cast<std::chrono::milliseconds>(parseEndTime - copyEndTime);
-  std::cout << "Time taken to parse data: " << duration2.count()/1000.0 << " seconds" << std::endl;
-  // for(size_t i = 0; i < data_ptrs.size(); ++i){
-  //     ParseEcmToPlotjuggler(reinterpret_cast<const uint8_t*>(data_ptrs[i].getData()), data_ptrs[i].getSize(), delim);
-  //     std::cout << i << std::endl;
-  //     if(i > 10000)
-  //       break;
-  // }
-  sqlite3_finalize(stmt);
-  sqlite3_close(db);
-  count = 0;
-  std::cout << "Writing to plotjuggler..." << std::endl;
-  for(const auto& vec_of_maps: list_of_maps){
-    for(const auto& map : vec_of_maps){
-      std::cout << ++count << " " << numRows<< "\r" << std::flush;
-      // Get the instance id
-      std::string instance_key = "component" + delim + "instance"; 
-      std::string instance_id = "";
-      double instance_component = 0;
-      for(auto it = map.begin(); it!= map.end(); ++it){
-        const std::string& key = it->first;
-        if(key.size() > instance_key.size() && key.compare(key.size() - instance_key.size(), instance_key.size(), instance_key) == 0 ){
-          instance_id = "_"+  std::to_string(static_cast<size_t>(std::get<double>(map.at(key))));
-        }
+  // Split the table into rowid ranges, or the matching rows into batches. Every decode thread opens
+  // its own read-only connection and reads the partitions it claims, so fetching blobs scales with the
+  // number of threads. This thread writes the partitions to plotjuggler in rowid order, while only a
+  // few are held in memory.
+  DecodePipeline pipeline(*_field_table, delim);
+  pipeline.SetMessageTypes(filter.message_types);
+  pipeline.SetFieldSelection(FieldSelection(filter.field_patterns));
+  std::vector<std::unique_ptr<RecordsReader>> readers(pipeline.NumWorkers());
+  const size_t n_partitions = !filter.SelectsRecords() ? static_cast<size_t>((last_rowid - first_rowid) / kRowBatchSize + 1)
+                                             : (rowids.size() + kRowBatchSize - 1) / kRowBatchSize;
+  // Workers count the rows they decode and the progress dialog samples the count, so nothing on the
+  // way prints or takes a lock. Cancelling keeps the rows up to where the load stopped.
+  LoadProgress progress;
+  progress.SetTotal(!filter.SelectsRecords() ? static_cast<size_t>(numRows) : rowids.size());
+  auto progress_dialog = LoadProgressDialog::Create(progress, "Loading " + fileload_info->filename);
+  pipeline.SetProgress(&progress);
+  if (progress_dialog)
+    pipeline.SetIdle(&LoadProgressDialog::ProcessEvents);
+  auto pipeline_scope = std::make_unique<LoadTelemetry::Scope>(telemetry, "pipeline");
+  pipeline.RunPartitioned(n_partitions,
+    [&readers, &path, &filter, &rowids, first_rowid, last_rowid](size_t worker, size_t partition, const DecodePipeline::RecordCallback& decode){
+      if (!readers[worker])
+        readers[worker] = std::make_unique<RecordsReader>(path);
+      // Blobs are decoded straight out of sqlite's memory map
+      auto decode_blob = [&decode](const uint8_t* data, size_t size){
+        decode(data, size, 0);
+      };
+      if (!filter.SelectsRecords()) {
+        const int64_t begin = first_rowid + static_cast<int64_t>(partition * kRowBatchSize);
+        const int64_t end = std::min<int64_t>(begin + kRowBatchSize - 1, last_rowid);
+        readers[worker]->ReadRange(begin, end, decode_blob);
+      } else {
+        const size_t begin = partition * kRowBatchSize;
+        const size_t n = std::min(kRowBatchSize, rowids.size() - begin);
+        readers[worker]->ReadRows(rowids.data() + begin, n, decode_blob);
       }
-      // Get the timestamp
-      double timestamp = 0;
-      std::string timestamp_key = "BusObject" + delim + "write_timestamp_ns";
-      for(auto it = map.begin(); it!= map.end(); ++it){
-        const std::string& key = it->first;
-        if(key.size() > timestamp_key.size() && key.compare(key.size() - timestamp_key.size(), timestamp_key.size(), timestamp_key) == 0 ){
-          timestamp = std::get<double>(map.at(key)) / 1e9;
-        }
+    },
+    [this, &telemetry, &cache](DecodedBatch& batch){
+      telemetry.AddBatch(batch, *_field_table);
+      {
+        auto scope = telemetry.Time("pipeline/transfer");
+        batch.store.TransferTo(*_field_table, *_plot_data);
       }
-      for (const auto& pair: map){
-        std::string field_name_str = pair.first;
-        field_name_str = field_name_str.insert(field_name_str.find(delim), "_"+instance_id);
-        QString field_name = QString::fromStdString(field_name_str);
-        WriteToPlotjugglerThreadSafe(field_name, pair.second, timestamp);
+      if (cache.IsOpen()) {
+        auto scope = telemetry.Time("pipeline/write cache");
+        cache.Write(batch.store, *_field_table);
       }
-    }
+    });
+  pipeline_scope.reset();
+  progress_dialog.reset();
+
+  // The cache of a cancelled load would pass for the whole log
+  telemetry.cancelled = progress.Cancelled();
+  if (telemetry.cancelled)
+    cache.Abort();
+  if (cache.IsOpen()) {
+    auto scope = telemetry.Time("finish cache");
+    if (!cache.Finish())
+      telemetry.Warn("Could not write " + SeriesCache::SidecarPath(path));
   }
-  std::cout << std::endl;
-  auto endTime = std::chrono::high_resolution_clock::now();
-  auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - parseEndTime);
-  std::cout << "Time to write to plotjuggler: " << duration.count()/1000.0 << " seconds" << std::endl;
+  if (scanned) {
+    auto scope = telemetry.Time("list other types");
+    scanned->CreateSeries(plot_data, [&filter](const TableInfo& table){
+      return !MatchesMessageType(filter.message_types, table.name);
+    });
+  }
+  telemetry.Report(plot_data);
   return true;
 }
-// bool ElroyLogLoader::readDataFromFile_multithread(PJ::FileLoadInfo* fileload_info,
-//                       PlotDataMapRef& plot_data){
-//   // Read in multithread mode from the database                      
-//   auto startTime = std::chrono::high_resolution_clock::now();
-//   int numThreads = 8;
-//   int chunk_size = 100;
-//   std::vector<std::thread> threads;
-//   std::string delim = "/";
-//   _plot_data = &plot_data;  
-  
-//   // Initialize pointers to plotjuggler plots
-//   std::map<QString, PlotData*> plots_map;
-//   // Initialize pointers to plotjuggler string plots (this only displays the strings in the tree and does not plot them)
-//   std::map<QString, PJ::StringSeries*> string_map;
-
-//   // Load the elroy_log database file into a vector of packets
-//   const auto& path = fileload_info->filename.toStdString();
-//   sqlite3* db;
-//   int rc = sqlite3_open(path.c_str(), &db);
-//   if (rc != SQLITE_OK) {
-//     std::cerr << "Cannot open database: " << sqlite3_errmsg(db) << std::endl;
-//     return rc;
-//   }
-//   // Count rows
-//   const char* row_query = "SELECT COUNT(*) FROM records;";
-//   sqlite3_stmt* stmt;
-//   rc = sqlite3_prepare_v2(db, row_query, -1, &stmt, nullptr);
-//   if (rc != SQLITE_OK) {
-//       std::cerr << "Cannot prepare query: " << sqlite3_errmsg(db) << std::endl;
-//       sqlite3_close(db);
-//       return rc;
-//   }
-//   // Execute the query
-//   rc = sqlite3_step(stmt);
-//   if (rc != SQLITE_ROW) {
-//       std::cerr << "Error executing query: " << sqlite3_errmsg(db) << std::endl;
-//       sqlite3_finalize(stmt);
-//       sqlite3_close(db);
-//       return rc;
-//   }
-//   // Get the result of the COUNT(*) query
-//   int numRows = sqlite3_column_int(stmt, 0);
-
-//   // Prepare the SQL query
-//   const char* query = "SELECT * FROM records;";
-//   rc = sqlite3_prepare_v2(db, query, -1, &stmt, nullptr);
-//   if (rc != SQLITE_OK) {
-//         std::cerr << "Cannot prepare query: " << sqlite3_errmsg(db) << std::endl;
-//         sqlite3_close(db);
-//         return rc;
-//   }           
-//   // Execute the query in multithreaded mode
-//   size_t rows_per_thread = numRows / numThreads;
-//   for (size_t i = 0; i < numThreads; ++i){
-//     size_t start_row = i * rows_per_thread;
-//     int end_row = (i == numThreads - 1) ? numRows : (i + 1) * rows_per_thread;
-//     threads.emplace_back([this,i, &query, start_row, end_row, numRows, path] {
-//       // Perform database read operation for the assigned range
-//       // A new db instance must be created per thread
-//       sqlite3* db;
-//       sqlite3_stmt* stmt;
-//       // Open the database
-//       {
-//           std::lock_guard<std::mutex> lock(this->_db_mutex);
-//           if (sqlite3_open(path.c_str(), &db) != SQLITE_OK) {
-//               std::cerr << "Cannot open database" << std::endl;
-//               return;
-//           }
-//       }
-//       // Prepare the query
-//       {
-//           std::lock_guard<std::mutex> lock(this->_db_mutex);
-//           if (sqlite3_prepare_v2(db, query, -1, &stmt, nullptr) != SQLITE_OK) {
-//               std::cerr << "Error preparing query: " << sqlite3_errmsg(db) << std::endl;
-//               sqlite3_close(db);
-//               return;
-//           }
-//       }
-//       // Move to the starting row
-//       for (int i = 0; i < start_row; ++i) {
-//           std::lock_guard<std::mutex> lock(this->_db_mutex);
-//           if (sqlite3_step(stmt) != SQLITE_ROW) {
-//               // Handle error or reach the end of the result set
-//               break;
-//           }
-//       }
-//       // Read data within the specified range
-//       for (int i = start_row; i < end_row; ++i) {
-//           {
-//             // increment counter
-//             std::lock_guard<std::mutex>(this->_counter_mutex);
-//             this->_msg_counter ++;
-//             if (i % 10 == 0){
-//               std::cout << this->_msg_counter << " : " << numRows << std::endl;
-//             }
-//             if (this->_msg_counter > 10000)
-//               break;
-//           }
-//           std::vector<EcmMessageMap> maps;
-//           {
-//               std::lock_guard<std::mutex> lock(this->_db_mutex);
-//               if (sqlite3_step(stmt) == SQLITE_ROW) {
-//                   // Read data from the current row
-//                   int timestamp = sqlite3_column_int(stmt, 0);
-//                   const uint8_t* raw_data = reinterpret_cast<const uint8_t*>(sqlite3_column_blob(stmt, 1)); // 3.6 seconds to read all from database
-//                   int column2 = sqlite3_column_int(stmt, 3);
-//                   const unsigned char* from_ip = sqlite3_column_text(stmt, 5);
-//                   const unsigned char* git_sha = sqlite3_column_text(stmt, 8);
-//                   size_t byte_array_len = sqlite3_column_int(stmt, 3);
-//                   // Process the data as needed
-//                   maps = this->ParseToEcmMap(raw_data, byte_array_len);
-//               } else {
-//                   // Handle error or reach the end of the result set
-//                   break;
-//               }
-//           }
-//           // Send the maps to plotjuggler
-//           for(const auto& map : maps){
-
-//             // this->WriteToPlotjugglerThreadSafe();
-//           }
-//       }
-//     });
-//   }
-//   // Join all threads
-//   for (auto& thread : threads) {
-//       thread.join();
-//   }
-//   auto endTime = std::chrono::high_resolution_clock::now();
-//   auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
-//   std::cout << "Time taken by function: " << duration.count()/1000.0 << " seconds" << std::endl;
-//   return true;
-// }
 bool ElroyLogLoader::readDataFromFile(PJ::FileLoadInfo* fileload_info,
                       PlotDataMapRef& plot_data){
-  // return readDataFromFile_multithread(fileload_info, plot_data);  // Uncomment this to use the multithreaded implementation                      
-  auto startTime = std::chrono::high_resolution_clock::now();
+  return readDataFromFile_multithread(fileload_info, plot_data);
+}
+bool ElroyLogLoader::readDataFromFile_singlethread(PJ::FileLoadInfo* fileload_info,
+                      PlotDataMapRef& plot_data){
   std::string delim = "/";
   _plot_data = &plot_data;
+  _field_table = std::make_unique<FieldTable>(&plot_data);
+  EcmDecoder decoder(*_field_table, delim);
+  PlotDataSink plot_sink;
 
-  // Initialize pointers to plotjuggler plots
-  std::map<QString, PlotData*> plots_map;
-  // Initialize pointers to plotjuggler string plots (this only displays the strings in the tree and does not plot them)
-  std::map<QString, PJ::StringSeries*> string_map;
-
-  // Load the elroy_log database file into a vector of packets
+  // Open the elroy_log database file
   const auto& path = fileload_info->filename.toStdString();
-  sqlite3* db;
-  int rc = sqlite3_open(path.c_str(), &db);
-  if (rc != SQLITE_OK) {
-    std::cerr << "Cannot open database: " << sqlite3_errmsg(db) << std::endl;
-    return rc;
+  LoadTelemetry telemetry("ElroyLogLoader", path);
+  RecordsReader records(path);
+  const int64_t numRows = records.Count();
+  int64_t first_rowid, last_rowid;
+  if (!records.RowidRange(first_rowid, last_rowid)) {
+    telemetry.Warn("No records in " + path);
+    telemetry.Report(plot_data);
+    return true;
   }
-  // Count rows
-  const char* row_query = "SELECT COUNT(*) FROM records;";
-  sqlite3_stmt* stmt;
-  rc = sqlite3_prepare_v2(db, row_query, -1, &stmt, nullptr);
-  if (rc != SQLITE_OK) {
-      std::cerr << "Cannot prepare query: " << sqlite3_errmsg(db) << std::endl;
-      sqlite3_close(db);
-      return rc;
-  }
-  // Execute the query
-  rc = sqlite3_step(stmt);
-  if (rc != SQLITE_ROW) {
-      std::cerr << "Error executing query: " << sqlite3_errmsg(db) << std::endl;
-      sqlite3_finalize(stmt);
-      sqlite3_close(db);
-      return rc;
-  }
-  // Get the result of the COUNT(*) query
-  int numRows = sqlite3_column_int(stmt, 0);
 
-  // Prepare the SQL query
-  const char* query = "SELECT * FROM records;";
-  // sqlite3_stmt* stmt;
-  rc = sqlite3_prepare_v2(db, query, -1, &stmt, nullptr);
-  if (rc != SQLITE_OK) {
-        std::cerr << "Cannot prepare query: " << sqlite3_errmsg(db) << std::endl;
-        sqlite3_close(db);
-        return rc;
-  }
-  size_t count = 0;
-  elroy_common_msg::MsgDecoder decoder;
-  std::vector<EcmMessageMap> maps;
-  size_t n_msgs = 0;
-  // Execute the query and retrieve data
-  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-      std::cout << count << " of " << numRows << " " << 100 * count / numRows << "%\r" << std::flush;
-      ++count;
-      // Access the columns of the current row
-      int timestamp = sqlite3_column_int(stmt, 0);
-      const uint8_t* raw_data = reinterpret_cast<const uint8_t*>(sqlite3_column_blob(stmt, 1));
-      int column2 = sqlite3_column_int(stmt, 3);
-      const unsigned char* from_ip = sqlite3_column_text(stmt, 5);
-      const unsigned char* git_sha = sqlite3_column_text(stmt, 8);
-      size_t byte_array_len = sqlite3_column_int(stmt, 3);
-      ParseEcmToPlotjuggler(raw_data, byte_array_len, delim);
-      if (count > 10000)
-        break;
+  // Decode every blob in place, straight into plotjuggler. Reading, decoding and writing are one
+  // stage here. Rows are read a batch at a time, and between batches the progress dialog gets to run.
+  LoadProgress progress;
+  progress.SetTotal(static_cast<size_t>(numRows));
+  auto progress_dialog = LoadProgressDialog::Create(progress, "Loading " + fileload_info->filename);
+  {
+    auto scope = telemetry.Time("read, decode and write");
+    for (int64_t begin = first_rowid; begin <= last_rowid && !progress.Cancelled(); begin += kRowBatchSize) {
+      const int64_t end = std::min<int64_t>(begin + kRowBatchSize - 1, last_rowid);
+      const size_t n_before = telemetry.n_records;
+      records.ReadRange(begin, end, [&decoder, &plot_sink, &telemetry](const uint8_t* raw_data, size_t byte_array_len){
+        ++telemetry.n_records;
+        telemetry.n_messages += decoder.Decode(raw_data, byte_array_len, plot_sink);
+        telemetry.n_bytes += byte_array_len;
+      });
+      progress.Add(telemetry.n_records - n_before);
+      if (progress_dialog)
+        LoadProgressDialog::ProcessEvents();
+    }
   }
-  auto endTime = std::chrono::high_resolution_clock::now();
-  auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
-  std::cout << "Time taken by function: " << duration.count()/1000.0 << " seconds" << std::endl;
+  progress_dialog.reset();
+  telemetry.cancelled = progress.Cancelled();
+  telemetry.n_failures = decoder.NumFailures();
+  telemetry.Report(plot_data);
   return true;
 };
-int main()
+// Example program: run ~/build/ElroyLogLoaderExec with a log, e.g. one written by ecm_generator
+int main(int argc, char** argv)
 {
   ElroyLogLoader loader;
   PJ::FileLoadInfo file_info;
-  file_info.filename = QString::fromStdString("/home/mark/Downloads/2023_11_12-14_14-Elroy_Log_File-ELROYLOG_V1_1-65ab13ad_RECOVERED.elroy_log");
+  file_info.filename = QString::fromStdString(argc > 1 ? argv[1] : "/home/mark/Downloads/2023_11_12-14_14-Elroy_Log_File-ELROYLOG_V1_1-65ab13ad_RECOVERED.elroy_log");
   PlotDataMapRef plot_data;
   loader.readDataFromFile(&file_info,plot_data);
 }
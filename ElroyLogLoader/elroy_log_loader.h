@@ -12,55 +12,16 @@
 #include "PlotJuggler/dataloader_base.h"
 #include <cstring>
 
-using namespace PJ;
+#include "Common/decode_pipeline.h"
+#include "Common/decode_sink.h"
+#include "Common/ecm_decoder.h"
+#include "Common/field_table.h"
+#include "Common/series_store.h"
+#include "records_index.h"
+#include "records_reader.h"
 
+using namespace PJ;
 
-class BlobData {
-public:
-    BlobData(const void* data, int size) : size(size) {
-        // Allocate memory and copy the BLOB data
-        if (size > 0) {
-            buffer = new uint8_t[size];
-            std::memcpy(buffer, data, size);
-        }
-    }
-
-    ~BlobData() {
-        // Release allocated memory
-        delete[] buffer;
-    }
-
-    // Accessors
-    const uint8_t* getData() const {
-        return buffer;
-    }
-
-    int getSize() const {
-        return size;
-    }
-
-    // Move constructor
-    BlobData(BlobData&& other) noexcept : buffer(other.buffer), size(other.size) {
-        other.buffer = nullptr;
-        other.size = 0;
-    }
-
-    // Move assignment operator
-    BlobData& operator=(BlobData&& other) noexcept {
-        if (this != &other) {
-            delete[] buffer;
-            buffer = other.buffer;
-            size = other.size;
-            other.buffer = nullptr;
-            other.size = 0;
-        }
-        return *this;
-    }
-
-private:
-    uint8_t* buffer;
-    int size;
-};
 
 class ElroyLogLoader : public DataLoader
 {
@@ -73,10 +34,17 @@ public:
   virtual const std::vector<const char*>& compatibleFileExtensions() const override{
     return _extensions;
   };
+  // @brief this is the entry point that plotjuggler will call. It streams the whole log through
+  // readDataFromFile_multithread
   bool readDataFromFile(PJ::FileLoadInfo* fileload_info,
                         PlotDataMapRef& destination) override;
+  // @brief Read rowid ranges of the log in parallel and stream them through a DecodePipeline. Memory is
+  // bounded by the pipeline depth, not the size of the log.
   bool readDataFromFile_multithread(PJ::FileLoadInfo* fileload_info,
                         PlotDataMapRef& destination);                      
+  // @brief Decode every row on the calling thread, straight into plotjuggler
+  bool readDataFromFile_singlethread(PJ::FileLoadInfo* fileload_info,
+                        PlotDataMapRef& destination);
 
   ~ElroyLogLoader() override = default;
 
@@ -90,34 +58,25 @@ protected:
   QSize parseHeader(QFile* file, std::vector<std::string>& ordered_names);
 
 private:
-  using EcmMessageMap = std::unordered_map<std::string, std::variant<std::string, double, bool>>;
-  using EcmMessageListMap = std::unordered_map<std::string, std::vector<std::variant<std::string, double, bool>>>;
-  void WriteToPlotjugglerThreadSafe(const QString& field_name, const std::variant<std::string, double, bool> &data, double timestamp);
-  bool ParseEcmToPlotjuggler(const uint8_t* const buf, size_t buff_len, const std::string& delim = "/");
-
-  std::vector<EcmMessageMap> ParseToEcmMap(const uint8_t* const buf, size_t buff_len, const std::string& delim = "/");
+  // @brief Ask the user which part of the log to load, and whether to load it lazily. Returns false if
+  // the load was cancelled.
+  bool AskForFilter(RecordsReader& records, RecordFilter& filter, bool& lazy);
+  // @brief Decode kScanBatches batches of rows spread over the log into scanned, to find its message
+  // types and their fields. Returns the number of records decoded.
+  size_t ScanMessageTypes(const std::string& path, int64_t first_rowid, int64_t last_rowid,
+                          const RecordFilter& filter, FieldTable& scanned);
 
-  // This processes a small bunch of data, multithreaded. Once the data is all done it writes it to plotjuggler
-  bool MultithreadProcess(std::vector<BlobData> &data, size_t start_idx, size_t end_idx, size_t n_threads = 8, std::string delim="/");
-  
   std::vector<const char*> _extensions;
 
   std::string _default_time_axis;
 
-  // Pointers to plotjuggler plots
-  std::unordered_map<QString, PlotData*> _plots_map;
-  // Pointers pointers to plotjuggler string plots (this only displays the strings in the tree and does not plot them)
-  std::unordered_map<QString, PJ::StringSeries*> _string_map;
-
-  //map of keys to timestamp and instance id fields for each message
-  std::unordered_map<std::string, std::string> _message_id_to_timestamp_id;
-  std::unordered_map<std::string, std::string> _message_to_instance_id;
-
-  // Mutex for writing to plotjuggler
-  std::mutex _plotjuggler_mutex;
-  PlotDataMapRef* _plot_data;
-  std::mutex _db_mutex;
+  // Interned fields with their plotjuggler series
+  std::unique_ptr<FieldTable> _field_table;
+  // Number of rowids per DecodePipeline batch
+  static constexpr size_t kRowBatchSize = 512;
+  // Number of batches decoded by ScanMessageTypes
+  static constexpr size_t kScanBatches = 64;
 
-  size_t _msg_counter = 0;
-  std::mutex _counter_mutex;
+  // Destination of the load in progress
+  PlotDataMapRef* _plot_data = nullptr;
 };
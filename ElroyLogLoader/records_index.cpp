@@ -0,0 +1,232 @@
+#include "records_index.h"
+
+#include <cstdio>
+#include <stdexcept>
+
+#include "Common/load_progress.h"
+#include "records_reader.h"
+
+namespace {
+void Exec(sqlite3* db, const std::string& sql) {
+  char* error = nullptr;
+  if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &error) != SQLITE_OK) {
+    std::string message = error != nullptr ? error : "unknown error";
+    sqlite3_free(error);
+    throw std::runtime_error("Error executing \"" + sql + "\": " + message);
+  }
+}
+
+// Run a query returning one integer
+int64_t QueryInt(sqlite3* db, const std::string& sql) {
+  sqlite3_stmt* stmt;
+  if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+    throw std::runtime_error("Cannot prepare \"" + sql + "\": " + sqlite3_errmsg(db));
+  int64_t value = 0;
+  if (sqlite3_step(stmt) == SQLITE_ROW)
+    value = sqlite3_column_int64(stmt, 0);
+  sqlite3_finalize(stmt);
+  return value;
+}
+
+// @brief A sidecar being built: closes its connection and statements, and unless the build got to
+// the end, deletes its temporary file, whichever way the build is left
+struct SidecarBuild {
+  explicit SidecarBuild(const std::string& tmp_path) : tmp_path(tmp_path) {}
+  ~SidecarBuild() {
+    sqlite3_finalize(select);
+    sqlite3_finalize(insert);
+    sqlite3_close(db);
+    if (!done)
+      std::remove(tmp_path.c_str());
+  }
+
+  std::string tmp_path;
+  sqlite3* db = nullptr;
+  sqlite3_stmt* select = nullptr;
+  sqlite3_stmt* insert = nullptr;
+  bool done = false;
+};
+}  // namespace
+
+RecordsIndex::RecordsIndex(const std::string& log_path, LoadProgress* progress, const std::function<void()>& idle)
+  : _log_path(log_path), _progress(progress), _idle(idle) {
+  if (sqlite3_open_v2(log_path.c_str(), &_log_db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+    std::string message = sqlite3_errmsg(_log_db);
+    sqlite3_close(_log_db);
+    throw std::runtime_error("Cannot open database (" + log_path + "): " + message);
+  }
+  _time_column = RecordsReader::ColumnName(_log_db, RecordsReader::kTimeColumn);
+  _source_column = RecordsReader::ColumnName(_log_db, RecordsReader::kSourceColumn);
+
+  if (LogHasTimeIndex()) {
+    _index_db = _log_db;
+    _table = "records";
+    return;
+  }
+  const std::string stamp = LogStamp();
+  if (!OpenSidecar(stamp)) {
+    try {
+      BuildSidecar(stamp);
+    } catch (const std::exception& e) {
+      // e.g. the log is in a read-only directory. Filtering still works, it just scans the log.
+      if (_progress == nullptr || !_progress->Cancelled())
+        _build_error = "Cannot build " + SidecarPath(log_path) + ": " + e.what();
+      CloseIndexDb();
+      _index_db = _log_db;
+      _table = "records";
+    }
+  }
+}
+
+RecordsIndex::~RecordsIndex() {
+  CloseIndexDb();
+  sqlite3_close(_log_db);
+}
+
+void RecordsIndex::CloseIndexDb() {
+  if (_index_db != nullptr && _index_db != _log_db)
+    sqlite3_close(_index_db);
+  _index_db = nullptr;
+}
+
+bool RecordsIndex::LogHasTimeIndex() const {
+  sqlite3_stmt* stmt;
+  if (sqlite3_prepare_v2(_log_db, "SELECT name FROM pragma_index_list('records');", -1, &stmt, nullptr) != SQLITE_OK)
+    return false;
+  bool found = false;
+  while (!found && sqlite3_step(stmt) == SQLITE_ROW) {
+    const std::string index = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+    sqlite3_stmt* info;
+    const std::string query = "SELECT name FROM pragma_index_info(" + RecordsReader::Quote(index) + ") WHERE seqno = 0;";
+    if (sqlite3_prepare_v2(_log_db, query.c_str(), -1, &info, nullptr) == SQLITE_OK) {
+      if (sqlite3_step(info) == SQLITE_ROW && sqlite3_column_type(info, 0) != SQLITE_NULL)
+        found = reinterpret_cast<const char*>(sqlite3_column_text(info, 0)) == _time_column;
+      sqlite3_finalize(info);
+    }
+  }
+  sqlite3_finalize(stmt);
+  return found;
+}
+
+std::string RecordsIndex::LogStamp() const {
+  // Logs are only ever appended to, so the last rowid and the size identify a version of the log
+  const int64_t max_rowid = QueryInt(_log_db, "SELECT MAX(rowid) FROM records;");
+  const int64_t page_count = QueryInt(_log_db, "PRAGMA page_count;");
+  return std::to_string(max_rowid) + ":" + std::to_string(page_count);
+}
+
+bool RecordsIndex::OpenSidecar(const std::string& stamp) {
+  const std::string path = SidecarPath(_log_path);
+  sqlite3* db;
+  if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+    sqlite3_close(db);
+    return false;
+  }
+  bool current = false;
+  sqlite3_stmt* stmt;
+  if (sqlite3_prepare_v2(db, "SELECT value FROM meta WHERE key = 'stamp';", -1, &stmt, nullptr) == SQLITE_OK) {
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+      current = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)) == stamp;
+    sqlite3_finalize(stmt);
+  }
+  if (!current) {
+    sqlite3_close(db);
+    return false;
+  }
+  _index_db = db;
+  _table = "records_index";
+  _time_column = "time";
+  _source_column = "source";
+  return true;
+}
+
+void RecordsIndex::BuildSidecar(const std::string& stamp) {
+  // Build into a temporary file and move it in place, so a cancelled build never leaves a sidecar
+  // that looks current
+  const std::string path = SidecarPath(_log_path);
+  SidecarBuild build(path + ".tmp");
+  std::remove(build.tmp_path.c_str());
+  if (sqlite3_open(build.tmp_path.c_str(), &build.db) != SQLITE_OK)
+    throw std::runtime_error(sqlite3_errmsg(build.db));
+  sqlite3* db = build.db;
+  Exec(db, "PRAGMA journal_mode = OFF; PRAGMA synchronous = OFF;");
+  Exec(db, "CREATE TABLE meta (key TEXT PRIMARY KEY, value TEXT);");
+  Exec(db, "CREATE TABLE records_index (rowid INTEGER PRIMARY KEY, time INTEGER, source TEXT);");
+  Exec(db, "BEGIN;");
+
+  const std::string query = "SELECT rowid, " + RecordsReader::Quote(_time_column) + ", " +
+                            RecordsReader::Quote(_source_column) + " FROM records;";
+  if (sqlite3_prepare_v2(_log_db, query.c_str(), -1, &build.select, nullptr) != SQLITE_OK)
+    throw std::runtime_error(sqlite3_errmsg(_log_db));
+  if (sqlite3_prepare_v2(db, "INSERT INTO records_index VALUES (?1, ?2, ?3);", -1, &build.insert, nullptr) != SQLITE_OK)
+    throw std::runtime_error(sqlite3_errmsg(db));
+  if (_progress != nullptr)
+    _progress->SetTotal(static_cast<size_t>(QueryInt(_log_db, "SELECT COUNT(*) FROM records;")));
+  int64_t n_rows = 0;
+  int rc;
+  while ((rc = sqlite3_step(build.select)) == SQLITE_ROW) {
+    sqlite3_bind_int64(build.insert, 1, sqlite3_column_int64(build.select, 0));
+    sqlite3_bind_int64(build.insert, 2, sqlite3_column_int64(build.select, 1));
+    sqlite3_bind_text(build.insert, 3, reinterpret_cast<const char*>(sqlite3_column_text(build.select, 2)), -1,
+                      SQLITE_TRANSIENT);
+    // e.g. the disk is full. An index missing rows would silently drop them from filtered loads.
+    if (sqlite3_step(build.insert) != SQLITE_DONE)
+      throw std::runtime_error(sqlite3_errmsg(db));
+    sqlite3_reset(build.insert);
+    if (++n_rows % kProgressRows == 0 && _progress != nullptr) {
+      _progress->Add(kProgressRows);
+      if (_idle)
+        _idle();
+      if (_progress->Cancelled())
+        throw std::runtime_error("cancelled");
+    }
+  }
+  if (rc != SQLITE_DONE)
+    throw std::runtime_error(sqlite3_errmsg(_log_db));
+  if (_progress != nullptr)
+    _progress->Add(static_cast<size_t>(n_rows % kProgressRows));
+
+  Exec(db, "CREATE INDEX records_index_source_time ON records_index (source, time);");
+  Exec(db, "CREATE INDEX records_index_time ON records_index (time);");
+  Exec(db, "INSERT INTO meta VALUES ('stamp', '" + stamp + "');");
+  Exec(db, "COMMIT;");
+  sqlite3_finalize(build.select);
+  sqlite3_finalize(build.insert);
+  build.select = build.insert = nullptr;
+  if (sqlite3_close(db) != SQLITE_OK)
+    throw std::runtime_error(sqlite3_errmsg(db));
+  build.db = nullptr;
+  if (std::rename(build.tmp_path.c_str(), path.c_str()) != 0)
+    throw std::runtime_error("Cannot move " + build.tmp_path + " to " + path);
+  build.done = true;
+  if (!OpenSidecar(stamp))
+    throw std::runtime_error("Cannot open " + path);
+}
+
+std::vector<int64_t> RecordsIndex::MatchingRowids(const RecordFilter& filter) {
+  std::string query = "SELECT rowid FROM " + _table + " WHERE 1";
+  if (filter.has_time_range)
+    query += " AND " + RecordsReader::Quote(_time_column) + " BETWEEN ?1 AND ?2";
+  if (!filter.sources.empty()) {
+    query += " AND " + RecordsReader::Quote(_source_column) + " IN (";
+    for (size_t i = 0; i < filter.sources.size(); ++i)
+      query += (i == 0 ? "?" : ", ?") + std::to_string(i + 3);
+    query += ")";
+  }
+  query += " ORDER BY rowid;";
+
+  sqlite3_stmt* stmt;
+  if (sqlite3_prepare_v2(_index_db, query.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+    throw std::runtime_error("Cannot prepare \"" + query + "\": " + sqlite3_errmsg(_index_db));
+  if (filter.has_time_range) {
+    sqlite3_bind_int64(stmt, 1, filter.begin_time);
+    sqlite3_bind_int64(stmt, 2, filter.end_time);
+  }
+  for (size_t i = 0; i < filter.sources.size(); ++i)
+    sqlite3_bind_text(stmt, static_cast<int>(i + 3), filter.sources[i].c_str(), -1, SQLITE_TRANSIENT);
+  std::vector<int64_t> rowids;
+  while (sqlite3_step(stmt) == SQLITE_ROW)
+    rowids.push_back(sqlite3_column_int64(stmt, 0));
+  sqlite3_finalize(stmt);
+  return rowids;
+}
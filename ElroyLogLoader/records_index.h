@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <sqlite3.h>
+
+#include "Common/record_filter.h"
+
+class LoadProgress;
+
+// @brief Finds the rows of records that match a RecordFilter from the time and from_ip columns only,
+// without touching the blobs.
+//
+// If the log already has an index on its time column, the log is queried directly. Otherwise a
+// sidecar database "<log>.idx" holding (rowid, time, from_ip) with indices on (from_ip, time) and
+// (time) is built next to the log the first time it is needed, and rebuilt when the log changes.
+// The log itself is never written to. Throws std::runtime_error if the log can't be read.
+class RecordsIndex
+{
+public:
+  // @brief A sidecar build counts the rows it indexed in progress, if given, and calls idle every
+  // kProgressRows rows, e.g. to run a LoadProgressDialog. Once progress is cancelled the build is
+  // dropped and the log is queried directly.
+  explicit RecordsIndex(const std::string& log_path, LoadProgress* progress = nullptr,
+                        const std::function<void()>& idle = {});
+  ~RecordsIndex();
+
+  RecordsIndex(const RecordsIndex&) = delete;
+  RecordsIndex& operator=(const RecordsIndex&) = delete;
+
+  // @brief Why the sidecar couldn't be built, e.g. the log is in a read-only directory, or empty if it
+  // wasn't needed or was built. Without it MatchingRowids scans the log.
+  const std::string& BuildError() const { return _build_error; }
+
+  // @brief Rowids of the rows matching filter, in increasing order
+  std::vector<int64_t> MatchingRowids(const RecordFilter& filter);
+
+  static std::string SidecarPath(const std::string& log_path) { return log_path + ".idx"; }
+
+private:
+  // Rows indexed between progress updates
+  static constexpr int64_t kProgressRows = 4096;
+
+  // @brief True if the log has an index whose first column is the time column
+  bool LogHasTimeIndex() const;
+  // @brief Open the sidecar if it was built from the current version of the log
+  bool OpenSidecar(const std::string& stamp);
+  // @brief Build the sidecar and open it. Throws if the build fails or is cancelled, leaving neither
+  // the sidecar nor its temporary file behind.
+  void BuildSidecar(const std::string& stamp);
+  // @brief Identifies the version of the log the sidecar was built from
+  std::string LogStamp() const;
+  void CloseIndexDb();
+
+  std::string _log_path;
+  sqlite3* _log_db = nullptr;
+  // Connection and names used by MatchingRowids: the log itself or the sidecar
+  sqlite3* _index_db = nullptr;
+  std::string _table;
+  std::string _time_column;
+  std::string _source_column;
+  LoadProgress* _progress;
+  std::function<void()> _idle;
+  std::string _build_error;
+};
@@ -0,0 +1,138 @@
+#include "records_reader.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+RecordsReader::RecordsReader(const std::string& path) : _path(path) {
+  // NOMUTEX: a connection is only ever used by the thread that owns the reader
+  if (sqlite3_open_v2(path.c_str(), &_db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, nullptr) != SQLITE_OK)
+    Throw("Cannot open database");
+  // Read pages through a memory map instead of copying them into sqlite's page cache
+  const std::string mmap_pragma = "PRAGMA mmap_size = " + std::to_string(kMmapSize) + ";";
+  sqlite3_exec(_db, mmap_pragma.c_str(), nullptr, nullptr, nullptr);
+
+  // Only select the columns that are decoded, instead of materializing from_ip, git_sha etc. per row
+  const std::string columns = Quote(ColumnName(_db, kDataColumn)) + ", " + Quote(ColumnName(_db, kLengthColumn));
+  Prepare("SELECT " + columns + " FROM records WHERE rowid BETWEEN ?1 AND ?2;", &_range_stmt);
+  Prepare("SELECT " + columns + " FROM records WHERE rowid = ?1;", &_row_stmt);
+}
+
+RecordsReader::~RecordsReader() {
+  sqlite3_finalize(_range_stmt);
+  sqlite3_finalize(_row_stmt);
+  sqlite3_close(_db);
+}
+
+void RecordsReader::Prepare(const std::string& query, sqlite3_stmt** stmt) {
+  if (sqlite3_prepare_v2(_db, query.c_str(), -1, stmt, nullptr) != SQLITE_OK)
+    Throw("Cannot prepare query");
+}
+
+void RecordsReader::Throw(const std::string& what) const {
+  throw std::runtime_error(what + " (" + _path + "): " + sqlite3_errmsg(_db));
+}
+
+std::string RecordsReader::ColumnName(sqlite3* db, int index) {
+  sqlite3_stmt* stmt;
+  if (sqlite3_prepare_v2(db, "PRAGMA table_info(records);", -1, &stmt, nullptr) != SQLITE_OK)
+    throw std::runtime_error(std::string("Cannot read the columns of records: ") + sqlite3_errmsg(db));
+  std::string name;
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    if (sqlite3_column_int(stmt, 0) == index) {
+      name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+      break;
+    }
+  }
+  sqlite3_finalize(stmt);
+  if (name.empty())
+    throw std::runtime_error("No column " + std::to_string(index) + " in records");
+  return name;
+}
+
+std::string RecordsReader::Quote(const std::string& name) {
+  std::string quoted = "\"";
+  for (char c : name) {
+    if (c == '"')
+      quoted += '"';
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+int64_t RecordsReader::Count() {
+  sqlite3_stmt* stmt;
+  Prepare("SELECT COUNT(*) FROM records;", &stmt);
+  if (sqlite3_step(stmt) != SQLITE_ROW) {
+    sqlite3_finalize(stmt);
+    Throw("Error executing query");
+  }
+  const int64_t count = sqlite3_column_int64(stmt, 0);
+  sqlite3_finalize(stmt);
+  return count;
+}
+
+bool RecordsReader::RowidRange(int64_t& first, int64_t& last) {
+  sqlite3_stmt* stmt;
+  Prepare("SELECT MIN(rowid), MAX(rowid) FROM records;", &stmt);
+  if (sqlite3_step(stmt) != SQLITE_ROW) {
+    sqlite3_finalize(stmt);
+    Throw("Error executing query");
+  }
+  const bool empty = sqlite3_column_type(stmt, 0) == SQLITE_NULL;
+  first = sqlite3_column_int64(stmt, 0);
+  last = sqlite3_column_int64(stmt, 1);
+  sqlite3_finalize(stmt);
+  return !empty;
+}
+
+bool RecordsReader::TimeRange(int64_t& first, int64_t& last) {
+  const std::string time = Quote(ColumnName(_db, kTimeColumn));
+  sqlite3_stmt* stmt;
+  Prepare("SELECT (SELECT " + time + " FROM records ORDER BY rowid ASC LIMIT 1), (SELECT " + time +
+          " FROM records ORDER BY rowid DESC LIMIT 1);", &stmt);
+  if (sqlite3_step(stmt) != SQLITE_ROW) {
+    sqlite3_finalize(stmt);
+    Throw("Error executing query");
+  }
+  const bool empty = sqlite3_column_type(stmt, 0) == SQLITE_NULL;
+  first = sqlite3_column_int64(stmt, 0);
+  last = sqlite3_column_int64(stmt, 1);
+  sqlite3_finalize(stmt);
+  return !empty;
+}
+
+void RecordsReader::EmitBlob(sqlite3_stmt* stmt, const BlobCallback& fn) {
+  // The length column holds the length of the message; never read past the end of the blob
+  const uint8_t* blob = static_cast<const uint8_t*>(sqlite3_column_blob(stmt, 0));
+  const size_t blob_len = static_cast<size_t>(sqlite3_column_bytes(stmt, 0));
+  const size_t byte_array_len = std::min(static_cast<size_t>(sqlite3_column_int(stmt, 1)), blob_len);
+  fn(blob, byte_array_len);
+}
+
+void RecordsReader::ReadRange(int64_t first, int64_t last, const BlobCallback& fn) {
+  sqlite3_reset(_range_stmt);
+  sqlite3_bind_int64(_range_stmt, 1, first);
+  sqlite3_bind_int64(_range_stmt, 2, last);
+  int rc;
+  while ((rc = sqlite3_step(_range_stmt)) == SQLITE_ROW)
+    EmitBlob(_range_stmt, fn);
+  sqlite3_reset(_range_stmt);
+  if (rc != SQLITE_DONE)
+    Throw("Error reading records");
+}
+
+void RecordsReader::ReadRows(const int64_t* rowids, size_t n, const BlobCallback& fn) {
+  // One b-tree lookup per row, which beats scanning a range when the matching rows are interleaved
+  // with the traffic of other sources
+  for (size_t i = 0; i < n; ++i) {
+    sqlite3_reset(_row_stmt);
+    sqlite3_bind_int64(_row_stmt, 1, rowids[i]);
+    const int rc = sqlite3_step(_row_stmt);
+    if (rc == SQLITE_ROW)
+      EmitBlob(_row_stmt, fn);
+    else if (rc != SQLITE_DONE)
+      Throw("Error reading records");
+  }
+  // Release the read transaction, so the log can be appended to while it is open
+  sqlite3_reset(_row_stmt);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include <sqlite3.h>
+
+// @brief Read-only connection to the records table of an elroy_log, reading blobs by rowid range.
+//
+// Every thread needs its own RecordsReader. The connections don't share anything, so scans of
+// disjoint rowid ranges run in parallel instead of queueing behind one sqlite3_step loop. Only the
+// blob and length columns are selected, and the database is read through sqlite's mmap I/O, so a
+// blob handed out by ReadRange points straight into the mapped file. Throws std::runtime_error if
+// the database can't be opened or queried.
+class RecordsReader
+{
+public:
+  // @brief Called with the blob of each row. data is only valid for the duration of the call.
+  using BlobCallback = std::function<void(const uint8_t* data, size_t size)>;
+
+  // Position of the columns used by the loader in "SELECT * FROM records"
+  static constexpr int kTimeColumn = 0;
+  static constexpr int kDataColumn = 1;
+  static constexpr int kLengthColumn = 3;
+  static constexpr int kSourceColumn = 5;
+
+  explicit RecordsReader(const std::string& path);
+  ~RecordsReader();
+
+  RecordsReader(const RecordsReader&) = delete;
+  RecordsReader& operator=(const RecordsReader&) = delete;
+
+  int64_t Count();
+  // @brief Smallest and largest rowid in records. Returns false if the table is empty.
+  bool RowidRange(int64_t& first, int64_t& last);
+  // @brief Time column of the first and last row. Returns false if the table is empty.
+  bool TimeRange(int64_t& first, int64_t& last);
+
+  // @brief Call fn with the blob of every row with first <= rowid <= last, in rowid order
+  void ReadRange(int64_t first, int64_t last, const BlobCallback& fn);
+  // @brief Call fn with the blob of each of the n rows in rowids, in that order
+  void ReadRows(const int64_t* rowids, size_t n, const BlobCallback& fn);
+
+  // @brief Name of the column at index of records, from PRAGMA table_info. Throws if there is none.
+  static std::string ColumnName(sqlite3* db, int index);
+  // @brief Quote an identifier for use in a query
+  static std::string Quote(const std::string& name);
+
+private:
+  // Upper bound of sqlite's memory map; sqlite clamps it to SQLITE_MAX_MMAP_SIZE
+  static constexpr int64_t kMmapSize = int64_t(1) << 40;
+
+  void Prepare(const std::string& query, sqlite3_stmt** stmt);
+  // @brief Pass the blob of the row stmt is on to fn
+  static void EmitBlob(sqlite3_stmt* stmt, const BlobCallback& fn);
+  [[noreturn]] void Throw(const std::string& what) const;
+
+  std::string _path;
+  sqlite3* _db = nullptr;
+  sqlite3_stmt* _range_stmt = nullptr;
+  sqlite3_stmt* _row_stmt = nullptr;
+};
@@ -0,0 +1,175 @@
+#include "log_follower.h"
+
+#include <QFileDialog>
+#include <QFileInfo>
+#include <QSettings>
+
+#include <algorithm>
+#include <iostream>
+
+#include "Common/series_store.h"
+#include "PcapLoader/mmap_pcap_reader.h"
+#include "PcapLoader/pcap_loader.h"
+
+LogFollower::LogFollower() = default;
+
+LogFollower::~LogFollower() {
+  shutdown();
+}
+
+bool LogFollower::start(QStringList*){
+  QSettings settings;
+  const QString directory = settings.value("LogFollower/directory", "").toString();
+  const QString path = QFileDialog::getOpenFileName(nullptr, "Follow a recording", directory,
+                                                    "Recordings (*.elroy_log *.pcap)");
+  if (path.isEmpty())
+    return false;
+  settings.setValue("LogFollower/directory", QFileInfo(path).absolutePath());
+  Start(path.toStdString());
+  return true;
+}
+
+void LogFollower::Start(const std::string& path){
+  shutdown();
+  _path = path;
+  _is_pcap = QFileInfo(QString::fromStdString(path)).suffix() == "pcap";
+  _pcap_offset = MmapPcapReader::kGlobalHeaderSize;
+  _last_rowid = 0;
+  _field_table = std::make_unique<FieldTable>();
+  _pipeline = std::make_unique<DecodePipeline>(*_field_table);
+  _readers.clear();
+  _readers.resize(_pipeline->NumWorkers());
+  _n_records = 0;
+  {
+    std::lock_guard<std::mutex> lock(_error_mutex);
+    _last_error.clear();
+  }
+  _running = true;
+  _thread = std::thread(&LogFollower::FollowLoop, this);
+}
+
+void LogFollower::shutdown(){
+  {
+    std::lock_guard<std::mutex> lock(_wake_mutex);
+    _running = false;
+  }
+  _wake.notify_all();
+  if (_thread.joinable())
+    _thread.join();
+  _readers.clear();
+}
+
+void LogFollower::FollowLoop(){
+  while (_running){
+    // The recorder may be in the middle of rotating or creating the file, so a failed poll is only
+    // noted and tried again next time
+    std::string error;
+    try {
+      _n_records += Poll();
+    } catch (const std::exception& e) {
+      error = e.what();
+    }
+    {
+      std::lock_guard<std::mutex> lock(_error_mutex);
+      _last_error = error;
+    }
+    std::unique_lock<std::mutex> lock(_wake_mutex);
+    _wake.wait_for(lock, std::chrono::milliseconds(kPollIntervalMs), [this]() { return !_running; });
+  }
+}
+
+std::string LogFollower::LastError() const {
+  std::lock_guard<std::mutex> lock(_error_mutex);
+  return _last_error;
+}
+
+size_t LogFollower::Poll(){
+  return _is_pcap ? PollPcap() : PollElroyLog();
+}
+
+void LogFollower::Write(DecodedBatch& batch){
+  {
+    std::lock_guard<std::mutex> lock(mutex());
+    batch.store.TransferTo(*_field_table, dataMap());
+  }
+  emit dataReceived();
+}
+
+size_t LogFollower::PollPcap(){
+  // Map the file as it is now; GetNextPacket stops before a record that is still being written
+  MmapPcapReader reader(_path);
+  if (!reader.Open())
+    return 0;
+  // A capture that shrank was truncated or replaced, read it again from the start
+  if (reader.FileSize() < _pcap_offset)
+    _pcap_offset = MmapPcapReader::kGlobalHeaderSize;
+  if (reader.FileSize() == _pcap_offset || !reader.Seek(_pcap_offset))
+    return 0;
+
+  size_t n_records = 0;
+  _pipeline->Run(
+    [&reader](RawBatch& batch){
+      PcapPacketView packet;
+      const uint8_t* payload;
+      size_t payload_len;
+      while (batch.Size() < kPacketBatchSize){
+        if (!reader.GetNextPacket(packet))
+          return false;
+        if (PcapLoader::UdpPayload(packet, payload, payload_len))
+          batch.AddView(payload, payload_len, packet.capture_ts);
+      }
+      return true;
+    },
+    [this, &n_records](DecodedBatch& batch){
+      n_records += batch.n_records;
+      Write(batch);
+    });
+  _pcap_offset = reader.Tell();
+  return n_records;
+}
+
+size_t LogFollower::PollElroyLog(){
+  if (!_readers[0])
+    _readers[0] = std::make_unique<RecordsReader>(_path);
+  int64_t first_rowid, last_rowid;
+  if (!_readers[0]->RowidRange(first_rowid, last_rowid) || last_rowid <= _last_rowid)
+    return 0;
+  // Only the rows after the last one read. Rows are appended with increasing rowids.
+  first_rowid = std::max(first_rowid, _last_rowid + 1);
+
+  size_t n_records = 0;
+  const size_t n_partitions = static_cast<size_t>((last_rowid - first_rowid) / kRowBatchSize + 1);
+  _pipeline->RunPartitioned(n_partitions,
+    [this, first_rowid, last_rowid](size_t worker, size_t partition, const DecodePipeline::RecordCallback& decode){
+      if (!_readers[worker])
+        _readers[worker] = std::make_unique<RecordsReader>(_path);
+      const int64_t begin = first_rowid + static_cast<int64_t>(partition * kRowBatchSize);
+      const int64_t end = std::min<int64_t>(begin + kRowBatchSize - 1, last_rowid);
+      _readers[worker]->ReadRange(begin, end, [&decode](const uint8_t* data, size_t size){
+        decode(data, size, 0);
+      });
+    },
+    [this, &n_records](DecodedBatch& batch){
+      n_records += batch.n_records;
+      Write(batch);
+    });
+  _last_rowid = last_rowid;
+  return n_records;
+}
+
+// Example program: run ~/build/LogFollowerExec with a recording that is being written, e.g. by
+// ecm_generator, to follow it for 30 s
+int main(int argc, char** argv)
+{
+  if (argc < 2) {
+    std::cout << "usage: LogFollowerExec <recording>" << std::endl;
+    return 1;
+  }
+  LogFollower follower;
+  follower.Start(argv[1]);
+  std::this_thread::sleep_for(std::chrono::seconds(30));
+  follower.shutdown();
+  std::cout << "Appended " << follower.NumRecords() << " records" << std::endl;
+  if (!follower.LastError().empty())
+    std::cout << "Last poll failed: " << follower.LastError() << std::endl;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <QObject>
+#include <QtPlugin>
+#include "PlotJuggler/datastreamer_base.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Common/decode_pipeline.h"
+#include "Common/field_table.h"
+#include "ElroyLogLoader/records_reader.h"
+
+using namespace PJ;
+
+// @brief Follows an .elroy_log or a classic .pcap that is still being recorded, like `tail -f`.
+//
+// The file is loaded once, then polled every kPollIntervalMs. Each poll decodes only what was
+// appended since the previous one (the rows after the last rowid read, or the records after the last
+// complete pcap record) through a DecodePipeline and appends it to the existing series, so the cost
+// of a refresh is proportional to the new data. This is a DataStreamer rather than a DataLoader
+// because plotjuggler only lets streamers append to series after the initial load.
+class LogFollower : public DataStreamer
+{
+  Q_OBJECT
+  Q_PLUGIN_METADATA(IID "facontidavide.PlotJuggler3.DataStreamer")
+  Q_INTERFACES(PJ::DataStreamer)
+
+public:
+  LogFollower();
+  ~LogFollower() override;
+
+  // @brief this is the entry point that plotjuggler will call. Asks for the file to follow.
+  bool start(QStringList* pre_selected_sources) override;
+  void shutdown() override;
+  bool isRunning() const override { return _running; }
+
+  virtual const char* name() const override
+  {
+    return "Elroy log follower";
+  };
+
+  // @brief Start following path without asking
+  void Start(const std::string& path);
+
+  // @brief Decode whatever was appended since the last poll. Returns the number of new records.
+  size_t Poll();
+
+  // @brief Records appended to the series since Start
+  size_t NumRecords() const { return _n_records; }
+  // @brief Why the last poll failed, e.g. the recorder was rotating the file, or empty if it didn't.
+  // The next poll tries again.
+  std::string LastError() const;
+
+private:
+  static constexpr int kPollIntervalMs = 1000;
+  static constexpr size_t kRowBatchSize = 512;
+  static constexpr size_t kPacketBatchSize = 256;
+
+  void FollowLoop();
+  size_t PollPcap();
+  size_t PollElroyLog();
+  // @brief Append a decoded batch to the series, under the streamer's mutex
+  void Write(DecodedBatch& batch);
+
+  std::string _path;
+  bool _is_pcap = false;
+  // Offset of the first pcap record not read yet
+  uint64_t _pcap_offset = 0;
+  // Last rowid of the records table read so far
+  int64_t _last_rowid = 0;
+
+  // Fields aren't bound to dataMap(), whose series must only be touched under mutex()
+  std::unique_ptr<FieldTable> _field_table;
+  std::unique_ptr<DecodePipeline> _pipeline;
+  // One connection per decode worker, kept between polls
+  std::vector<std::unique_ptr<RecordsReader>> _readers;
+
+  std::atomic<size_t> _n_records{0};
+  mutable std::mutex _error_mutex;
+  std::string _last_error;
+
+  std::thread _thread;
+  std::atomic<bool> _running{false};
+  std::mutex _wake_mutex;
+  std::condition_variable _wake;
+};
@@ -0,0 +1,231 @@
+#include "byte_stream.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <zlib.h>
+#include <zstd.h>
+
+#include "Common/thread_pool.h"
+
+namespace {
+constexpr uint8_t kGzipMagic[] = {0x1f, 0x8b};
+constexpr uint8_t kZstdMagic[] = {0x28, 0xb5, 0x2f, 0xfd};
+
+[[noreturn]] void ThrowErrno(const std::string& what, const std::string& path) {
+  throw std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+}
+}  // namespace
+
+std::unique_ptr<ByteStream> ByteStream::Open(const std::string& path) {
+  uint8_t magic[4] = {};
+  {
+    FileByteStream file(path);
+    size_t n = 0;
+    while (n < sizeof(magic)) {
+      const size_t read = file.Read(magic + n, sizeof(magic) - n);
+      if (read == 0)
+        break;
+      n += read;
+    }
+  }
+  if (std::memcmp(magic, kZstdMagic, sizeof(kZstdMagic)) == 0)
+    return std::make_unique<ZstdByteStream>(path);
+  if (std::memcmp(magic, kGzipMagic, sizeof(kGzipMagic)) == 0)
+    return std::make_unique<GzipByteStream>(path);
+  return std::make_unique<FileByteStream>(path);
+}
+
+bool ByteStream::HasCompressedExtension(const std::string& path) {
+  const auto ends_with = [&path](const std::string& suffix) {
+    return path.size() >= suffix.size() && path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0;
+  };
+  return ends_with(".gz") || ends_with(".zst");
+}
+
+FileByteStream::FileByteStream(const std::string& path) : _path(path) {
+  _fd = ::open(path.c_str(), O_RDONLY);
+  if (_fd < 0)
+    ThrowErrno("Could not open", path);
+  posix_fadvise(_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+FileByteStream::~FileByteStream() {
+  if (_fd >= 0)
+    ::close(_fd);
+}
+
+size_t FileByteStream::Read(uint8_t* buf, size_t size) {
+  while (true) {
+    const ssize_t n = ::read(_fd, buf, size);
+    if (n >= 0)
+      return static_cast<size_t>(n);
+    if (errno != EINTR)
+      ThrowErrno("Could not read", _path);
+  }
+}
+
+GzipByteStream::GzipByteStream(const std::string& path) {
+  gzFile file = gzopen(path.c_str(), "rb");
+  if (file == nullptr)
+    ThrowErrno("Could not open", path);
+  // A larger buffer means fewer, larger reads of the compressed file
+  gzbuffer(file, 1 << 20);
+  _file = file;
+}
+
+GzipByteStream::~GzipByteStream() {
+  gzclose(static_cast<gzFile>(_file));
+}
+
+size_t GzipByteStream::Read(uint8_t* buf, size_t size) {
+  gzFile file = static_cast<gzFile>(_file);
+  const unsigned int chunk = static_cast<unsigned int>(std::min<size_t>(size, 1u << 30));
+  const int n = gzread(file, buf, chunk);
+  if (n < 0) {
+    int error;
+    throw std::runtime_error(std::string("Could not inflate capture: ") + gzerror(file, &error));
+  }
+  return static_cast<size_t>(n);
+}
+
+ZstdByteStream::ZstdByteStream(const std::string& path) {
+  try {
+    Open(path);
+  } catch (...) {
+    Close();
+    throw;
+  }
+}
+
+ZstdByteStream::~ZstdByteStream() {
+  Close();
+}
+
+void ZstdByteStream::Open(const std::string& path) {
+  _fd = ::open(path.c_str(), O_RDONLY);
+  if (_fd < 0)
+    ThrowErrno("Could not open", path);
+  struct stat st;
+  if (fstat(_fd, &st) != 0)
+    ThrowErrno("Could not stat", path);
+  _size = static_cast<uint64_t>(st.st_size);
+  if (_size > 0) {
+    void* addr = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _fd, 0);
+    if (addr == MAP_FAILED)
+      ThrowErrno("Could not map", path);
+    _base = static_cast<const uint8_t*>(addr);
+    madvise(addr, _size, MADV_SEQUENTIAL);
+  }
+
+  // Find the frames. Only their headers and block headers are read, not the compressed data.
+  for (uint64_t offset = 0; offset < _size;) {
+    const size_t frame_size = ZSTD_findFrameCompressedSize(_base + offset, _size - offset);
+    if (ZSTD_isError(frame_size))
+      throw std::runtime_error("Corrupt zstd capture " + path + ": " + ZSTD_getErrorName(frame_size));
+    _frames.push_back({offset, frame_size});
+    offset += frame_size;
+  }
+
+  if (_frames.size() > 1) {
+    // Enough frames in flight to keep every pool thread busy, without inflating the whole file ahead
+    _look_ahead = ThreadPool::Instance().NumThreads() + 1;
+  } else {
+    _dstream = ZSTD_createDStream();
+    ZSTD_initDStream(static_cast<ZSTD_DStream*>(_dstream));
+    _last_ret = _size > 0 ? 1 : 0;
+  }
+}
+
+void ZstdByteStream::Close() {
+  // The frames still being inflated read from the mapping
+  for (auto& frame : _pending)
+    frame.wait();
+  _pending.clear();
+  if (_dstream != nullptr) {
+    ZSTD_freeDStream(static_cast<ZSTD_DStream*>(_dstream));
+    _dstream = nullptr;
+  }
+  if (_base != nullptr) {
+    munmap(const_cast<uint8_t*>(_base), _size);
+    _base = nullptr;
+  }
+  if (_fd >= 0) {
+    ::close(_fd);
+    _fd = -1;
+  }
+}
+
+std::vector<uint8_t> ZstdByteStream::DecompressFrame(const uint8_t* data, size_t size) {
+  std::vector<uint8_t> out;
+  const unsigned long long content_size = ZSTD_getFrameContentSize(data, size);
+  if (content_size != ZSTD_CONTENTSIZE_UNKNOWN && content_size != ZSTD_CONTENTSIZE_ERROR)
+    out.reserve(content_size);
+
+  ZSTD_DCtx* dctx = ZSTD_createDCtx();
+  std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx*)> guard(dctx, ZSTD_freeDCtx);
+  ZSTD_inBuffer input{data, size, 0};
+  std::vector<uint8_t> chunk(ZSTD_DStreamOutSize());
+  while (input.pos < input.size) {
+    ZSTD_outBuffer output{chunk.data(), chunk.size(), 0};
+    const size_t ret = ZSTD_decompressStream(dctx, &output, &input);
+    if (ZSTD_isError(ret))
+      throw std::runtime_error(std::string("Could not inflate capture: ") + ZSTD_getErrorName(ret));
+    out.insert(out.end(), chunk.data(), chunk.data() + output.pos);
+    if (ret == 0 && output.pos < output.size)
+      break;
+  }
+  return out;
+}
+
+void ZstdByteStream::ScheduleFrames() {
+  while (_pending.size() < _look_ahead && _next_frame < _frames.size()) {
+    const Frame frame = _frames[_next_frame++];
+    auto task = std::make_shared<std::packaged_task<std::vector<uint8_t>()>>(
+      [data = _base + frame.offset, size = frame.size]() { return DecompressFrame(data, size); });
+    _pending.push_back(task->get_future());
+    ThreadPool::Instance().Submit([task]() { (*task)(); });
+  }
+}
+
+size_t ZstdByteStream::ReadStreaming(uint8_t* buf, size_t size) {
+  auto* dstream = static_cast<ZSTD_DStream*>(_dstream);
+  ZSTD_outBuffer output{buf, size, 0};
+  // Once the whole input is consumed the DStream may still hold decoded output, so it is called with an
+  // empty input until it reports the frame as flushed
+  while (output.pos == 0 && (_input_pos < _size || _last_ret != 0)) {
+    ZSTD_inBuffer input{_base + _input_pos, _size - _input_pos, 0};
+    const size_t ret = ZSTD_decompressStream(dstream, &output, &input);
+    if (ZSTD_isError(ret))
+      throw std::runtime_error(std::string("Could not inflate capture: ") + ZSTD_getErrorName(ret));
+    _input_pos += input.pos;
+    _last_ret = ret;
+    if (output.pos == 0 && input.pos == 0 && _input_pos == _size && ret != 0)
+      throw std::runtime_error("Could not inflate capture: the zstd frame is truncated");
+  }
+  return output.pos;
+}
+
+size_t ZstdByteStream::Read(uint8_t* buf, size_t size) {
+  if (_dstream != nullptr)
+    return ReadStreaming(buf, size);
+  while (_current_pos == _current.size()) {
+    ScheduleFrames();
+    if (_pending.empty())
+      return 0;
+    _current = _pending.front().get();
+    _pending.pop_front();
+    _current_pos = 0;
+  }
+  const size_t n = std::min(size, _current.size() - _current_pos);
+  std::memcpy(buf, _current.data() + _current_pos, n);
+  _current_pos += n;
+  ScheduleFrames();
+  return n;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+// @brief Sequential source of the bytes of a capture, decompressing it on the fly if needed, so a
+// compressed capture never has to be written out to a temporary file. Throws std::runtime_error on
+// I/O or decompression errors.
+class ByteStream
+{
+public:
+  virtual ~ByteStream() = default;
+
+  // @brief Read up to size bytes into buf. Returns the number of bytes read, 0 at the end of the stream.
+  virtual size_t Read(uint8_t* buf, size_t size) = 0;
+
+  // @brief Open path, picking the decompressor from the first bytes of the file: gzip, zstd or none
+  static std::unique_ptr<ByteStream> Open(const std::string& path);
+  // @brief Whether path is named like a compressed file, i.e. ends in .gz or .zst
+  static bool HasCompressedExtension(const std::string& path);
+};
+
+// @brief Uncompressed file
+class FileByteStream : public ByteStream
+{
+public:
+  explicit FileByteStream(const std::string& path);
+  ~FileByteStream() override;
+
+  size_t Read(uint8_t* buf, size_t size) override;
+
+private:
+  std::string _path;
+  int _fd = -1;
+};
+
+// @brief gzip file, possibly made of several members. gzip can only be inflated serially.
+class GzipByteStream : public ByteStream
+{
+public:
+  explicit GzipByteStream(const std::string& path);
+  ~GzipByteStream() override;
+
+  size_t Read(uint8_t* buf, size_t size) override;
+
+private:
+  // gzFile, kept opaque so zlib.h stays out of this header
+  void* _file = nullptr;
+};
+
+// @brief zstd file. A file made of several frames (zstdmt or pzstd output, or concatenated .zst files)
+// is inflated frame by frame on the shared ThreadPool, a few frames ahead of the reader; a single frame
+// is streamed on the calling thread.
+class ZstdByteStream : public ByteStream
+{
+public:
+  explicit ZstdByteStream(const std::string& path);
+  ~ZstdByteStream() override;
+
+  size_t Read(uint8_t* buf, size_t size) override;
+
+private:
+  struct Frame {
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  void Open(const std::string& path);
+  void Close();
+  // @brief Inflate one whole frame
+  static std::vector<uint8_t> DecompressFrame(const uint8_t* data, size_t size);
+  // @brief Queue frames until the look-ahead is full
+  void ScheduleFrames();
+  size_t ReadStreaming(uint8_t* buf, size_t size);
+
+  int _fd = -1;
+  const uint8_t* _base = nullptr;
+  uint64_t _size = 0;
+  std::vector<Frame> _frames;
+
+  // Multi-frame files: frames being inflated, in file order, and the one being read
+  size_t _next_frame = 0;
+  size_t _look_ahead = 1;
+  std::deque<std::future<std::vector<uint8_t>>> _pending;
+  std::vector<uint8_t> _current;
+  size_t _current_pos = 0;
+
+  // Single-frame files: ZSTD_DStream, kept opaque so zstd.h stays out of this header
+  void* _dstream = nullptr;
+  uint64_t _input_pos = 0;
+  // Last return of ZSTD_decompressStream: 0 once the frame is decoded and flushed
+  size_t _last_ret = 0;
+};
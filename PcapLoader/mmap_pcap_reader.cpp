@@ -0,0 +1,134 @@
+#include "mmap_pcap_reader.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+constexpr uint32_t kMagicMicro = 0xa1b2c3d4;
+constexpr uint32_t kMagicNano = 0xa1b23c4d;
+
+uint32_t ByteSwap32(uint32_t v) {
+  return ((v & 0xff) << 24) | ((v & 0xff00) << 8) | ((v >> 8) & 0xff00) | (v >> 24);
+}
+}  // namespace
+
+MmapPcapReader::MmapPcapReader(const std::string& path) : _path(path) {}
+
+MmapPcapReader::~MmapPcapReader() {
+  Close();
+}
+
+bool MmapPcapReader::Open(Access access) {
+  Close();
+  _fd = ::open(_path.c_str(), O_RDONLY);
+  if (_fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(_fd, &st) != 0 || static_cast<uint64_t>(st.st_size) < kGlobalHeaderSize) {
+    Close();
+    return false;
+  }
+  _size = static_cast<uint64_t>(st.st_size);
+  void* addr = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _fd, 0);
+  if (addr == MAP_FAILED) {
+    Close();
+    return false;
+  }
+  _base = static_cast<const uint8_t*>(addr);
+  // A single pass front to back gets aggressive read-ahead and drops the pages behind it. Workers reading
+  // ranges at once, or an index skipping around, would have pages dropped before the others reach them
+  // and read ahead into records that aren't wanted, so those keep the default read-ahead.
+  madvise(addr, _size, access == Access::Sequential ? MADV_SEQUENTIAL : MADV_NORMAL);
+
+  uint32_t magic;
+  std::memcpy(&magic, _base, sizeof(magic));
+  if (magic == kMagicMicro || magic == kMagicNano) {
+    _swapped = false;
+  } else if (ByteSwap32(magic) == kMagicMicro || ByteSwap32(magic) == kMagicNano) {
+    _swapped = true;
+    magic = ByteSwap32(magic);
+  } else {
+    Close();
+    return false;
+  }
+  _nanosecond = magic == kMagicNano;
+  _link_type = ReadU32(_base + 20);
+  _pos = kGlobalHeaderSize;
+  return true;
+}
+
+void MmapPcapReader::Close() {
+  if (_base != nullptr) {
+    munmap(const_cast<uint8_t*>(_base), _size);
+    _base = nullptr;
+  }
+  if (_fd >= 0) {
+    ::close(_fd);
+    _fd = -1;
+  }
+  _size = 0;
+  _pos = 0;
+}
+
+uint32_t MmapPcapReader::ReadU32(const uint8_t* p) const {
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return _swapped ? ByteSwap32(v) : v;
+}
+
+bool MmapPcapReader::GetNextPacket(PcapPacketView& packet) {
+  if (!PacketAt(_pos, packet))
+    return false;
+  _pos = NextOffset(packet);
+  return true;
+}
+
+bool MmapPcapReader::PacketAt(uint64_t offset, PcapPacketView& packet) const {
+  if (_base == nullptr || offset + kRecordHeaderSize > _size)
+    return false;
+  const uint8_t* header = _base + offset;
+  const uint32_t ts_sec = ReadU32(header);
+  const uint32_t ts_frac = ReadU32(header + 4);
+  const uint32_t captured_len = ReadU32(header + 8);
+  if (offset + kRecordHeaderSize + captured_len > _size)
+    return false;
+
+  packet.data = header + kRecordHeaderSize;
+  packet.captured_len = captured_len;
+  packet.original_len = ReadU32(header + 12);
+  packet.capture_ts = ts_sec + ts_frac * (_nanosecond ? 1e-9 : 1e-6);
+  packet.offset = offset;
+  packet.link_type = _link_type;
+  return true;
+}
+
+std::vector<uint64_t> MmapPcapReader::RecordBoundaries(size_t stride) const {
+  std::vector<uint64_t> boundaries;
+  if (_base == nullptr)
+    return boundaries;
+  if (stride == 0)
+    stride = 1;
+  // Only the captured length of each header is needed to find the next one
+  uint64_t offset = kGlobalHeaderSize;
+  size_t n_records = 0;
+  while (offset + kRecordHeaderSize <= _size) {
+    const uint64_t next = offset + kRecordHeaderSize + ReadU32(_base + offset + 8);
+    if (next > _size)
+      break;
+    if (n_records++ % stride == 0)
+      boundaries.push_back(offset);
+    offset = next;
+  }
+  boundaries.push_back(offset);
+  return boundaries;
+}
+
+bool MmapPcapReader::Seek(uint64_t offset) {
+  if (_base == nullptr || offset < kGlobalHeaderSize || offset > _size)
+    return false;
+  _pos = offset;
+  return true;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A single pcap record. The data pointer points straight into the file mapping, so it is only
+// valid while the MmapPcapReader that produced it is open (see StreamPcapReader for other readers).
+struct PcapPacketView {
+  const uint8_t* data = nullptr;
+  uint32_t captured_len = 0;
+  uint32_t original_len = 0;
+  // Capture time in seconds since the epoch
+  double capture_ts = 0;
+  // Byte offset of the record header within the file
+  uint64_t offset = 0;
+  // LINKTYPE_* value of the interface the packet was captured on
+  uint32_t link_type = 0;
+};
+
+// @brief Reads a classic (libpcap) capture file by memory mapping it and walking the record headers
+// in place. Unlike pcpp::PcapFileReaderDevice, no packet is ever copied: the decode stage reads
+// straight from the page cache, so the memory used by the raw capture can be reclaimed by the kernel.
+class MmapPcapReader
+{
+public:
+  explicit MmapPcapReader(const std::string& path);
+  ~MmapPcapReader();
+
+  MmapPcapReader(const MmapPcapReader&) = delete;
+  MmapPcapReader& operator=(const MmapPcapReader&) = delete;
+
+  // @brief How the records will be read, for the kernel's read-ahead
+  enum class Access {
+    // One pass front to back with GetNextPacket
+    Sequential,
+    // Ranges read by several workers at once, or only the records an index picked
+    Partitioned
+  };
+
+  // @brief Map the file and parse the global header. Returns false if the file can't be mapped or
+  // isn't a classic pcap file.
+  bool Open(Access access = Access::Sequential);
+  void Close();
+  bool IsOpen() const { return _base != nullptr; }
+
+  // @brief Fill packet with the next record. Returns false at the end of the file or if the
+  // remaining bytes don't hold a complete record (e.g. a capture that is still being written).
+  bool GetNextPacket(PcapPacketView& packet);
+
+  // @brief Fill packet with the record whose header is at offset, without touching the read position,
+  // so several threads can walk different parts of the file at once. Returns false like GetNextPacket.
+  bool PacketAt(uint64_t offset, PcapPacketView& packet) const;
+  // @brief File offset of the record following packet
+  static uint64_t NextOffset(const PcapPacketView& packet) { return packet.offset + kRecordHeaderSize + packet.captured_len; }
+
+  // @brief Cut the file into ranges of `stride` records by walking only the record headers. Returns the
+  // offset of the first record of each range followed by the end of the last complete record, so range
+  // i is [boundaries[i], boundaries[i + 1]). Doesn't move the read position.
+  std::vector<uint64_t> RecordBoundaries(size_t stride) const;
+
+  // @brief Move the read position to offset, which must be the offset of a record header (or the
+  // first byte after the global header).
+  bool Seek(uint64_t offset);
+  uint64_t Tell() const { return _pos; }
+
+  // LINKTYPE_* value from the global header
+  uint32_t LinkType() const { return _link_type; }
+  uint64_t FileSize() const { return _size; }
+  // @brief Start of the mapping, i.e. the byte at file offset 0
+  const uint8_t* Data() const { return _base; }
+  static constexpr uint64_t kGlobalHeaderSize = 24;
+  static constexpr uint64_t kRecordHeaderSize = 16;
+
+private:
+  uint32_t ReadU32(const uint8_t* p) const;
+
+  std::string _path;
+  int _fd = -1;
+  const uint8_t* _base = nullptr;
+  uint64_t _size = 0;
+  uint64_t _pos = 0;
+
+  bool _swapped = false;
+  bool _nanosecond = false;
+  uint32_t _link_type = 0;
+};
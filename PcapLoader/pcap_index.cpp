@@ -0,0 +1,254 @@
+#include "pcap_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
+
+#include "Common/field_selection.h"
+
+namespace {
+constexpr char kMagic[8] = {'P', 'J', 'P', 'C', 'A', 'P', 'I', 'X'};
+constexpr uint32_t kVersion = 2;
+// Written as 1 by the machine that built the index, so a foreign byte order reads as something else
+constexpr uint32_t kByteOrderMark = 1;
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t capture_size;
+  int64_t capture_mtime_ns;
+  uint32_t link_type;
+  uint32_t n_names;
+  uint64_t n_entries;
+  uint64_t n_table_refs;
+};
+
+template <typename T>
+void WriteArray(std::ofstream& out, const std::vector<T>& values) {
+  if (!values.empty())
+    out.write(reinterpret_cast<const char*>(values.data()), static_cast<std::streamsize>(values.size() * sizeof(T)));
+}
+
+template <typename T>
+bool ReadArray(std::ifstream& in, std::vector<T>& values, uint64_t n) {
+  values.resize(n);
+  if (n > 0)
+    in.read(reinterpret_cast<char*>(values.data()), static_cast<std::streamsize>(n * sizeof(T)));
+  return static_cast<bool>(in);
+}
+}  // namespace
+
+bool PcapIndex::CaptureStamp(const std::string& capture_path, uint64_t& size, int64_t& mtime_ns) {
+  struct stat st;
+  if (stat(capture_path.c_str(), &st) != 0)
+    return false;
+  size = static_cast<uint64_t>(st.st_size);
+  mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+  return true;
+}
+
+bool PcapIndex::Load(const std::string& capture_path) {
+  Clear();
+  uint64_t capture_size;
+  int64_t capture_mtime_ns;
+  if (!CaptureStamp(capture_path, capture_size, capture_mtime_ns))
+    return false;
+  std::ifstream in(SidecarPath(capture_path), std::ios::binary);
+  if (!in)
+    return false;
+
+  FileHeader header;
+  in.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!in || std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.version != kVersion ||
+      header.byte_order != kByteOrderMark || header.capture_size != capture_size ||
+      header.capture_mtime_ns != capture_mtime_ns)
+    return false;
+
+  bool ok = ReadArray(in, _entries, header.n_entries) && ReadArray(in, _table_refs, header.n_table_refs);
+  for (uint32_t i = 0; ok && i < header.n_names; ++i) {
+    uint32_t length;
+    in.read(reinterpret_cast<char*>(&length), sizeof(length));
+    std::string name(length, '\0');
+    in.read(&name[0], length);
+    ok = static_cast<bool>(in);
+    _table_ids.insert({name, static_cast<uint32_t>(_table_names.size())});
+    _table_names.push_back(std::move(name));
+  }
+  // Reject a truncated index, or one whose table references point past the end of what was read
+  for (const auto& entry : _entries) {
+    if (!ok)
+      break;
+    ok = static_cast<uint64_t>(entry.first_table) + entry.n_tables <= _table_refs.size() &&
+         entry.payload_offset + entry.payload_len <= capture_size;
+  }
+  for (uint32_t ref : _table_refs) {
+    if (!ok)
+      break;
+    ok = ref < _table_names.size();
+  }
+  if (!ok) {
+    Clear();
+    return false;
+  }
+  _link_type = header.link_type;
+  _n_typed = _entries.size();
+  return true;
+}
+
+bool PcapIndex::Save(const std::string& capture_path, uint64_t capture_size, int64_t capture_mtime_ns) const {
+  // A capture that changed during the load may have grown past what was indexed
+  uint64_t size;
+  int64_t mtime_ns;
+  if (!CaptureStamp(capture_path, size, mtime_ns) || size != capture_size || mtime_ns != capture_mtime_ns)
+    return false;
+  FileHeader header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.byte_order = kByteOrderMark;
+  header.capture_size = capture_size;
+  header.capture_mtime_ns = capture_mtime_ns;
+  header.link_type = _link_type;
+  header.n_names = static_cast<uint32_t>(_table_names.size());
+  header.n_entries = _entries.size();
+  header.n_table_refs = _table_refs.size();
+
+  // Write a temporary file and move it into place, so a reader never sees half an index
+  const std::string path = SidecarPath(capture_path);
+  const std::string tmp_path = path + ".tmp";
+  {
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!out)
+      return false;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    WriteArray(out, _entries);
+    WriteArray(out, _table_refs);
+    for (const auto& name : _table_names) {
+      const uint32_t length = static_cast<uint32_t>(name.size());
+      out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+      out.write(name.data(), length);
+    }
+    out.flush();
+    if (!out) {
+      out.close();
+      std::remove(tmp_path.c_str());
+      return false;
+    }
+  }
+  if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    std::remove(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+void PcapIndex::Clear() {
+  _link_type = 0;
+  _entries.clear();
+  _table_refs.clear();
+  _table_names.clear();
+  _table_ids.clear();
+  _n_typed = 0;
+}
+
+void PcapIndex::AddEntry(const Entry& entry) {
+  _entries.push_back(entry);
+  _entries.back().first_table = 0;
+  _entries.back().n_tables = 0;
+}
+
+void PcapIndex::AddEntryTables(const std::vector<std::string>& table_names) {
+  if (_n_typed >= _entries.size())
+    return;
+  Entry& entry = _entries[_n_typed++];
+  entry.first_table = static_cast<uint32_t>(_table_refs.size());
+  entry.n_tables = static_cast<uint32_t>(table_names.size());
+  for (const auto& name : table_names) {
+    auto it = _table_ids.find(name);
+    if (it == _table_ids.end()) {
+      it = _table_ids.insert({name, static_cast<uint32_t>(_table_names.size())}).first;
+      _table_names.push_back(name);
+    }
+    _table_refs.push_back(it->second);
+  }
+}
+
+bool PcapIndex::TimeRange(double& first, double& last) const {
+  if (_entries.empty())
+    return false;
+  // Captures are written in arrival order, but clocks can step, so don't trust the first and last record
+  first = last = _entries.front().capture_ts;
+  for (const auto& entry : _entries) {
+    first = std::min(first, entry.capture_ts);
+    last = std::max(last, entry.capture_ts);
+  }
+  return true;
+}
+
+std::vector<size_t> PcapIndex::Select(const RecordFilter& filter) const {
+  // If none of the sources is an address, nothing can match them
+  const std::vector<uint32_t> sources = ParseIPv4List(filter.sources);
+  const std::vector<uint32_t> destinations = ParseIPv4List(filter.destinations);
+  auto accepts = [](const std::vector<uint32_t>& ips, uint32_t ip) {
+    return std::find(ips.begin(), ips.end(), ip) != ips.end();
+  };
+
+  const FieldSelection selection(filter.field_patterns);
+  std::vector<bool> wanted_tables;
+  if (!filter.message_types.empty() || !selection.Empty()) {
+    wanted_tables.resize(_table_names.size());
+    for (size_t i = 0; i < _table_names.size(); ++i)
+      wanted_tables[i] = MatchesMessageType(filter.message_types, _table_names[i]) &&
+                         selection.MatchesTable(_table_names[i]);
+  }
+
+  std::vector<size_t> selected;
+  for (size_t i = 0; i < _entries.size(); ++i) {
+    const Entry& entry = _entries[i];
+    if (filter.has_time_range) {
+      const double second = std::floor(entry.capture_ts);
+      if (second < static_cast<double>(filter.begin_time) || second > static_cast<double>(filter.end_time))
+        continue;
+    }
+    if (!filter.sources.empty() && !accepts(sources, entry.src_ip))
+      continue;
+    if (!filter.destinations.empty() && !accepts(destinations, entry.dst_ip))
+      continue;
+    if (!filter.ports.empty() && std::find(filter.ports.begin(), filter.ports.end(), entry.src_port) == filter.ports.end() &&
+        std::find(filter.ports.begin(), filter.ports.end(), entry.dst_port) == filter.ports.end())
+      continue;
+    if (!wanted_tables.empty()) {
+      bool found = false;
+      for (uint32_t j = 0; j < entry.n_tables && !found; ++j)
+        found = wanted_tables[_table_refs[entry.first_table + j]];
+      if (!found)
+        continue;
+    }
+    selected.push_back(i);
+  }
+  return selected;
+}
+
+std::vector<uint32_t> PcapIndex::ParseIPv4List(const std::vector<std::string>& addresses) {
+  std::vector<uint32_t> ips;
+  for (const auto& address : addresses) {
+    uint32_t ip;
+    if (ParseIPv4(address, ip))
+      ips.push_back(ip);
+  }
+  return ips;
+}
+
+bool PcapIndex::ParseIPv4(const std::string& address, uint32_t& ip) {
+  unsigned int a, b, c, d;
+  char extra;
+  if (std::sscanf(address.c_str(), "%u.%u.%u.%u%c", &a, &b, &c, &d, &extra) != 4 || a > 255 || b > 255 ||
+      c > 255 || d > 255)
+    return false;
+  // Host order, so 10.0.0.1 is 0x0a000001
+  ip = (a << 24) | (b << 16) | (c << 8) | d;
+  return true;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Common/record_filter.h"
+
+// @brief Sidecar index of a capture, "<capture>.pjidx", built while a capture is loaded for the first
+// time. It records where every UDP record and its payload start, the capture time, the addresses and
+// the ECM message types found in the payload, so the following loads can go straight to the records
+// they want (and split them across threads) without parsing any packet headers.
+//
+// The index is tied to the size and modification time of the capture and is ignored once either
+// changes. The file is written in host byte order; an index from a machine of the other endianness is
+// rejected like a stale one.
+class PcapIndex
+{
+public:
+  struct Entry {
+    // File offset of the record header
+    uint64_t record_offset;
+    // File offset and length of the UDP payload
+    uint64_t payload_offset;
+    uint32_t payload_len;
+    // IPv4 addresses in host order, 0 if the packet isn't IPv4
+    uint32_t src_ip;
+    uint32_t dst_ip;
+    uint16_t src_port;
+    uint16_t dst_port;
+    double capture_ts;
+    // Message types of the record: TableNames()[TableRefs()[first_table + i]] for i < n_tables
+    uint32_t first_table;
+    uint32_t n_tables;
+  };
+
+  static std::string SidecarPath(const std::string& capture_path) { return capture_path + ".pjidx"; }
+
+  // @brief Load the index of capture_path. Returns false if there is none or it is out of date.
+  bool Load(const std::string& capture_path);
+  // @brief Write the index next to capture_path, stamped with the size and modification time the
+  // capture had when it was opened for the load that built the index. Returns false if it can't be
+  // written, or if the capture has changed since, e.g. because it is still being recorded: the index
+  // would only cover the bytes that were mapped.
+  bool Save(const std::string& capture_path, uint64_t capture_size, int64_t capture_mtime_ns) const;
+  void Clear();
+
+  // @brief Add a record. Entries must be added in file order; their message types are set by
+  // AddEntryTables.
+  void AddEntry(const Entry& entry);
+  // @brief Set the message types of the next entry that has none yet. Types must be set in entry order.
+  void AddEntryTables(const std::vector<std::string>& table_names);
+
+  const std::vector<Entry>& Entries() const { return _entries; }
+  size_t Size() const { return _entries.size(); }
+  const std::vector<std::string>& TableNames() const { return _table_names; }
+  const std::vector<uint32_t>& TableRefs() const { return _table_refs; }
+  uint32_t LinkType() const { return _link_type; }
+  void SetLinkType(uint32_t link_type) { _link_type = link_type; }
+  // @brief Capture time of the first and last entry. Returns false if the index is empty.
+  bool TimeRange(double& first, double& last) const;
+
+  // @brief Indices of the entries matching filter, in file order. With message types or field patterns,
+  // only the entries holding at least one message of a matching type are selected.
+  std::vector<size_t> Select(const RecordFilter& filter) const;
+
+  // @brief Parse a dotted IPv4 address into the representation of Entry::src_ip. Returns false if
+  // address isn't one.
+  static bool ParseIPv4(const std::string& address, uint32_t& ip);
+  static std::vector<uint32_t> ParseIPv4List(const std::vector<std::string>& addresses);
+
+  // @brief Size and modification time of the capture, which an index is tied to
+  static bool CaptureStamp(const std::string& capture_path, uint64_t& size, int64_t& mtime_ns);
+
+private:
+
+  uint32_t _link_type = 0;
+  std::vector<Entry> _entries;
+  std::vector<uint32_t> _table_refs;
+  std::vector<std::string> _table_names;
+  std::unordered_map<std::string, uint32_t> _table_ids;
+  // Number of entries whose message types were set
+  size_t _n_typed = 0;
+};
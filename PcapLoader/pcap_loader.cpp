@@ -1,4 +1,5 @@
 #include "pcap_loader.h"
+#include "mmap_pcap_reader.h"
 
 #include "IPv4Layer.h"
 #include "Packet.h"
@@ -13,15 +14,27 @@
 #include <QProgressDialog>
 #include <QDateTime>
 #include <QInputDialog>
+#include <QApplication>
+#include <arpa/inet.h>
+#include <cmath>
 #include <thread>
 // #include <algorithm>
 // #include <execution>
 // #include <valgrind/callgrind.h>
 
 
-#include <chrono>
-
 #include "elroy_common_msg/msg_handling/msg_decoder.h"
+#include "Common/decode_pipeline.h"
+#include "Common/decode_sink.h"
+#include "Common/ecm_decoder.h"
+#include "Common/field_table.h"
+#include "Common/load_dialog.h"
+#include "Common/load_progress.h"
+#include "Common/load_telemetry.h"
+#include "Common/message_type_dialog.h"
+#include "Common/series_cache.h"
+#include "Common/series_store.h"
+#include "Common/thread_pool.h"
 
 // static constexpr std::vector<type> numeric_types{int, double};
 // std::vector<std::reference_wrapper<const std::type_info>> numericTypes = {
@@ -35,38 +48,123 @@ using EcmMessageMap = std::unordered_map<std::string, std::variant<std::string,
 
 PcapLoader::PcapLoader(){
     _extensions.push_back("pcap");
+    _extensions.push_back("pcapng");
+    // Compressed captures, e.g. flight.pcap.gz or flight.pcapng.zst. plotjuggler only matches the last
+    // suffix of a file, so "pcap.gz" would never match; any other .gz or .zst file is turned down with
+    // "not a compressed capture" once its first inflated bytes are read, before the pipeline starts.
+    _extensions.push_back("gz");
+    _extensions.push_back("zst");
+}
+
+// Wrap a record in a pcpp::RawPacket without copying it, so that pcpp::Packet can parse it in place
+static pcpp::RawPacket ToRawPacket(const PcapPacketView& packet, pcpp::LinkLayerType link_type){
+  timespec ts;
+  ts.tv_sec = static_cast<time_t>(packet.capture_ts);
+  ts.tv_nsec = static_cast<long>((packet.capture_ts - ts.tv_sec) * 1e9);
+  return pcpp::RawPacket(packet.data, static_cast<int>(packet.captured_len), ts, false, link_type);
+}
+
+namespace {
+enum class FrameKind { Udp, NotUdp, Unknown };
+
+uint16_t ReadBigEndian16(const uint8_t* p){
+  return static_cast<uint16_t>((p[0] << 8) | p[1]);
 }
 
-std::unordered_map<std::string, std::vector<std::variant<std::string, double, bool>>> PcapLoader::ProcessPackets(std::vector<pcpp::RawPacket> &vec, size_t start_idx, size_t end_idx)const{
-  std::unordered_map<std::string, std::vector<std::variant<std::string, double, bool>>> map_of_vec;
-  elroy_common_msg::MsgDecoder decoder;
-  for (size_t i = start_idx; i < end_idx; ++i){
-    size_t current_index = 0;
-    pcpp::Packet parsed_packet(&vec[i]);
+uint32_t ReadBigEndian32(const uint8_t* p){
+  return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) | (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+// Find the UDP payload of a plain Ethernet/IPv4/UDP frame (or a raw IPv4 packet) from the header
+// fields alone. Anything else, e.g. VLAN tags, IP options that don't fit or fragments, is Unknown and
+// left to PcapPlusPlus.
+FrameKind FastUdpPayload(const PcapPacketView& packet, uint32_t link_type, const uint8_t*& payload,
+                         size_t& payload_len, PcapLoader::UdpEndpoints* endpoints){
+  constexpr uint32_t kLinkTypeEthernet = 1;
+  constexpr uint32_t kLinkTypeRaw = 101;
+  constexpr uint32_t kLinkTypeIPv4 = 228;
+  constexpr size_t kEthernetHeaderSize = 14;
+  constexpr uint16_t kEtherTypeIPv4 = 0x0800;
+  constexpr uint8_t kProtocolUdp = 17;
+  constexpr size_t kUdpHeaderSize = 8;
+
+  const uint8_t* data = packet.data;
+  size_t len = packet.captured_len;
+  if (link_type == kLinkTypeEthernet){
+    if (len < kEthernetHeaderSize || ReadBigEndian16(data + 12) != kEtherTypeIPv4)
+      return FrameKind::Unknown;
+    data += kEthernetHeaderSize;
+    len -= kEthernetHeaderSize;
+  } else if (link_type != kLinkTypeRaw && link_type != kLinkTypeIPv4){
+    return FrameKind::Unknown;
+  }
+
+  if (len < 20 || (data[0] >> 4) != 4)
+    return FrameKind::Unknown;
+  const size_t ip_header_size = (data[0] & 0x0f) * 4;
+  // More fragments, or not the first fragment
+  const bool fragment = (ReadBigEndian16(data + 6) & 0x3fff) != 0;
+  if (ip_header_size < 20 || fragment)
+    return FrameKind::Unknown;
+  if (data[9] != kProtocolUdp)
+    return FrameKind::NotUdp;
+  if (len < ip_header_size + kUdpHeaderSize)
+    return FrameKind::Unknown;
+
+  const uint8_t* udp = data + ip_header_size;
+  const size_t udp_len = ReadBigEndian16(udp + 4);
+  if (udp_len < kUdpHeaderSize)
+    return FrameKind::Unknown;
+  // A truncated capture only has part of the payload, same as PcapPlusPlus would return
+  payload = udp + kUdpHeaderSize;
+  payload_len = std::min(udp_len, len - ip_header_size) - kUdpHeaderSize;
+  if (endpoints != nullptr){
+    endpoints->src_ip = ReadBigEndian32(data + 12);
+    endpoints->dst_ip = ReadBigEndian32(data + 16);
+    endpoints->src_port = ReadBigEndian16(udp);
+    endpoints->dst_port = ReadBigEndian16(udp + 2);
+  }
+  return FrameKind::Udp;
+}
+}  // namespace
+
+bool PcapLoader::UdpPayload(const PcapPacketView &packet, const uint8_t *&payload, size_t &payload_len,
+                            UdpEndpoints *endpoints){
+  // Nearly all of our traffic is plain Ethernet/IPv4/UDP, which doesn't need a pcpp::Packet and its
+  // layer objects at all
+  switch (FastUdpPayload(packet, packet.link_type, payload, payload_len, endpoints)){
+    case FrameKind::Udp:
+      return true;
+    case FrameKind::NotUdp:
+      return false;
+    case FrameKind::Unknown:
+      break;
+  }
+  pcpp::RawPacket raw_packet = ToRawPacket(packet, static_cast<pcpp::LinkLayerType>(packet.link_type));
+  pcpp::Packet parsed_packet(&raw_packet);
+  const auto& udp_layer = parsed_packet.getLayerOfType<pcpp::UdpLayer>();
+  if (udp_layer == nullptr)
+    return false;
+  // The payload points into the record, not into the parsed packet, so it outlives both
+  payload = udp_layer->getLayerPayload();
+  payload_len = udp_layer->getLayerPayloadSize();
+  if (endpoints != nullptr){
     const auto& ipv4_layer = parsed_packet.getLayerOfType<pcpp::IPv4Layer>();
-    const auto& udp_layer = parsed_packet.getLayerOfType<pcpp::UdpLayer>();
-    const auto& byte_array = udp_layer->getLayerPayload();
-    size_t byte_array_len = udp_layer->getLayerPayloadSize();
-    size_t bytes_processed = 0;
-    std::string delim = "/";
-    elroy_common_msg::MessageDecoderResult res;
-    while (current_index < byte_array_len){
-      if (!decoder.DecodeAsMapOfArrays(byte_array + current_index , byte_array_len-current_index, bytes_processed, map_of_vec, res, delim))
-        break;
-      current_index += bytes_processed;
-    }
+    endpoints->src_ip = ipv4_layer != nullptr ? ntohl(ipv4_layer->getSrcIPv4Address().toInt()) : 0;
+    endpoints->dst_ip = ipv4_layer != nullptr ? ntohl(ipv4_layer->getDstIPv4Address().toInt()) : 0;
+    endpoints->src_port = udp_layer->getSrcPort();
+    endpoints->dst_port = udp_layer->getDstPort();
   }
-  return map_of_vec;
+  return true;
 }
-std::vector<EcmMessageMap> PcapLoader::ParseOnePacketToMap(pcpp::RawPacket &packet, const std::string &delim)const{
+std::vector<EcmMessageMap> PcapLoader::ParseOnePacketToMap(const PcapPacketView &packet, const std::string &delim)const{
   //elroy_common_msg::MsgDecoder decoder;
   std::vector<EcmMessageMap> maps;
   size_t current_index = 0;
-  pcpp::Packet parsed_packet(&packet);
-  const auto& ipv4_layer = parsed_packet.getLayerOfType<pcpp::IPv4Layer>();
-  const auto& udp_layer = parsed_packet.getLayerOfType<pcpp::UdpLayer>();
-  const auto& byte_array = udp_layer->getLayerPayload();
-  size_t byte_array_len = udp_layer->getLayerPayloadSize();
+  const uint8_t* byte_array;
+  size_t byte_array_len;
+  if (!UdpPayload(packet, byte_array, byte_array_len))
+    return maps;
   size_t bytes_processed = 0;
   while (current_index < byte_array_len){
     std::unordered_map<std::string, std::variant<std::string, double, bool>> map;
@@ -79,434 +177,398 @@ std::vector<EcmMessageMap> PcapLoader::ParseOnePacketToMap(pcpp::RawPacket &pack
   }
   return maps;
 }
-bool PcapLoader::readDataFromFile_transform(PJ::FileLoadInfo* fileload_info, PlotDataMapRef& plot_data){
-
-  auto startTime = std::chrono::high_resolution_clock::now();
-  int numThreads = 8;
-  std::vector<pcpp::RawPacket> packet_data;
-  std::vector<std::unordered_map<std::string, std::variant<std::string, double, bool>>> vec_of_map_of_variants;
-
-  // Load the pcap file
-  const auto& path = fileload_info->filename.toStdString();
-  std::cout <<"File name: " <<  path << std::endl;
-  pcpp::PcapFileReaderDevice reader(path);
-  if (!reader.open()) {
-    std::string m = "Could not open pcap file: {}"+ path;
-    throw std::runtime_error(m);
-  }
-  pcpp::RawPacket raw_packet;
-  while (reader.getNextPacket(raw_packet)){
-    packet_data.push_back(raw_packet);
-  }
-//   std::transform(
-//     std::execution::par,            // Parallel execution policy
-//     packet_data.begin(), packet_data.end(), // Input range
-//     vec_of_map_of_variants.begin(),              // Output range
-//     [](pcpp::RawPacket packet) {
-//         // process packets one at a time
-//         return ParseOnePacketToMap(packet);
-//     }
-// );
-return true;
-}
-
 bool PcapLoader::readDataFromFile_mulithread(PJ::FileLoadInfo* fileload_info, PlotDataMapRef& plot_data){
   // Warning: This function uses tons of memory!
-  auto startTime = std::chrono::high_resolution_clock::now();
-  int numThreads = 1;
   std::string delim = "/";
 
-  // Initialize pointers to plotjuggler plots
-  std::map<QString, PlotData*> plots_map;
-  // Initialize pointers to plotjuggler string plots (this only displays the strings in the tree and does not plot them)
-  std::map<QString, PJ::StringSeries*> string_map;
-
   // Load the pcap file into a vector of packets
-  std::vector<pcpp::RawPacket> packet_data;
+  std::vector<PcapPacketView> packet_data;
   const auto& path = fileload_info->filename.toStdString();
-  pcpp::PcapFileReaderDevice reader(path);
-  if (!reader.open()) {
+  LoadTelemetry telemetry("PcapLoader", path);
+  MmapPcapReader reader(path);
+  if (!reader.Open()) {
     std::string m = "Could not open pcap file: {}"+ path;
     throw std::runtime_error(m);
   }
-  pcpp::RawPacket raw_packet;
-  while (reader.getNextPacket(raw_packet)){
-    packet_data.push_back(raw_packet);
+  _link_type = static_cast<pcpp::LinkLayerType>(reader.LinkType());
+  {
+    auto scope = telemetry.Time("read packets");
+    PcapPacketView packet;
+    while (reader.GetNextPacket(packet)){
+      packet_data.push_back(packet);
+      telemetry.n_bytes += packet.captured_len;
+    }
   }
-
-  // Convert each packet into a vector of Ecm message maps
-  std::vector<std::vector<EcmMessageMap>> vec_of_maps(numThreads);
-  const size_t chunkSize = packet_data.size() / numThreads;
-  std::vector<std::thread> threads;
-  for (size_t thread_idx = 0; thread_idx < numThreads; ++thread_idx) {
-    size_t startIndex = thread_idx * chunkSize;
-    size_t endIndex = (thread_idx == numThreads - 1) ? packet_data.size() : (thread_idx + 1) * chunkSize;
-    threads.emplace_back([this, &packet_data, &vec_of_maps, thread_idx, startIndex, endIndex](){
-      for(size_t j = startIndex; j < endIndex; ++j){
+  telemetry.n_records = packet_data.size();
+
+  // Convert each batch of packets into a vector of Ecm message maps
+  ThreadPool& pool = ThreadPool::Instance();
+  const size_t n_batches = (packet_data.size() + kPacketBatchSize - 1) / kPacketBatchSize;
+  std::vector<std::vector<EcmMessageMap>> vec_of_maps(n_batches);
+  {
+    auto scope = telemetry.Time("decode to maps");
+    pool.ParallelFor(packet_data.size(), kPacketBatchSize, [this, &packet_data, &vec_of_maps](size_t slot, size_t begin, size_t end){
+      auto& batch_maps = vec_of_maps[begin / kPacketBatchSize];
+      for(size_t j = begin; j < end; ++j){
         const auto& message_maps = this->ParseOnePacketToMap(packet_data[j]);
-        vec_of_maps[thread_idx].insert(vec_of_maps[thread_idx].end(), message_maps.begin(), message_maps.end());
+        batch_maps.insert(batch_maps.end(), message_maps.begin(), message_maps.end());
       }
     });
   }
-  // Wait for all threads to finish
-  for (auto& thread : threads) {
-      thread.join();
-  }
-  size_t n_msgs = 0;
-  // Add each ecm message map to plotjuggler
-  for (const auto& vec_per_thread : vec_of_maps){
-    for(const auto& map : vec_per_thread){
-      if (map.size() == 0)
-        continue;
-      // Get the instance id
-      std::string instance_key = "component" + delim + "instance"; 
-      std::string instance_id = "";
-      double instance_component = 0;
-      for(auto it = map.begin(); it!= map.end(); ++it){
-        const std::string& key = it->first;
-        if(key.size() > instance_key.size() && key.compare(key.size() - instance_key.size(), instance_key.size(), instance_key) == 0 ){
-          instance_id = "_"+  std::to_string(static_cast<size_t>(std::get<double>(map.at(key))));
-        }
-      }
-      // Get the timestamp
-      double timestamp = 0;
-      std::string timestamp_key = "BusObject" + delim + "write_timestamp_ns";
-      for(auto it = map.begin(); it!= map.end(); ++it){
-        const std::string& key = it->first;
-        if(key.size() > timestamp_key.size() && key.compare(key.size() - timestamp_key.size(), timestamp_key.size(), timestamp_key) == 0 ){
-          timestamp = std::get<double>(map.at(key)) / 1e9;
-        }
-      }
-      // Write each element from the ecm message map to plotjuggler
-      for (const auto& pair: map){
-        n_msgs++;
-        std::string field_name_str = pair.first;
-        field_name_str = field_name_str.insert(field_name_str.find(delim), "_"+instance_id);
-        QString field_name = QString::fromStdString(field_name_str);
-
-        // Add a new column to the plotter if it does not already exist
-        if ((std::holds_alternative<double>(pair.second) || std::holds_alternative<bool>(pair.second)) && plots_map.find(field_name) == plots_map.end()){
-          auto it = plot_data.addNumeric(field_name.toStdString());
-          plots_map[field_name] = (&(it->second));
-        }
-        else if (std::holds_alternative<std::string>(pair.second) && string_map.find(field_name) == string_map.end()){
-          auto it = plot_data.addStringSeries(field_name.toStdString());
-          string_map[field_name] = (&(it->second));
-        }
-        // Add the data to the plotter
-        if(std::holds_alternative<double>(pair.second)){
-          PlotData::Point point(timestamp, std::get<double>(pair.second));
-          plots_map[field_name]->pushBack(point);
-        }else if(std::holds_alternative<std::string>(pair.second)){
-          string_map[field_name]->pushBack({timestamp, std::get<std::string>(pair.second)});
-          continue;
-        }
+  // Add each ecm message map to plotjuggler. Fields are resolved to their series once, after that
+  // each sample is pushed through a cached handle.
+  FieldTable field_table(&plot_data);
+  EcmDecoder decoder(field_table, delim);
+  PlotDataSink sink;
+  {
+    auto scope = telemetry.Time("write to plotjuggler");
+    for (const auto& vec_per_batch : vec_of_maps){
+      for(const auto& map : vec_per_batch){
+        if (decoder.Dispatch(map, sink))
+          ++telemetry.n_messages;
       }
     }
   }
-  auto endTime = std::chrono::high_resolution_clock::now();
-  auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
-  std::cout << "Time taken by function: " << duration.count()/1000.0 << " seconds" << std::endl; // takes 5sec for 93mb
-  std::cout << "N_msgs = " << n_msgs << std::endl;
+  telemetry.Report(plot_data);
   return true;
 }
 
-bool PcapLoader::readDataFromFile_mulithread_old(PJ::FileLoadInfo* fileload_info, PlotDataMapRef& plot_data){
-  auto startTime = std::chrono::high_resolution_clock::now();
-  int numThreads = 8;
-  std::vector<pcpp::RawPacket> packet_data;
-  std::vector<std::unordered_map<std::string, std::vector<std::variant<std::string, double, bool>>>> vec_of_map_of_vec(numThreads);
-
-  // Load the pcap file
-  const auto& path = fileload_info->filename.toStdString();
-  std::cout <<"File name: " <<  path << std::endl;
-  // const bool file_exists = access(fileload_info->filename, 0) == 0;
-  pcpp::PcapFileReaderDevice reader(path);
-  if (!reader.open()) {
-    std::string m = "Could not open pcap file: {}"+ path;
-    throw std::runtime_error(m);
-  }
-  pcpp::RawPacket raw_packet;
-  while (reader.getNextPacket(raw_packet)){
-    packet_data.push_back(raw_packet);
-  }
-  std::vector<std::thread> threads;
-  const size_t chunkSize = packet_data.size() / numThreads;
-  for (size_t i = 0; i < numThreads; ++i) {
-    size_t startIndex = i * chunkSize;
-    size_t endIndex = (i == numThreads - 1) ? packet_data.size() : (i + 1) * chunkSize;
-    threads.emplace_back([this, &packet_data, &vec_of_map_of_vec, i, startIndex, endIndex](){
-      vec_of_map_of_vec[i] = this->ProcessPackets(packet_data, startIndex, endIndex);
-    });
-  }
-  // Wait for all threads to finish
-  for (auto& thread : threads) {
-      thread.join();
-  }
+bool PcapLoader::AskForFilter(const PcapIndex& index, RecordFilter& filter, bool& lazy){
+  // Only ask when running inside plotjuggler, not from PcapLoaderExec
+  if (qobject_cast<QApplication*>(QCoreApplication::instance()) == nullptr)
+    return true;
+  double first_ts, last_ts;
+  if (!index.TimeRange(first_ts, last_ts))
+    return true;
+  LoadDialog dialog(static_cast<int64_t>(std::floor(first_ts)), static_cast<int64_t>(std::floor(last_ts)), "PcapLoader", true);
+  if (dialog.exec() != QDialog::Accepted)
+    return false;
+  dialog.SaveSettings();
+  filter = dialog.Filter();
+  lazy = dialog.Lazy();
+  return true;
+}
 
-  // Join together the maps of arrays
-  std::unordered_map<std::string, std::vector<std::variant<std::string, double, bool>>> map_of_vecs;
-  for (const auto& map : vec_of_map_of_vec){
-    for (const auto& key_val : map){
-      const auto& key = key_val.first;
-      map_of_vecs.insert({key, {}});
-      // std::cout << key << " has n messages: " << key_val.second.size() << std::endl;
-      map_of_vecs[key].insert(map_of_vecs[key].end(), key_val.second.begin(), key_val.second.end());
-      continue;
+void PcapLoader::ScanMessageTypes(const MmapPcapReader& reader, const PcapIndex& index, const RecordFilter& filter,
+                                  FieldTable& scanned){
+  // The index knows the message types of every packet, so the first packet holding each type is enough
+  const auto& entries = index.Entries();
+  const auto& refs = index.TableRefs();
+  std::vector<bool> seen(index.TableNames().size(), false);
+  std::vector<size_t> selected;
+  for (size_t i = 0; i < entries.size(); ++i){
+    bool is_new = false;
+    for (uint32_t j = 0; j < entries[i].n_tables; ++j){
+      const uint32_t ref = refs[entries[i].first_table + j];
+      is_new = is_new || !seen[ref];
+      seen[ref] = true;
     }
+    if (is_new)
+      selected.push_back(i);
   }
+  DecodePipeline pipeline(scanned);
+  pipeline.SetMessageTypes(filter.message_types);
+  pipeline.SetFieldSelection(FieldSelection(filter.field_patterns));
+  ReadIndexed(reader, index, selected, pipeline, [](DecodedBatch&){});
+}
 
-  // Now that the map of vectors has been populated, for each key in that map copy the vector to plotjuggler
-
-  // We need to record pointers to each plot
-  size_t n_msgs = 0;
-  std::map<QString, PlotData*> plots_map;
-  std::map<QString, PJ::StringSeries*> string_map;
-  if(map_of_vecs.size() > 0 && true){
-    for (const auto& pair: map_of_vecs){
-      QString field_name = QString::fromStdString(pair.first);
-      if(pair.second.size() == 0)
-        continue;
-      n_msgs+= pair.second.size();
-      // Add this field name to plotjuggler if it doesn't exist
-      if (std::holds_alternative<double>(pair.second[0]) && plots_map.find(field_name) == plots_map.end()){
-        auto it = plot_data.addNumeric(pair.first);
-        plots_map[field_name] = (&(it->second));
+void PcapLoader::ReadIndexed(const MmapPcapReader& reader, const PcapIndex& index, const std::vector<size_t>& selected,
+                             DecodePipeline& pipeline, const DecodePipeline::Writer& writer){
+  // The index knows where every payload is, so no packet is parsed and every worker reads its own
+  // batches of entries straight from the mapped file
+  const uint8_t* data = reader.Data();
+  const auto& entries = index.Entries();
+  const size_t n_partitions = (selected.size() + kPacketBatchSize - 1) / kPacketBatchSize;
+  pipeline.RunPartitioned(n_partitions,
+    [data, &entries, &selected](size_t /*worker*/, size_t partition, const DecodePipeline::RecordCallback& decode){
+      const size_t begin = partition * kPacketBatchSize;
+      const size_t end = std::min(begin + kPacketBatchSize, selected.size());
+      for (size_t i = begin; i < end; ++i){
+        const auto& entry = entries[selected[i]];
+        decode(data + entry.payload_offset, entry.payload_len, entry.capture_ts);
       }
-      else if (std::holds_alternative<std::string>(pair.second[0]) && plots_map.find(field_name) == plots_map.end()){
-        auto it = plot_data.addStringSeries(pair.first);
-        string_map[field_name] = (&(it->second));
+    },
+    writer);
+}
+
+void PcapLoader::ReadAndIndex(const MmapPcapReader& reader, PcapIndex& index, FieldTable& field_table,
+                              DecodePipeline& pipeline, LoadProgress& progress, const DecodePipeline::Writer& writer){
+  // Cut the capture into ranges of kPacketBatchSize records with a pass over the record headers only.
+  // After that every worker parses and decodes its own ranges of the mapped file, so no thread reads
+  // the capture front to back before the others can start. UDP payloads point into the mapping, so
+  // nothing is copied until the decoders write their stores. Ranges are written to plotjuggler in
+  // capture order while the next ones are still being decoded.
+  const std::vector<uint64_t> boundaries = reader.RecordBoundaries(kPacketBatchSize);
+  const size_t n_partitions = boundaries.size() - 1;
+  const uint8_t* data = reader.Data();
+  // Only the last range is short, and only packets that aren't UDP are left out
+  progress.SetTotal(n_partitions * kPacketBatchSize);
+
+  // Each worker fills the index entries of its own ranges; the writer adds them, with the tables found
+  // in each record, once the range is written
+  index.Clear();
+  index.SetLinkType(reader.LinkType());
+  std::vector<std::vector<PcapIndex::Entry>> partition_entries(n_partitions);
+  std::vector<std::string> names;
+  pipeline.SetRecordTables(true);
+  pipeline.RunPartitioned(n_partitions,
+    [&reader, &boundaries, &partition_entries, data](size_t /*worker*/, size_t partition,
+                                                     const DecodePipeline::RecordCallback& decode){
+      auto& entries = partition_entries[partition];
+      PcapPacketView packet;
+      const uint8_t* payload;
+      size_t payload_len;
+      UdpEndpoints endpoints;
+      for (uint64_t offset = boundaries[partition];
+           offset < boundaries[partition + 1] && reader.PacketAt(offset, packet);
+           offset = MmapPcapReader::NextOffset(packet)){
+        if (!UdpPayload(packet, payload, payload_len, &endpoints))
+          continue;
+        entries.push_back({packet.offset, static_cast<uint64_t>(payload - data), static_cast<uint32_t>(payload_len),
+                           endpoints.src_ip, endpoints.dst_ip, endpoints.src_port, endpoints.dst_port,
+                           packet.capture_ts, 0, 0});
+        decode(payload, payload_len, packet.capture_ts);
       }
-      size_t i = 0;
-      for(const auto& value : pair.second){
-        ++i;
-        if(std::holds_alternative<double>(value)){
-            // Get the timestamp from the udp packet. I might need to use the udp layer
-            PlotData::Point point(i, std::get<double>(value));
-            plots_map[field_name]->pushBack(point);
-          }else if(std::holds_alternative<std::string>(value)){
-            // std::cout << std::get<std::string>(pair.second) << std::endl;
-            string_map[field_name]->pushBack({static_cast<double>(i), std::get<std::string>(value)});
-            continue;
-          }
+    },
+    [&writer, &index, &field_table, &partition_entries, &names](DecodedBatch& batch){
+      auto& entries = partition_entries[batch.sequence];
+      size_t begin = 0;
+      for (size_t i = 0; i < entries.size(); ++i){
+        index.AddEntry(entries[i]);
+        names.clear();
+        for (size_t j = begin; j < batch.record_table_end[i]; ++j)
+          names.push_back(field_table.Table(batch.record_tables[j]).name);
+        index.AddEntryTables(names);
+        begin = batch.record_table_end[i];
       }
-    }
-  }else{
-    std::cout << "map of vec is empty" << std::endl;
-  }
-  auto endTime = std::chrono::high_resolution_clock::now();
-  auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
-  std::cout << "Time taken by function: " << duration.count()/1000.0 << " seconds" << std::endl;
-  std::cout << "N_msgs = " << n_msgs << std::endl; //9743346
+      std::vector<PcapIndex::Entry>().swap(entries);
+      writer(batch);
+    });
+  pipeline.SetRecordTables(false);
+}
+
+void PcapLoader::ReadStream(StreamPcapReader& reader, DecodePipeline& pipeline, const DecodePipeline::Writer& writer){
+  // The reader thread inflates and parses the stream while the workers decode the previous batches.
+  // Packets only live in the reader's buffer until the next one is read, so payloads are copied.
+  pipeline.Run(
+    [this, &reader](RawBatch& batch){
+      PcapPacketView packet;
+      const uint8_t* payload;
+      size_t payload_len;
+      while (batch.Size() < kPacketBatchSize){
+        if (!reader.GetNextPacket(packet))
+          return false;
+        if (UdpPayload(packet, payload, payload_len))
+          batch.Add(payload, payload_len, packet.capture_ts);
+      }
+      return true;
+    },
+    writer);
+}
+
+bool PcapLoader::LoadCached(const std::string& path, PlotDataMapRef& plot_data, LoadTelemetry& telemetry){
+  if (!SeriesCache::Enabled())
+    return false;
+  auto scope = telemetry.Time("load cache");
+  if (!SeriesCache::Load(path, plot_data))
+    return false;
+  telemetry.mode = "cache";
   return true;
 }
-bool PcapLoader::readDataFromFile(PJ::FileLoadInfo* fileload_info,
-                        PlotDataMapRef& plot_data){
-  return PcapLoader::readDataFromFile_mulithread_old(fileload_info, plot_data);                        
-  // return PcapLoader::readDataFromFile_mulithread(fileload_info, plot_data);                        
 
-  auto startTime = std::chrono::high_resolution_clock::now();
-  std::string delim = "/";
+void PcapLoader::BeginCache(SeriesCache& cache, const std::string& path, LoadTelemetry& telemetry){
+  // A capture in a read-only directory just won't get a cache
+  if (SeriesCache::Enabled() && !cache.Begin(path))
+    telemetry.Warn("Could not write " + SeriesCache::SidecarPath(path));
+}
+
+void PcapLoader::FinishCache(SeriesCache& cache, const std::string& path, LoadTelemetry& telemetry){
+  if (!cache.IsOpen())
+    return;
+  // The cache of a cancelled load would pass for the whole capture
+  if (telemetry.cancelled){
+    cache.Abort();
+    return;
+  }
+  auto scope = telemetry.Time("finish cache");
+  if (!cache.Finish())
+    telemetry.Warn("Could not write " + SeriesCache::SidecarPath(path));
+}
+
+bool PcapLoader::readDataFromFile_mulithread_old(PJ::FileLoadInfo* fileload_info, PlotDataMapRef& plot_data){
+  FieldTable field_table(&plot_data);
 
   // Load the pcap file
   const auto& path = fileload_info->filename.toStdString();
-  std::cout <<"File name: " <<  path << std::endl;
   // const bool file_exists = access(fileload_info->filename, 0) == 0;
-  pcpp::PcapFileReaderDevice reader(path);
-  if (!reader.open()) {
-    std::string m = "Could not open pcap file: {}"+ path;
-    throw std::runtime_error(m);
+  LoadTelemetry telemetry("PcapLoader", path);
+  DecodePipeline pipeline(field_table);
+  // Complete loads write the decoded cache as they go; filtered ones never begin it
+  SeriesCache cache;
+  auto writer = [&field_table, &plot_data, &telemetry, &cache](DecodedBatch& batch){
+    telemetry.AddBatch(batch, field_table);
+    {
+      auto scope = telemetry.Time("pipeline/transfer");
+      batch.store.TransferTo(field_table, plot_data);
+    }
+    if (cache.IsOpen()){
+      auto scope = telemetry.Time("pipeline/write cache");
+      cache.Write(batch.store, field_table);
+    }
+  };
+
+  // Workers count the packets they decode and a progress dialog samples the count, so nothing on the
+  // way prints or takes a lock. Cancelling keeps the packets up to where the load stopped.
+  LoadProgress progress;
+  pipeline.SetProgress(&progress);
+  std::unique_ptr<LoadProgressDialog> progress_dialog;
+  auto show_progress = [&progress, &progress_dialog, &pipeline, fileload_info](){
+    progress_dialog = LoadProgressDialog::Create(progress, "Loading " + fileload_info->filename);
+    if (progress_dialog)
+      pipeline.SetIdle(&LoadProgressDialog::ProcessEvents);
+  };
+
+  MmapPcapReader reader(path);
+  bool mapped;
+  // An index built by this load only covers the bytes mapped now, so it is stamped with the capture as
+  // it was opened. A capture that grew in between has a newer size, and its index is never saved.
+  uint64_t capture_size = 0;
+  int64_t capture_mtime_ns = -1;
+  {
+    auto scope = telemetry.Time("open");
+    mapped = reader.Open(MmapPcapReader::Access::Partitioned);
+    if (mapped && PcapIndex::CaptureStamp(path, capture_size, capture_mtime_ns))
+      capture_size = reader.FileSize();
   }
-  pcpp::RawPacket raw_packet; 
-  int i = 0;
-  elroy_common_msg::MsgDecoder decoder;
-
-  // We need to record pointers to each plot
-  std::map<QString, PlotData*> plots_map;
-  std::map<QString, PJ::StringSeries*> string_map;
-
-  // Schema for ip addresses
-  // std::map<std::string, std::string> ip_src_addr_to_folder_name;
-  // ip_src_addr_to_folder_name["172.16.17.11"] = "MfcA";
-  std::unordered_map<std::string, std::vector<std::variant<std::string, double, bool>>> map_of_vec;
-
-  while (reader.getNextPacket(raw_packet)){
-    auto maps = ParseOnePacketToMap(raw_packet);
-    for (auto& map : maps){
-      if(map.size() > 0){
-        std::string instance_key = "component" + delim + "instance"; 
-        std::string instance_id = "";
-        double instance_component = 0;
-        // Search for the instance ID string
-        for(auto it = map.begin(); it!= map.end(); ++it){
-          const std::string& key = it->first;
-          if(key.size() > instance_key.size() && key.compare(key.size() - instance_key.size(), instance_key.size(), instance_key) == 0 ){
-            instance_id = "_"+  std::to_string(static_cast<size_t>(std::get<double>(map[key])));
-          }
-        }
-        // Search for the timestamp
-        double timestamp = 0;
-        std::string timestamp_key = "BusObject" + delim + "write_timestamp_ns";
-        for(auto it = map.begin(); it!= map.end(); ++it){
-          const std::string& key = it->first;
-          if(key.size() > timestamp_key.size() && key.compare(key.size() - timestamp_key.size(), timestamp_key.size(), timestamp_key) == 0 ){
-            timestamp = std::get<double>(map[key]) / 1e9;
-          }
-        }
-        for (const auto& pair: map){
-          std::string field_name_str = pair.first;
-          field_name_str = field_name_str.insert(field_name_str.find(delim), "_"+instance_id);
-          // QString field_name = QString::fromStdString(pair.first);
-          QString field_name = QString::fromStdString(field_name_str);
-          // Add a new column to the plotter if it does not already exist
-          if ((std::holds_alternative<double>(pair.second) || std::holds_alternative<bool>(pair.second)) && plots_map.find(field_name) == plots_map.end()){
-            auto it = plot_data.addNumeric(field_name.toStdString());
-            plots_map[field_name] = (&(it->second));
-          }
-          else if (std::holds_alternative<std::string>(pair.second) && string_map.find(field_name) == string_map.end()){
-            auto it = plot_data.addStringSeries(field_name.toStdString());
-            string_map[field_name] = (&(it->second));
-          }
-          // std::cout << pair.first << std::endl;
-          if(std::holds_alternative<double>(pair.second)){
-            PlotData::Point point(timestamp, std::get<double>(pair.second));
-            plots_map[field_name]->pushBack(point);
-          }else if(std::holds_alternative<std::string>(pair.second)){
-            string_map[field_name]->pushBack({static_cast<double>(i), std::get<std::string>(pair.second)});
-            continue;
-          }
-        }
+  if (!mapped) {
+    // Not an uncompressed classic pcap: pcapng or compressed captures are streamed instead. They are
+    // never filtered, so all but the first load come out of the decoded cache.
+    if (!LoadCached(path, plot_data, telemetry)) {
+      StreamPcapReader stream_reader(ByteStream::Open(path));
+      if (!stream_reader.Open()) {
+        if (ByteStream::HasCompressedExtension(path))
+          throw std::runtime_error(path + " is not a compressed capture");
+        throw std::runtime_error("Could not open pcap file: " + path);
       }
-    }
-    
-    continue;
-
-    size_t current_index = 0;
-    i++;
-    // std::cout << "Parsing packet " << i << std::endl;
-    pcpp::Packet parsed_packet(&raw_packet);
-    const auto& ipv4_layer = parsed_packet.getLayerOfType<pcpp::IPv4Layer>();
-    const auto& udp_layer = parsed_packet.getLayerOfType<pcpp::UdpLayer>();
-    const auto& byte_array = udp_layer->getLayerPayload();
-    size_t byte_array_len = udp_layer->getLayerPayloadSize();
-    size_t bytes_processed = 0;
-
-    while (current_index < byte_array_len){
-      std::unordered_map<std::string, std::variant<std::string, double, bool>> map;
-      elroy_common_msg::MessageDecoderResult res;
-      std::string delim = "/";
-
-      // if (!decoder.DecodeAsMapOfArrays(byte_array + current_index , byte_array_len-current_index, bytes_processed, map_of_vec, res, delim))
-      //   break;
-      // current_index += bytes_processed;
-      // continue;
-      //decode as map without going to plotjuggler: 4.1s
-      //decode as map of arrays without going to plotjuggler: 0.11s -> WRONG this wasn't parsing anything. It actually takes longer
-      if (!decoder.DecodeAsMap(byte_array + current_index , byte_array_len-current_index, bytes_processed, map, res, delim))
-        break;
-      current_index += bytes_processed;
-      if(map.size() > 0){
-        // Find the timestamp, in BusObject/write_timestamp_ns
-        double timestamp = 0;
-        std::string timestamp_key = "BusObject" + delim + "write_timestamp_ns";
-        for(auto it = map.begin(); it!= map.end(); ++it){
-          const std::string& key = it->first;
-          if(key.size() > timestamp_key.size() && key.compare(key.size() - timestamp_key.size(), timestamp_key.size(), timestamp_key) == 0 ){
-            timestamp = std::get<double>(map[key]) / 1e9;
-          }
-        }
-        std::string instance_key = "component" + delim + "instance"; //"instance_str";
-        std::string instance_id = "";
-        double instance_component = 0;
-        for(auto it = map.begin(); it!= map.end(); ++it){
-          const std::string& key = it->first;
-          if(key.size() > instance_key.size() && key.compare(key.size() - instance_key.size(), instance_key.size(), instance_key) == 0 ){
-            // instance_id = "_"+  std::get<std::string>(map[key]);
-            instance_id = "_"+  std::to_string(static_cast<size_t>(std::get<double>(map[key])));
-          }
-        }
-        for (const auto& pair: map){
-          std::string field_name_str = pair.first;
-          field_name_str = field_name_str.insert(field_name_str.find(delim), "_"+instance_id);
-          // QString field_name = QString::fromStdString(pair.first);
-          QString field_name = QString::fromStdString(field_name_str);
-          // if (pair.first.find("VlThrusterState") != std::string::npos){
-          //   std::cout << pair.first << std::endl;
-          // }
-
-          // Add a new column to the plotter if it does not already exist
-          if ((std::holds_alternative<double>(pair.second) || std::holds_alternative<bool>(pair.second)) && plots_map.find(field_name) == plots_map.end()){
-            auto it = plot_data.addNumeric(field_name.toStdString());
-            plots_map[field_name] = (&(it->second));
-          }
-          else if (std::holds_alternative<std::string>(pair.second) && string_map.find(field_name) == string_map.end()){
-            auto it = plot_data.addStringSeries(field_name.toStdString());
-            string_map[field_name] = (&(it->second));
-          }
-          // std::cout << pair.first << std::endl;
-          if(std::holds_alternative<double>(pair.second)){
-            // std::cout << std::get<double>(pair.second) << std::endl;
-            // Get the timestamp from the udp packet. I might need to use the udp layer
-            PlotData::Point point(timestamp, std::get<double>(pair.second));
-            plots_map[field_name]->pushBack(point);
-          }else if(std::holds_alternative<std::string>(pair.second)){
-            // std::cout << std::get<std::string>(pair.second) << std::endl;
-            string_map[field_name]->pushBack({static_cast<double>(i), std::get<std::string>(pair.second)});
-            continue;
-          }
-        }
-        // break;
+      BeginCache(cache, path, telemetry);
+      // Streams have no known length, the dialog just shows that the load is busy
+      show_progress();
+      {
+        auto scope = telemetry.Time("pipeline");
+        ReadStream(stream_reader, pipeline, writer);
       }
+      progress_dialog.reset();
+      telemetry.cancelled = progress.Cancelled();
+      FinishCache(cache, path, telemetry);
     }
-    // CALLGRIND_TOGGLE_COLLECT;
-    // CALLGRIND_STOP_INSTRUMENTATION;
+    telemetry.Report(plot_data);
+    return true;
   }
+  _link_type = static_cast<pcpp::LinkLayerType>(reader.LinkType());
 
-  // Now that the map of vectors has been populated, for each key in that map copy the vector to plotjuggler
-  if(map_of_vec.size() > 0 && true){
-    for (const auto& pair: map_of_vec){
-      QString field_name = QString::fromStdString(pair.first);
-      if(pair.second.size() == 0)
-        continue;
-      // Add this field name to plotjuggler if it doesn't exist
-      if (std::holds_alternative<double>(pair.second[0]) && plots_map.find(field_name) == plots_map.end()){
-        auto it = plot_data.addNumeric(pair.first);
-        plots_map[field_name] = (&(it->second));
+  PcapIndex index;
+  bool indexed;
+  {
+    auto scope = telemetry.Time("load index");
+    indexed = index.Load(path) && index.LinkType() == reader.LinkType();
+  }
+  if (indexed){
+    RecordFilter filter;
+    bool lazy = false;
+    {
+      // Time spent on the dialogs is the user's, but it is part of the wall time of the load
+      auto scope = telemetry.Time("dialogs");
+      if (!AskForFilter(index, filter, lazy))
+        return false;
+    }
+    // A lazy load only decodes the message types picked from those in the index. The fields of the
+    // other types are added to the tree without samples once the load is done.
+    std::unique_ptr<FieldTable> scanned;
+    if (lazy){
+      scanned = std::make_unique<FieldTable>();
+      {
+        auto scope = telemetry.Time("scan message types");
+        ScanMessageTypes(reader, index, filter, *scanned);
       }
-      else if (std::holds_alternative<std::string>(pair.second[0]) && plots_map.find(field_name) == plots_map.end()){
-        auto it = plot_data.addStringSeries(pair.first);
-        string_map[field_name] = (&(it->second));
+      {
+        auto scope = telemetry.Time("dialogs");
+        MessageTypeDialog dialog(*scanned, "Taken from the capture's index.",
+                                 "PcapLoader");
+        if (dialog.exec() != QDialog::Accepted)
+          return false;
+        dialog.SaveSettings();
+        filter.message_types = dialog.MessageTypes();
       }
-      size_t i = 0;
-      for(const auto& value : pair.second){
-        ++i;
-        if(std::holds_alternative<double>(value)){
-            // Get the timestamp from the udp packet. I might need to use the udp layer
-            PlotData::Point point(i, std::get<double>(value));
-            plots_map[field_name]->pushBack(point);
-          }else if(std::holds_alternative<std::string>(value)){
-            // std::cout << std::get<std::string>(pair.second) << std::endl;
-            string_map[field_name]->pushBack({static_cast<double>(i), std::get<std::string>(value)});
-            continue;
-          }
+      if (filter.message_types.empty()){
+        scanned->CreateSeries(plot_data, [](const TableInfo&){ return true; });
+        telemetry.mode = "listed";
+        telemetry.Report(plot_data);
+        return true;
       }
     }
-  }else{
-    std::cout << "map of vec is empty" << std::endl;
+    if (filter.Empty() && LoadCached(path, plot_data, telemetry)){
+      telemetry.Report(plot_data);
+      return true;
+    }
+    if (filter.Empty())
+      BeginCache(cache, path, telemetry);
+    // Packets are dropped by address, port and message type using the index alone; within the packets
+    // that are left, messages of other types are dropped before they are stored
+    std::vector<size_t> selected;
+    {
+      auto scope = telemetry.Time("select");
+      selected = index.Select(filter);
+    }
+    pipeline.SetMessageTypes(filter.message_types);
+    pipeline.SetFieldSelection(FieldSelection(filter.field_patterns));
+    progress.SetTotal(selected.size());
+    show_progress();
+    {
+      auto scope = telemetry.Time("pipeline");
+      ReadIndexed(reader, index, selected, pipeline, writer);
+    }
+    progress_dialog.reset();
+    telemetry.cancelled = progress.Cancelled();
+    FinishCache(cache, path, telemetry);
+    if (scanned){
+      auto scope = telemetry.Time("list other types");
+      scanned->CreateSeries(plot_data, [&filter](const TableInfo& table){
+        return !MatchesMessageType(filter.message_types, table.name);
+      });
+    }
+  } else {
+    BeginCache(cache, path, telemetry);
+    show_progress();
+    {
+      auto scope = telemetry.Time("pipeline");
+      ReadAndIndex(reader, index, field_table, pipeline, progress, writer);
+    }
+    progress_dialog.reset();
+    telemetry.cancelled = progress.Cancelled();
+    FinishCache(cache, path, telemetry);
+    // The index of a cancelled load would miss the rest of the capture, and so would the index of a
+    // capture that is still being recorded. A capture in a read-only directory just won't get an index.
+    if (!telemetry.cancelled){
+      auto scope = telemetry.Time("save index");
+      if (!index.Save(path, capture_size, capture_mtime_ns))
+        telemetry.Warn("Could not write " + PcapIndex::SidecarPath(path));
+    }
   }
-  auto endTime = std::chrono::high_resolution_clock::now();
-  auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
-  std::cout << "Time taken by function: " << duration.count()/1000.0 << " seconds" << std::endl;
-  return true;                         
+  telemetry.Report(plot_data);
+  return true;
+}
+bool PcapLoader::readDataFromFile(PJ::FileLoadInfo* fileload_info,
+                        PlotDataMapRef& plot_data){
+  return PcapLoader::readDataFromFile_mulithread_old(fileload_info, plot_data);
 }
 
-// This is an example program that I'm using for development/debugging. Change the 
-// file_info.filename to a pcap file on your computer and run ~/build/PcapLoaderExec
-int main()
+// This is an example program that I'm using for development/debugging. Run ~/build/PcapLoaderExec
+// with a capture, e.g. one written by ecm_generator
+int main(int argc, char** argv)
 {
   PcapLoader pcap;
   PJ::FileLoadInfo file_info;
-  file_info.filename = QString::fromStdString("/home/mark/code2/fast_ecm_example.pcap");
+  file_info.filename = QString::fromStdString(argc > 1 ? argv[1] : "/home/mark/code2/fast_ecm_example.pcap");
   PlotDataMapRef plot_data;
   pcap.readDataFromFile(&file_info,plot_data);
 }
@@ -17,6 +17,17 @@
 #include "PcapFileDevice.h"
 #include "UdpLayer.h"
 
+#include "mmap_pcap_reader.h"
+#include "pcap_index.h"
+#include "stream_pcap_reader.h"
+#include "Common/decode_pipeline.h"
+#include "Common/ecm_decoder.h"
+#include "Common/load_progress.h"
+#include "Common/load_telemetry.h"
+#include "Common/record_filter.h"
+#include "Common/series_cache.h"
+#include "Common/series_store.h"
+
 using namespace PJ;
 
 // std::map<std::string, std::string> ip_addr_to_mfc{
@@ -33,29 +44,38 @@ public:
   virtual const std::vector<const char*>& compatibleFileExtensions() const override{
     return _extensions;
   };
-  std::vector<std::unordered_map<std::string, std::variant<std::string, double, bool>>> ParseOnePacketToMap(pcpp::RawPacket &packet, const std::string &delim = "/")const;
-  std::unordered_map<std::string, std::vector<std::variant<std::string, double, bool>>> ProcessPackets(std::vector<pcpp::RawPacket> &vec, size_t start_idx, size_t end_idx) const;
+  std::vector<std::unordered_map<std::string, std::variant<std::string, double, bool>>> ParseOnePacketToMap(const PcapPacketView &packet, const std::string &delim = "/")const;
+  // @brief Addresses of a UDP datagram, in host order. The IPs are 0 if the packet isn't IPv4.
+  struct UdpEndpoints {
+    uint32_t src_ip = 0;
+    uint32_t dst_ip = 0;
+    uint16_t src_port = 0;
+    uint16_t dst_port = 0;
+  };
+  // @brief Find the UDP payload of a packet, and its addresses if endpoints isn't null. Returns false if
+  // it isn't a UDP packet.
+  static bool UdpPayload(const PcapPacketView &packet, const uint8_t *&payload, size_t &payload_len,
+                         UdpEndpoints *endpoints = nullptr);
   
-  // @brief this is the entry point that plotjuggler will call. This function contains the single-threaded implementation
+  // @brief this is the entry point that plotjuggler will call. Loads through readDataFromFile_mulithread_old.
   bool readDataFromFile(PJ::FileLoadInfo* fileload_info,
                         PlotDataMapRef& destination) override;
 
-  // @brief This is the multithreaded implementation, converting each ECM into its own C++ map. Each key
-  // has exactly one value. This means the memory usage is way too high and this will only work for very
-  // small pcap files.
+  // @brief Decodes every packet into C++ maps, one per ECM message, on the shared ThreadPool, then writes
+  // the maps to plotjuggler on the calling thread. The maps of the whole capture are kept until then, so
+  // the memory usage is way too high and this will only work for very small pcap files.
   bool readDataFromFile_mulithread(PJ::FileLoadInfo* fileload_info,
                         PlotDataMapRef& destination);
 
-  // @brief This is the multithreaded implementation, converting ECMs into a C++ map, where the key is
-  // the field name and the value is a vector of the field's data. This means there is only one map and
-  // this uses significantly less memory than readDataFromFile_multithread                        
+  // @brief The implementation readDataFromFile uses: every DecodePipeline worker reads and decodes its
+  // own ranges of the capture. Each range is decoded into a columnar SeriesStore and bulk-transferred to
+  // plotjuggler in capture order, so this uses a fraction of the memory of readDataFromFile_mulithread.
+  // The first load of a capture writes a PcapIndex next to it; later loads ask which records to load and
+  // decode only those, straight from the index, on every worker. pcapng and compressed captures are
+  // streamed through a single reader thread instead. Complete loads write and use the SeriesCache.
   bool readDataFromFile_mulithread_old(PJ::FileLoadInfo* fileload_info,
                         PlotDataMapRef& destination);
 
-  // @brief An attempt to use std::transform for multiprocessing but I couldn't get this to work.                   
-  bool readDataFromFile_transform(PJ::FileLoadInfo* fileload_info,
-                        PlotDataMapRef& destination);                      
-
   ~PcapLoader() override = default;
 
   virtual const char* name() const override
@@ -68,7 +88,40 @@ protected:
   QSize parseHeader(QFile* file, std::vector<std::string>& ordered_names);
 
 private:
+  // @brief Ask the user which part of the capture to load, and whether to load it lazily. Returns false
+  // if the load was cancelled.
+  bool AskForFilter(const PcapIndex& index, RecordFilter& filter, bool& lazy);
+  // @brief Decode one packet of every message type in index into scanned, to find the fields of each
+  void ScanMessageTypes(const MmapPcapReader& reader, const PcapIndex& index, const RecordFilter& filter,
+                        FieldTable& scanned);
+
+  // @brief Decode the selected entries of index, read in place from the mapped capture
+  void ReadIndexed(const MmapPcapReader& reader, const PcapIndex& index, const std::vector<size_t>& selected,
+                   DecodePipeline& pipeline, const DecodePipeline::Writer& writer);
+
+  // @brief Decode a pcapng or compressed capture, which can't be indexed or split
+  void ReadStream(StreamPcapReader& reader, DecodePipeline& pipeline, const DecodePipeline::Writer& writer);
+
+  // @brief Decode the whole capture, filling index on the way. Sets the total of progress once the
+  // capture is cut into ranges.
+  void ReadAndIndex(const MmapPcapReader& reader, PcapIndex& index, FieldTable& field_table,
+                    DecodePipeline& pipeline, LoadProgress& progress, const DecodePipeline::Writer& writer);
+
+  // @brief Push the decoded cache of path into plot_data. Returns false if caching is off or there is no
+  // valid cache.
+  bool LoadCached(const std::string& path, PlotDataMapRef& plot_data, LoadTelemetry& telemetry);
+  void BeginCache(SeriesCache& cache, const std::string& path, LoadTelemetry& telemetry);
+  void FinishCache(SeriesCache& cache, const std::string& path, LoadTelemetry& telemetry);
+
+  // Number of packets per ThreadPool task or DecodePipeline batch. Small enough that a few batches of
+  // large multi-message datagrams can't leave the other workers idle.
+  static constexpr size_t kPacketBatchSize = 256;
+
   std::vector<const char*> _extensions;
 
   std::string _default_time_axis;
+
+  // Link type of the capture being loaded, used by the single threaded implementation. Everything else
+  // takes it from PcapPacketView::link_type.
+  pcpp::LinkLayerType _link_type = pcpp::LINKTYPE_ETHERNET;
 };
@@ -0,0 +1,241 @@
+#include "stream_pcap_reader.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace {
+constexpr uint32_t kMagicMicro = 0xa1b2c3d4;
+constexpr uint32_t kMagicNano = 0xa1b23c4d;
+
+constexpr uint32_t kSectionHeaderBlock = 0x0a0d0d0a;
+constexpr uint32_t kInterfaceBlock = 1;
+constexpr uint32_t kObsoletePacketBlock = 2;
+constexpr uint32_t kSimplePacketBlock = 3;
+constexpr uint32_t kEnhancedPacketBlock = 6;
+constexpr uint32_t kByteOrderMagic = 0x1a2b3c4d;
+constexpr uint16_t kOptionEnd = 0;
+constexpr uint16_t kOptionTsResolution = 9;
+
+constexpr size_t kClassicHeaderSize = 24;
+constexpr size_t kClassicRecordHeaderSize = 16;
+// Block type and total length before the body, total length again after it
+constexpr size_t kBlockOverhead = 12;
+
+uint32_t ByteSwap32(uint32_t v) {
+  return ((v & 0xff) << 24) | ((v & 0xff00) << 8) | ((v >> 8) & 0xff00) | (v >> 24);
+}
+
+uint16_t ByteSwap16(uint16_t v) {
+  return static_cast<uint16_t>((v << 8) | (v >> 8));
+}
+
+// Seconds since the epoch of a timestamp counted in units of 1 / ticks_per_second
+double TicksToSeconds(uint64_t ticks, uint64_t ticks_per_second) {
+  return static_cast<double>(ticks / ticks_per_second) +
+         static_cast<double>(ticks % ticks_per_second) / static_cast<double>(ticks_per_second);
+}
+}  // namespace
+
+StreamPcapReader::StreamPcapReader(std::unique_ptr<ByteStream> stream) : _stream(std::move(stream)) {}
+
+bool StreamPcapReader::Fill(size_t n) {
+  if (_end - _pos >= n)
+    return true;
+  if (n > kMaxRecordSize)
+    throw std::runtime_error("Corrupt capture: record of " + std::to_string(n) + " bytes");
+  // Move what is left to the front, so the buffer only ever holds about one read
+  if (_pos > 0) {
+    std::memmove(_buffer.data(), _buffer.data() + _pos, _end - _pos);
+    _buffer_offset += _pos;
+    _end -= _pos;
+    _pos = 0;
+  }
+  if (_buffer.size() < n + kReadSize)
+    _buffer.resize(n + kReadSize);
+  while (_end < n) {
+    const size_t read = _stream->Read(_buffer.data() + _end, _buffer.size() - _end);
+    if (read == 0)
+      return false;
+    _end += read;
+  }
+  return true;
+}
+
+uint16_t StreamPcapReader::ReadU16(const uint8_t* p) const {
+  uint16_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return _swapped ? ByteSwap16(v) : v;
+}
+
+uint32_t StreamPcapReader::ReadU32(const uint8_t* p) const {
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return _swapped ? ByteSwap32(v) : v;
+}
+
+bool StreamPcapReader::Open() {
+  if (!Fill(4))
+    return false;
+  uint32_t magic;
+  std::memcpy(&magic, _buffer.data() + _pos, sizeof(magic));
+  if (magic == kSectionHeaderBlock) {
+    _pcapng = true;
+    return ReadSectionHeader();
+  }
+
+  if (magic == kMagicMicro || magic == kMagicNano) {
+    _swapped = false;
+  } else if (ByteSwap32(magic) == kMagicMicro || ByteSwap32(magic) == kMagicNano) {
+    _swapped = true;
+    magic = ByteSwap32(magic);
+  } else {
+    return false;
+  }
+  if (!Fill(kClassicHeaderSize))
+    return false;
+  _nanosecond = magic == kMagicNano;
+  _link_type = ReadU32(_buffer.data() + _pos + 20);
+  _pos += kClassicHeaderSize;
+  return true;
+}
+
+bool StreamPcapReader::GetNextPacket(PcapPacketView& packet) {
+  return _pcapng ? NextPcapng(packet) : NextClassic(packet);
+}
+
+bool StreamPcapReader::NextClassic(PcapPacketView& packet) {
+  if (!Fill(kClassicRecordHeaderSize))
+    return false;
+  const uint32_t captured_len = ReadU32(_buffer.data() + _pos + 8);
+  if (!Fill(kClassicRecordHeaderSize + captured_len))
+    return false;
+  const uint8_t* header = _buffer.data() + _pos;
+  packet.data = header + kClassicRecordHeaderSize;
+  packet.captured_len = captured_len;
+  packet.original_len = ReadU32(header + 12);
+  packet.capture_ts = ReadU32(header) + ReadU32(header + 4) * (_nanosecond ? 1e-9 : 1e-6);
+  packet.offset = _buffer_offset + _pos;
+  packet.link_type = _link_type;
+  _pos += kClassicRecordHeaderSize + captured_len;
+  return true;
+}
+
+bool StreamPcapReader::ReadSectionHeader() {
+  // The byte order of a section is only known from the magic inside its header
+  if (!Fill(kBlockOverhead))
+    return false;
+  uint32_t byte_order;
+  std::memcpy(&byte_order, _buffer.data() + _pos + 8, sizeof(byte_order));
+  if (byte_order == kByteOrderMagic)
+    _swapped = false;
+  else if (ByteSwap32(byte_order) == kByteOrderMagic)
+    _swapped = true;
+  else
+    return false;
+  const uint32_t block_len = ReadU32(_buffer.data() + _pos + 4);
+  if (block_len < kBlockOverhead + 16 || block_len % 4 != 0)
+    throw std::runtime_error("Corrupt pcapng section header");
+  if (!Fill(block_len))
+    return false;
+  // Interfaces are numbered per section
+  _interfaces.clear();
+  _pos += block_len;
+  return true;
+}
+
+void StreamPcapReader::ReadInterface(const uint8_t* block, uint32_t block_len) {
+  if (block_len < kBlockOverhead + 8)
+    throw std::runtime_error("Corrupt pcapng interface description");
+  Interface interface{ReadU16(block + 8), ReadU32(block + 12), 1000000};
+  // Options run from after the fixed fields to the trailing length
+  const uint8_t* option = block + 16;
+  const uint8_t* options_end = block + block_len - 4;
+  while (option + 4 <= options_end) {
+    const uint16_t code = ReadU16(option);
+    const uint16_t length = ReadU16(option + 2);
+    if (code == kOptionEnd || option + 4 + length > options_end)
+      break;
+    if (code == kOptionTsResolution && length >= 1) {
+      // High bit set: a negative power of 2, otherwise a negative power of 10
+      const uint8_t resolution = option[4];
+      const uint8_t exponent = resolution & 0x7f;
+      if (resolution & 0x80) {
+        if (exponent < 64)
+          interface.ticks_per_second = uint64_t(1) << exponent;
+      } else if (exponent <= 19) {
+        interface.ticks_per_second = 1;
+        for (uint8_t i = 0; i < exponent; ++i)
+          interface.ticks_per_second *= 10;
+      }
+    }
+    option += 4 + ((length + 3) & ~3u);
+  }
+  _interfaces.push_back(interface);
+}
+
+bool StreamPcapReader::NextPcapng(PcapPacketView& packet) {
+  while (true) {
+    if (!Fill(8))
+      return false;
+    uint32_t block_type;
+    std::memcpy(&block_type, _buffer.data() + _pos, sizeof(block_type));
+    if (block_type == kSectionHeaderBlock) {
+      if (!ReadSectionHeader())
+        return false;
+      continue;
+    }
+    block_type = ReadU32(_buffer.data() + _pos);
+    const uint32_t block_len = ReadU32(_buffer.data() + _pos + 4);
+    if (block_len < kBlockOverhead || block_len % 4 != 0)
+      throw std::runtime_error("Corrupt pcapng block at offset " + std::to_string(_buffer_offset + _pos));
+    if (!Fill(block_len))
+      return false;
+    const uint8_t* block = _buffer.data() + _pos;
+    const uint64_t offset = _buffer_offset + _pos;
+    _pos += block_len;
+
+    // Packet blocks fill these, every other block is skipped
+    uint32_t interface_id = 0;
+    uint64_t ticks = 0;
+    size_t data_offset;
+    uint32_t captured_len;
+    uint32_t original_len;
+    if (block_type == kInterfaceBlock) {
+      ReadInterface(block, block_len);
+      continue;
+    } else if (block_type == kEnhancedPacketBlock && block_len >= kBlockOverhead + 20) {
+      interface_id = ReadU32(block + 8);
+      ticks = (uint64_t(ReadU32(block + 12)) << 32) | ReadU32(block + 16);
+      captured_len = ReadU32(block + 20);
+      original_len = ReadU32(block + 24);
+      data_offset = 28;
+    } else if (block_type == kObsoletePacketBlock && block_len >= kBlockOverhead + 20) {
+      interface_id = ReadU16(block + 8);
+      ticks = (uint64_t(ReadU32(block + 12)) << 32) | ReadU32(block + 16);
+      captured_len = ReadU32(block + 20);
+      original_len = ReadU32(block + 24);
+      data_offset = 28;
+    } else if (block_type == kSimplePacketBlock && block_len >= kBlockOverhead + 4) {
+      // No timestamp, and the captured length is implied by the block length and snap length
+      original_len = ReadU32(block + 8);
+      captured_len = original_len;
+      data_offset = 12;
+      if (!_interfaces.empty() && _interfaces[0].snap_len != 0 && captured_len > _interfaces[0].snap_len)
+        captured_len = _interfaces[0].snap_len;
+    } else {
+      continue;
+    }
+    if (interface_id >= _interfaces.size() || data_offset + captured_len > block_len - 4)
+      throw std::runtime_error("Corrupt pcapng packet at offset " + std::to_string(offset));
+
+    const Interface& interface = _interfaces[interface_id];
+    packet.data = block + data_offset;
+    packet.captured_len = captured_len;
+    packet.original_len = original_len;
+    packet.capture_ts = TicksToSeconds(ticks, interface.ticks_per_second);
+    packet.offset = offset;
+    packet.link_type = interface.link_type;
+    return true;
+  }
+}
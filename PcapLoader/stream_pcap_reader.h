@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "byte_stream.h"
+#include "mmap_pcap_reader.h"
+
+// @brief Reads a classic pcap or a pcapng capture from a ByteStream, for the captures MmapPcapReader
+// can't map: pcapng files and compressed captures. Records are read into an internal buffer, so the
+// data of a packet is only valid until the next call to GetNextPacket, and PcapPacketView::offset is
+// the offset in the uncompressed stream. Throws std::runtime_error on a corrupt capture.
+class StreamPcapReader
+{
+public:
+  explicit StreamPcapReader(std::unique_ptr<ByteStream> stream);
+
+  // @brief Read the file header. Returns false if the stream is neither a pcap nor a pcapng capture.
+  bool Open();
+
+  // @brief Fill packet with the next record. Returns false at the end of the stream or if it ends in
+  // the middle of a record (e.g. a capture that is still being written).
+  bool GetNextPacket(PcapPacketView& packet);
+
+  bool IsPcapng() const { return _pcapng; }
+
+private:
+  // pcapng interface, from an Interface Description Block
+  struct Interface {
+    uint32_t link_type;
+    uint32_t snap_len;
+    // Timestamp units per second, from the if_tsresol option
+    uint64_t ticks_per_second;
+  };
+
+  // Refuse records larger than this instead of trying to buffer a corrupt length
+  static constexpr size_t kMaxRecordSize = size_t(64) << 20;
+  static constexpr size_t kReadSize = size_t(1) << 20;
+
+  // @brief Make n bytes available at _buffer[_pos]. Returns false if the stream ends first.
+  bool Fill(size_t n);
+  uint16_t ReadU16(const uint8_t* p) const;
+  uint32_t ReadU32(const uint8_t* p) const;
+
+  bool NextClassic(PcapPacketView& packet);
+  bool NextPcapng(PcapPacketView& packet);
+  // @brief Parse the section header block at _buffer[_pos]. Returns false if it isn't one.
+  bool ReadSectionHeader();
+  void ReadInterface(const uint8_t* block, uint32_t block_len);
+
+  std::unique_ptr<ByteStream> _stream;
+  std::vector<uint8_t> _buffer;
+  size_t _pos = 0;
+  size_t _end = 0;
+  // Stream offset of _buffer[0]
+  uint64_t _buffer_offset = 0;
+
+  bool _pcapng = false;
+  bool _swapped = false;
+  bool _nanosecond = false;
+  uint32_t _link_type = 0;
+  std::vector<Interface> _interfaces;
+};
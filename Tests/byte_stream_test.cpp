@@ -0,0 +1,145 @@
+// Round trip of a capture through zstd: every packet and byte of the uncompressed capture has to come
+// back out of the compressed one. The capture is several times larger than StreamPcapReader's reads
+// and the DStream's output buffer, and small reads leave the end of the frame buffered in the DStream
+// once its input is used up. Any other file compressed with zstd, which the loaders accept by its .zst
+// suffix alone, has to be turned down once its header is inflated.
+#include <zstd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "PcapLoader/byte_stream.h"
+#include "PcapLoader/mmap_pcap_reader.h"
+#include "PcapLoader/stream_pcap_reader.h"
+
+namespace {
+constexpr size_t kPackets = 40000;
+constexpr size_t kPayloadSize = 200;
+
+int failures = 0;
+
+void Check(bool ok, const std::string& what) {
+  if (!ok) {
+    std::cout << "FAILED: " << what << std::endl;
+    ++failures;
+  }
+}
+
+// @brief Classic pcap of Ethernet/IPv4/UDP frames with payloads that don't compress to nothing
+void WriteCapture(const std::string& path) {
+  std::ofstream out(path, std::ios::binary);
+  const uint32_t header[6] = {0xa1b2c3d4, 2 | (4u << 16), 0, 0, 65535, 1};
+  out.write(reinterpret_cast<const char*>(header), sizeof(header));
+  std::vector<uint8_t> frame(14 + 20 + 8 + kPayloadSize, 0);
+  frame[12] = 0x08;
+  uint8_t* ip = frame.data() + 14;
+  ip[0] = 0x45;
+  ip[2] = static_cast<uint8_t>((20 + 8 + kPayloadSize) >> 8);
+  ip[3] = static_cast<uint8_t>(20 + 8 + kPayloadSize);
+  ip[8] = 64;
+  ip[9] = 17;
+  uint8_t* udp = ip + 20;
+  udp[4] = static_cast<uint8_t>((8 + kPayloadSize) >> 8);
+  udp[5] = static_cast<uint8_t>(8 + kPayloadSize);
+  uint32_t state = 1;
+  for (size_t i = 0; i < kPackets; ++i) {
+    for (size_t j = 0; j < kPayloadSize; ++j) {
+      state = state * 1664525u + 1013904223u;
+      udp[8 + j] = static_cast<uint8_t>(state >> 24);
+    }
+    const uint32_t record[4] = {1700000000u + static_cast<uint32_t>(i / 1000), static_cast<uint32_t>(i % 1000),
+                                static_cast<uint32_t>(frame.size()), static_cast<uint32_t>(frame.size())};
+    out.write(reinterpret_cast<const char*>(record), sizeof(record));
+    out.write(reinterpret_cast<const char*>(frame.data()), static_cast<std::streamsize>(frame.size()));
+  }
+}
+
+// @brief Compress path into a single zstd frame, like `zstd file.pcap`
+void CompressFile(const std::string& path, const std::string& zst_path) {
+  std::ifstream in(path, std::ios::binary);
+  const std::vector<char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  std::vector<char> compressed(ZSTD_compressBound(data.size()));
+  const size_t size = ZSTD_compress(compressed.data(), compressed.size(), data.data(), data.size(), 3);
+  Check(!ZSTD_isError(size), "compress the capture");
+  std::ofstream out(zst_path, std::ios::binary);
+  out.write(compressed.data(), static_cast<std::streamsize>(size));
+}
+
+size_t CountMapped(const std::string& path) {
+  MmapPcapReader reader(path);
+  Check(reader.Open(), "map " + path);
+  PcapPacketView packet;
+  size_t n = 0;
+  while (reader.GetNextPacket(packet))
+    ++n;
+  return n;
+}
+
+size_t CountStreamed(const std::string& path) {
+  StreamPcapReader reader(ByteStream::Open(path));
+  Check(reader.Open(), "open " + path);
+  PcapPacketView packet;
+  size_t n = 0;
+  while (reader.GetNextPacket(packet))
+    ++n;
+  return n;
+}
+// @brief Bytes read from path in reads of chunk bytes. Reads smaller than a zstd block leave the rest
+// of the block in the DStream.
+size_t CountBytes(const std::string& path, size_t chunk) {
+  auto stream = ByteStream::Open(path);
+  std::vector<uint8_t> buf(chunk);
+  size_t n = 0;
+  while (const size_t read = stream->Read(buf.data(), buf.size()))
+    n += read;
+  return n;
+}
+}  // namespace
+
+int main() {
+  const std::string path = "/tmp/byte_stream_test_" + std::to_string(getpid()) + ".pcap";
+  const std::string zst_path = path + ".zst";
+  WriteCapture(path);
+  CompressFile(path, zst_path);
+
+  const size_t n_uncompressed = CountMapped(path);
+  const size_t n_zstd = CountStreamed(zst_path);
+  Check(n_uncompressed == kPackets, "uncompressed capture has " + std::to_string(n_uncompressed) + " packets");
+  Check(n_zstd == n_uncompressed, "zstd capture has " + std::to_string(n_zstd) + " of " +
+                                  std::to_string(n_uncompressed) + " packets");
+  std::ifstream in(path, std::ios::binary | std::ios::ate);
+  const size_t size = static_cast<size_t>(in.tellg());
+  for (size_t chunk : {size_t(1000), size_t(4096), size_t(1) << 20}) {
+    const size_t n_bytes = CountBytes(zst_path, chunk);
+    Check(n_bytes == size, "read " + std::to_string(n_bytes) + " of " + std::to_string(size) + " bytes in chunks of " +
+                           std::to_string(chunk));
+  }
+
+  // Not a capture once inflated
+  const std::string text_path = "/tmp/byte_stream_test_" + std::to_string(getpid()) + ".csv";
+  const std::string text_zst_path = text_path + ".zst";
+  {
+    std::ofstream out(text_path);
+    for (size_t i = 0; i < 1000; ++i)
+      out << i << "," << i * 2 << "\n";
+  }
+  CompressFile(text_path, text_zst_path);
+  Check(ByteStream::HasCompressedExtension(text_zst_path) && !ByteStream::HasCompressedExtension(text_path),
+        "name a compressed file by its suffix");
+  StreamPcapReader text_reader(ByteStream::Open(text_zst_path));
+  Check(!text_reader.Open(), "turn down a compressed file that isn't a capture");
+
+  std::remove(path.c_str());
+  std::remove(zst_path.c_str());
+  std::remove(text_path.c_str());
+  std::remove(text_zst_path.c_str());
+  return failures == 0 ? 0 : 1;
+}
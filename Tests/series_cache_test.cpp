@@ -0,0 +1,138 @@
+// A decoded cache is only used by a build that decodes to the same series: one written with another
+// DecoderVersion(), e.g. by a build against another elroy_common_msg schema, has to be ignored and
+// leave the destination untouched, so the load falls back to decoding. Rows where a field had no value
+// must not become samples, whether the series come from the store or from the cache.
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "Common/field_table.h"
+#include "Common/series_cache.h"
+#include "Common/series_store.h"
+
+namespace {
+constexpr size_t kRows = 100;
+// Only every third row has a value for /armed
+constexpr size_t kArmedRows = (kRows + 2) / 3;
+constexpr size_t kPoints = 2 * kRows + kArmedRows;
+
+int failures = 0;
+
+void Check(bool ok, const std::string& what) {
+  if (!ok) {
+    std::cout << "FAILED: " << what << std::endl;
+    ++failures;
+  }
+}
+
+std::vector<char> ReadFile(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  return std::vector<char>((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+void WriteFile(const std::string& path, const std::vector<char>& data) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(data.data(), static_cast<std::streamsize>(data.size()));
+}
+
+// @brief Number of points of the numeric series whose name ends with suffix
+size_t NumPoints(const PJ::PlotDataMapRef& plot_data, const std::string& suffix) {
+  for (const auto& pair : plot_data.numeric) {
+    const std::string& name = pair.first;
+    if (name.size() >= suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0)
+      return pair.second.size();
+  }
+  return 0;
+}
+
+// @brief One table with a numeric, a string and a sparse bool field
+void FillStore(FieldTable& fields, SeriesStore& store) {
+  const TableInfo& table = fields.InternTable("VlThrusterState__2");
+  const FieldInfo& rpm = fields.InternField(table.id, "/rpm", FieldType::Double);
+  const FieldInfo& mode = fields.InternField(table.id, "/mode", FieldType::String);
+  const FieldInfo& armed = fields.InternField(table.id, "/armed", FieldType::Bool);
+  for (size_t i = 0; i < kRows; ++i) {
+    store.BeginRow(table.id, static_cast<double>(i) / 10);
+    store.Column(rpm).AppendDouble(static_cast<double>(i) * 3);
+    store.Column(mode).AppendString(i % 2 == 0 ? "idle" : "spin");
+    if (i % 3 == 0)
+      store.Column(armed).AppendBool(true);
+    store.EndRow(table.id);
+  }
+}
+
+// @brief Cache the store of FillStore for source
+bool WriteCache(const std::string& source) {
+  FieldTable fields;
+  SeriesStore store;
+  FillStore(fields, store);
+  SeriesCache cache;
+  if (!cache.Begin(source))
+    return false;
+  cache.Write(store, fields);
+  return cache.Finish();
+}
+
+// @brief Load the cache of source into a fresh map, returning the number of points loaded or -1
+long LoadCache(const std::string& source, size_t& n_series, size_t* n_armed = nullptr) {
+  PJ::PlotDataMapRef plot_data;
+  size_t n_points = 0;
+  const bool loaded = SeriesCache::Load(source, plot_data, &n_points);
+  n_series = plot_data.numeric.size() + plot_data.strings.size();
+  if (n_armed != nullptr)
+    *n_armed = NumPoints(plot_data, "/armed");
+  return loaded ? static_cast<long>(n_points) : -1;
+}
+}  // namespace
+
+int main() {
+  const std::string source = "/tmp/series_cache_test_" + std::to_string(getpid()) + ".elroy_log";
+  const std::string cache_path = SeriesCache::SidecarPath(source);
+  WriteFile(source, std::vector<char>(4096, 'x'));
+
+  {
+    FieldTable fields;
+    SeriesStore store;
+    FillStore(fields, store);
+    PJ::PlotDataMapRef plot_data;
+    store.TransferTo(fields, plot_data);
+    Check(NumPoints(plot_data, "/rpm") == kRows, "transfer every row of a complete column");
+    Check(NumPoints(plot_data, "/armed") == kArmedRows, "transfer only the rows that have a value");
+  }
+
+  Check(WriteCache(source), "write the cache");
+  size_t n_series = 0;
+  size_t n_armed = 0;
+  Check(LoadCache(source, n_series, &n_armed) == static_cast<long>(kPoints) && n_series == 3,
+        "load the cache written by this build");
+  Check(n_armed == kArmedRows, "load only the cached rows that have a value");
+
+  // Stand in for a build with another schema: rewrite the decoder version stored in the header
+  const uint64_t version = SeriesCache::DecoderVersion();
+  std::vector<char> data = ReadFile(cache_path);
+  const auto it = std::search(data.begin(), data.end(), reinterpret_cast<const char*>(&version),
+                              reinterpret_cast<const char*>(&version) + sizeof(version));
+  Check(it != data.end(), "find the decoder version in the cache");
+  if (it != data.end()) {
+    const uint64_t other = version ^ 1;
+    std::memcpy(&*it, &other, sizeof(other));
+    WriteFile(cache_path, data);
+    Check(LoadCache(source, n_series) == -1, "reject a cache of another decoder version");
+    Check(n_series == 0, "leave the series alone when the cache is rejected");
+  }
+
+  // A build with the same schema gets the same version
+  Check(SeriesCache::DecoderVersion() == version, "decoder version is stable");
+
+  std::remove(cache_path.c_str());
+  std::remove(source.c_str());
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,54 @@
+#include "stream_settings_dialog.h"
+
+#include <QDialogButtonBox>
+#include <QFormLayout>
+#include <QSettings>
+#include <QVBoxLayout>
+
+StreamSettingsDialog::StreamSettingsDialog(QWidget* parent) : QDialog(parent) {
+  setWindowTitle("Listen for ECM traffic");
+  QSettings settings;
+
+  _address = new QLineEdit(this);
+  _address->setToolTip("Local address to listen on (0.0.0.0 for all, 127.0.0.1 for loopback) or a multicast "
+                       "group to join, e.g. 239.1.1.1");
+  _address->setText(settings.value("UdpStreamer/address", "0.0.0.0").toString());
+
+  _port = new QSpinBox(this);
+  _port->setRange(1, 65535);
+  _port->setValue(settings.value("UdpStreamer/port", 5000).toInt());
+
+  _interface_address = new QLineEdit(this);
+  _interface_address->setToolTip("Address of the local interface to join a multicast group on, 0.0.0.0 for the "
+                                 "default interface");
+  _interface_address->setText(settings.value("UdpStreamer/interface_address", "0.0.0.0").toString());
+
+  auto form = new QFormLayout();
+  form->addRow("Address", _address);
+  form->addRow("Port", _port);
+  form->addRow("Multicast interface", _interface_address);
+
+  auto buttons = new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel, this);
+  connect(buttons, &QDialogButtonBox::accepted, this, &QDialog::accept);
+  connect(buttons, &QDialogButtonBox::rejected, this, &QDialog::reject);
+
+  auto layout = new QVBoxLayout(this);
+  layout->addLayout(form);
+  layout->addWidget(buttons);
+  setLayout(layout);
+}
+
+StreamSettings StreamSettingsDialog::Settings() const {
+  StreamSettings stream_settings;
+  stream_settings.address = _address->text().trimmed().toStdString();
+  stream_settings.port = static_cast<uint16_t>(_port->value());
+  stream_settings.interface_address = _interface_address->text().trimmed().toStdString();
+  return stream_settings;
+}
+
+void StreamSettingsDialog::SaveSettings() const {
+  QSettings settings;
+  settings.setValue("UdpStreamer/address", _address->text());
+  settings.setValue("UdpStreamer/port", _port->value());
+  settings.setValue("UdpStreamer/interface_address", _interface_address->text());
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <QDialog>
+#include <QLineEdit>
+#include <QSpinBox>
+
+#include <cstdint>
+#include <string>
+
+// @brief Where UdpStreamer listens
+struct StreamSettings {
+  // Local address to bind, or a multicast group to join
+  std::string address = "0.0.0.0";
+  uint16_t port = 0;
+  // Local interface address to join a multicast group on
+  std::string interface_address = "0.0.0.0";
+};
+
+// @brief Asks where to listen for ECM traffic. The choices are remembered for the next start.
+class StreamSettingsDialog : public QDialog
+{
+public:
+  explicit StreamSettingsDialog(QWidget* parent = nullptr);
+
+  StreamSettings Settings() const;
+
+  // @brief Remember the current choices in QSettings
+  void SaveSettings() const;
+
+private:
+  QLineEdit* _address;
+  QSpinBox* _port;
+  QLineEdit* _interface_address;
+};
@@ -0,0 +1,174 @@
+#include "udp_streamer.h"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <netinet/in.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "Common/decode_sink.h"
+#include "Common/ecm_decoder.h"
+#include "Common/series_store.h"
+
+namespace {
+double Now() {
+  return std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+in_addr ParseAddress(const std::string& address) {
+  in_addr addr;
+  if (inet_pton(AF_INET, address.c_str(), &addr) != 1)
+    throw std::runtime_error("Not an IPv4 address: " + address);
+  return addr;
+}
+}  // namespace
+
+UdpStreamer::UdpStreamer() = default;
+
+UdpStreamer::~UdpStreamer() {
+  shutdown();
+}
+
+bool UdpStreamer::start(QStringList*){
+  StreamSettingsDialog dialog;
+  if (dialog.exec() != QDialog::Accepted)
+    return false;
+  dialog.SaveSettings();
+  Start(dialog.Settings());
+  return true;
+}
+
+int UdpStreamer::OpenSocket(const StreamSettings& settings){
+  const in_addr address = ParseAddress(settings.address);
+  const bool multicast = IN_MULTICAST(ntohl(address.s_addr));
+
+  const int fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0)
+    throw std::runtime_error(std::string("Could not create socket: ") + std::strerror(errno));
+  auto fail = [fd](const std::string& what){
+    const std::string message = what + ": " + std::strerror(errno);
+    ::close(fd);
+    throw std::runtime_error(message);
+  };
+
+  // A large socket buffer absorbs bursts while the receiver thread is descheduled. The kernel caps it
+  // at net.core.rmem_max.
+  const int buffer_size = kSocketBufferSize;
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+  // Let other listeners (e.g. a second plotjuggler) join the same group
+  const int reuse = 1;
+  if (multicast)
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  // Wake up regularly so shutdown() doesn't wait for traffic
+  timeval timeout{0, 100000};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  sockaddr_in bind_address{};
+  bind_address.sin_family = AF_INET;
+  bind_address.sin_port = htons(settings.port);
+  bind_address.sin_addr.s_addr = multicast ? htonl(INADDR_ANY) : address.s_addr;
+  if (::bind(fd, reinterpret_cast<const sockaddr*>(&bind_address), sizeof(bind_address)) != 0)
+    fail("Could not bind to " + settings.address + ":" + std::to_string(settings.port));
+
+  if (multicast){
+    ip_mreq membership{};
+    membership.imr_multiaddr = address;
+    membership.imr_interface = ParseAddress(settings.interface_address);
+    if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) != 0)
+      fail("Could not join multicast group " + settings.address);
+  }
+  return fd;
+}
+
+void UdpStreamer::Start(const StreamSettings& settings){
+  shutdown();
+  _socket = OpenSocket(settings);
+  _ring = std::make_unique<SpscByteRing>(kRingSize);
+  _field_table = std::make_unique<FieldTable>();
+  _n_received = 0;
+  _n_dropped = 0;
+  _running = true;
+  _receiver = std::thread(&UdpStreamer::ReceiveLoop, this);
+  _decoder = std::thread(&UdpStreamer::DecodeLoop, this);
+}
+
+void UdpStreamer::shutdown(){
+  _running = false;
+  if (_receiver.joinable())
+    _receiver.join();
+  if (_decoder.joinable())
+    _decoder.join();
+  if (_socket >= 0){
+    ::close(_socket);
+    _socket = -1;
+  }
+}
+
+void UdpStreamer::ReceiveLoop(){
+  std::vector<uint8_t> scratch(kMaxDatagramSize);
+  while (_running){
+    // Receive straight into the ring. If the decoder has fallen that far behind, the datagram still
+    // has to be read to keep the socket drained, but it is dropped.
+    uint8_t* slot = _ring->BeginWrite(kMaxDatagramSize);
+    const ssize_t n = ::recv(_socket, slot != nullptr ? slot : scratch.data(), kMaxDatagramSize, 0);
+    if (n < 0)
+      continue;
+    ++_n_received;
+    if (slot == nullptr){
+      ++_n_dropped;
+      continue;
+    }
+    _ring->CommitWrite(static_cast<size_t>(n));
+  }
+}
+
+void UdpStreamer::DecodeLoop(){
+  EcmDecoder decoder(*_field_table);
+  SeriesStore store;
+  SeriesStoreSink sink(store);
+  auto last_publish = std::chrono::steady_clock::now();
+  while (_running){
+    const uint8_t* data;
+    size_t size;
+    bool idle = true;
+    // Decode whatever arrived, then publish at most every kPublishIntervalMs
+    while (_ring->BeginRead(data, size)){
+      idle = false;
+      // Messages without a write timestamp get the time they were decoded, close enough for live data
+      decoder.Decode(data, size, sink, Now());
+      _ring->CommitRead();
+      if (std::chrono::steady_clock::now() - last_publish >= std::chrono::milliseconds(kPublishIntervalMs))
+        break;
+    }
+    if (!store.Empty() &&
+        std::chrono::steady_clock::now() - last_publish >= std::chrono::milliseconds(kPublishIntervalMs)){
+      {
+        std::lock_guard<std::mutex> lock(mutex());
+        store.TransferTo(*_field_table, dataMap());
+      }
+      store.Clear();
+      last_publish = std::chrono::steady_clock::now();
+      emit dataReceived();
+    }
+    if (idle)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+// This is an example program that I'm using for development/debugging. It listens on loopback for ten
+// seconds: run ~/build/UdpStreamerExec and replay a capture to 127.0.0.1:5000 (e.g. with tcpreplay).
+int main()
+{
+  UdpStreamer streamer;
+  StreamSettings settings;
+  settings.address = "127.0.0.1";
+  settings.port = 5000;
+  streamer.Start(settings);
+  std::this_thread::sleep_for(std::chrono::seconds(10));
+  streamer.shutdown();
+  std::cout << "Received " << streamer.NumReceived() << " datagrams, dropped " << streamer.NumDropped() << std::endl;
+}
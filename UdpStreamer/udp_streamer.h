@@ -0,0 +1,75 @@
+#pragma once
+
+#include <QObject>
+#include <QtPlugin>
+#include "PlotJuggler/datastreamer_base.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Common/field_table.h"
+#include "Common/spsc_ring.h"
+#include "stream_settings_dialog.h"
+
+using namespace PJ;
+
+// @brief Streams live ECM traffic from a UDP socket (unicast or multicast) into plotjuggler.
+//
+// A receiver thread does nothing but move datagrams from the socket into a lock-free ring, so the
+// socket buffer is drained at full bus rate even while plotjuggler is busy redrawing. A decoder thread
+// decodes them with the same EcmDecoder as the file loaders into a SeriesStore, and publishes the
+// store to plotjuggler every kPublishInterval, taking the streamer's mutex once per batch instead of
+// once per sample.
+class UdpStreamer : public DataStreamer
+{
+  Q_OBJECT
+  Q_PLUGIN_METADATA(IID "facontidavide.PlotJuggler3.DataStreamer")
+  Q_INTERFACES(PJ::DataStreamer)
+
+public:
+  UdpStreamer();
+  ~UdpStreamer() override;
+
+  // @brief this is the entry point that plotjuggler will call. Asks where to listen, then starts.
+  bool start(QStringList* pre_selected_sources) override;
+  void shutdown() override;
+  bool isRunning() const override { return _running; }
+
+  virtual const char* name() const override
+  {
+    return "Elroy UDP";
+  };
+
+  // @brief Start listening without asking. Throws std::runtime_error if the socket can't be opened.
+  void Start(const StreamSettings& settings);
+
+  // Datagrams received, and dropped because the ring was full, since Start. They stay readable after
+  // shutdown().
+  uint64_t NumReceived() const { return _n_received; }
+  uint64_t NumDropped() const { return _n_dropped; }
+
+private:
+  static constexpr size_t kMaxDatagramSize = 65536;
+  // Enough for a few seconds of bus traffic if the decoder falls behind
+  static constexpr size_t kRingSize = size_t(64) << 20;
+  static constexpr int kSocketBufferSize = 16 << 20;
+  static constexpr int kPublishIntervalMs = 50;
+
+  static int OpenSocket(const StreamSettings& settings);
+  void ReceiveLoop();
+  void DecodeLoop();
+
+  int _socket = -1;
+  std::atomic<bool> _running{false};
+  std::thread _receiver;
+  std::thread _decoder;
+  std::unique_ptr<SpscByteRing> _ring;
+  std::atomic<uint64_t> _n_received{0};
+  std::atomic<uint64_t> _n_dropped{0};
+  // Fields aren't bound to dataMap(), whose series must only be touched under mutex()
+  std::unique_ptr<FieldTable> _field_table;
+};